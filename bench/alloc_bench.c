@@ -0,0 +1,259 @@
+// Heap allocations and time per response body: the cJSON trees the
+// handlers used to build against json_t writing into the request arena.
+// Shapes follow get_all_posts (a page of 20 posts) and get_profile.
+//
+// Every malloc, calloc and realloc of the process is counted by the
+// wrappers below, so a path that allocates shows up however it does it.
+
+#include "support.h"
+#include "json.h"
+#include "cJSON.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_POSTS 20
+#define ITERATIONS 20000
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+#define COUNTING 1
+#else
+static size_t allocations = 0;
+#define COUNTING 0
+#endif
+
+typedef struct
+{
+    int id;
+    char header[64];
+    char slug[64];
+    char *content;
+    char username[32];
+    char created_at[32];
+    char updated_at[32];
+    int reading_time;
+    bool is_hidden;
+    char categories[64];
+    char *rendered; // the post as post_render stores it
+} post_t;
+
+static post_t posts[PAGE_POSTS];
+
+static char *lorem(size_t len)
+{
+    static const char words[] = "Lorem ipsum dolor sit amet, consectetur \"adipiscing\" elit.\n";
+    char *s = malloc(len + 1);
+    for (size_t i = 0; i < len; i++)
+        s[i] = words[i % (sizeof(words) - 1)];
+    s[len] = '\0';
+    return s;
+}
+
+static void make_posts(void)
+{
+    for (int i = 0; i < PAGE_POSTS; i++)
+    {
+        post_t *p = &posts[i];
+        p->id = 1000 + i;
+        snprintf(p->header, sizeof(p->header), "Post number %d about something", i);
+        snprintf(p->slug, sizeof(p->slug), "post-number-%d-about-something", i);
+        p->content = lorem(2000 + 97 * (size_t)i);
+        snprintf(p->username, sizeof(p->username), "johndoe");
+        snprintf(p->created_at, sizeof(p->created_at), "2026-10-%02d 12:34:56.789", 1 + i);
+        snprintf(p->updated_at, sizeof(p->updated_at), "2026-10-%02d 13:00:00", 1 + i);
+        p->reading_time = 3;
+        p->is_hidden = false;
+        snprintf(p->categories, sizeof(p->categories), "[{\"id\":1,\"name\":\"C\"},{\"id\":%d,\"name\":\"Perf\"}]", i);
+
+        // Without the closing categories, as json_post expects
+        json_t r;
+        json_init(&r, NULL);
+        json_object_begin(&r);
+        json_key(&r, "id");
+        json_int(&r, p->id);
+        json_key(&r, "header");
+        json_string(&r, p->header);
+        json_key(&r, "slug");
+        json_string(&r, p->slug);
+        json_key(&r, "content");
+        json_string(&r, p->content);
+        json_key(&r, "username");
+        json_string(&r, p->username);
+        json_key(&r, "created_at");
+        json_string(&r, p->created_at);
+        json_key(&r, "updated_at");
+        json_string(&r, p->updated_at);
+        json_key(&r, "reading_time");
+        json_int(&r, p->reading_time);
+        json_key(&r, "is_hidden");
+        json_bool(&r, p->is_hidden);
+        json_object_end(&r);
+        p->rendered = strdup(json_text(&r));
+        json_free(&r);
+    }
+}
+
+// The page as a cJSON tree, printed once at the end
+static size_t page_cjson(Arena *arena)
+{
+    (void)arena;
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *list = cJSON_AddArrayToObject(root, "posts");
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+    {
+        const post_t *p = &posts[i];
+        cJSON *obj = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(obj, "id", p->id);
+        cJSON_AddStringToObject(obj, "header", p->header);
+        cJSON_AddStringToObject(obj, "slug", p->slug);
+        cJSON_AddStringToObject(obj, "content", p->content);
+        cJSON_AddStringToObject(obj, "username", p->username);
+        cJSON_AddStringToObject(obj, "created_at", p->created_at);
+        cJSON_AddStringToObject(obj, "updated_at", p->updated_at);
+        cJSON_AddNumberToObject(obj, "reading_time", p->reading_time);
+        cJSON_AddBoolToObject(obj, "is_hidden", p->is_hidden);
+        cJSON_AddRawToObject(obj, "categories", p->categories);
+
+        cJSON_AddItemToArray(list, obj);
+    }
+
+    cJSON_AddNullToObject(root, "next_cursor");
+
+    char *text = cJSON_PrintUnformatted(root);
+    size_t len = strlen(text);
+
+    cJSON_Delete(root);
+    free(text);
+    return len;
+}
+
+// What get_all_posts does now: rendered posts spliced into the arena
+static size_t page_json_t(Arena *arena)
+{
+    json_t out;
+    json_init(&out, arena);
+    json_object_begin(&out);
+    json_key(&out, "posts");
+    json_array_begin(&out);
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+        json_post(&out, posts[i].rendered, posts[i].categories);
+
+    json_array_end(&out);
+    json_key(&out, "next_cursor");
+    json_null(&out);
+    json_object_end(&out);
+
+    return json_text(&out) ? out.len : 0;
+}
+
+static size_t profile_cjson(Arena *arena)
+{
+    (void)arena;
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddNumberToObject(resp, "id", 42);
+    cJSON_AddStringToObject(resp, "name", "John Doe");
+    cJSON_AddStringToObject(resp, "email", "noone@nowhere.com");
+    cJSON_AddStringToObject(resp, "about", "About John Doe, who writes about C and databases.");
+    cJSON_AddBoolToObject(resp, "is_author", true);
+
+    char *text = cJSON_PrintUnformatted(resp);
+    size_t len = strlen(text);
+
+    cJSON_Delete(resp);
+    free(text);
+    return len;
+}
+
+static size_t profile_json_t(Arena *arena)
+{
+    json_t out;
+    json_init(&out, arena);
+    json_object_begin(&out);
+    json_key(&out, "id");
+    json_int(&out, 42);
+    json_key(&out, "name");
+    json_string(&out, "John Doe");
+    json_key(&out, "email");
+    json_string(&out, "noone@nowhere.com");
+    json_key(&out, "about");
+    json_string(&out, "About John Doe, who writes about C and databases.");
+    json_key(&out, "is_author");
+    json_bool(&out, true);
+    json_object_end(&out);
+
+    return json_text(&out) ? out.len : 0;
+}
+
+static void run(const char *name, size_t (*render)(Arena *), Arena *arena)
+{
+    // Once outside the count, so lazy setup is not charged to it
+    arena_reset(arena);
+    size_t bytes = render(arena);
+
+    size_t before = allocations;
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        arena_reset(arena);
+        render(arena);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    double per_request = (double)(allocations - before) / ITERATIONS;
+
+    if (COUNTING)
+        printf("%-16s %8zu bytes %10.1f allocs %10.2f us\n",
+               name, bytes, per_request, elapsed / 1e3 / ITERATIONS);
+    else
+        printf("%-16s %8zu bytes %10s allocs %10.2f us\n",
+               name, bytes, "n/a", elapsed / 1e3 / ITERATIONS);
+}
+
+int main(void)
+{
+    make_posts();
+
+    // Comfortably larger than a page, like a request arena
+    Arena *arena = arena_new(1 << 20);
+    if (!arena)
+        return 1;
+
+    printf("per response, %d iterations\n", ITERATIONS);
+    run("page cJSON", page_cjson, arena);
+    run("page json_t", page_json_t, arena);
+    run("profile cJSON", profile_cjson, arena);
+    run("profile json_t", profile_json_t, arena);
+
+    arena_delete(arena);
+    return 0;
+}
@@ -0,0 +1,179 @@
+// bind_body against cJSON_Parse + cJSON_GetObjectItem, the way the
+// handlers read bodies before, on login and create_post bodies.
+
+#include "support.h"
+#include "bind.h"
+#include "cJSON.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 200000
+
+typedef struct
+{
+    char *username;
+    char *password;
+} login_t;
+
+static const bind_field_t login_fields[] = {
+    BIND(login_t, username, BIND_STRING, true),
+    BIND(login_t, password, BIND_STRING, true),
+};
+
+typedef struct
+{
+    char *header;
+    char *content;
+    bool is_hidden;
+    int_list_t categories;
+} post_t;
+
+static const bind_field_t post_fields[] = {
+    BIND(post_t, header, BIND_STRING, true),
+    BIND(post_t, content, BIND_STRING, true),
+    BIND(post_t, is_hidden, BIND_BOOL, false),
+    BIND(post_t, categories, BIND_INT_LIST, false),
+};
+
+static size_t login_bind(Arena *arena, const char *body)
+{
+    login_t b;
+    if (bind_body(arena, body, login_fields, BIND_COUNT(login_fields), &b) != BIND_OK)
+        return 0;
+    return strlen(b.username) + strlen(b.password);
+}
+
+static size_t login_cjson(Arena *arena, const char *body)
+{
+    (void)arena;
+
+    cJSON *json = cJSON_Parse(body);
+    if (!json)
+        return 0;
+
+    const cJSON *username = cJSON_GetObjectItem(json, "username");
+    const cJSON *password = cJSON_GetObjectItem(json, "password");
+
+    size_t n = 0;
+    if (cJSON_IsString(username) && cJSON_IsString(password))
+        n = strlen(username->valuestring) + strlen(password->valuestring);
+
+    cJSON_Delete(json);
+    return n;
+}
+
+static size_t post_bind(Arena *arena, const char *body)
+{
+    post_t b;
+    if (bind_body(arena, body, post_fields, BIND_COUNT(post_fields), &b) != BIND_OK)
+        return 0;
+    return strlen(b.header) + strlen(b.content) + (size_t)b.categories.count + b.is_hidden;
+}
+
+static size_t post_cjson(Arena *arena, const char *body)
+{
+    (void)arena;
+
+    cJSON *json = cJSON_Parse(body);
+    if (!json)
+        return 0;
+
+    const cJSON *header = cJSON_GetObjectItem(json, "header");
+    const cJSON *content = cJSON_GetObjectItem(json, "content");
+    const cJSON *is_hidden = cJSON_GetObjectItem(json, "is_hidden");
+    const cJSON *categories = cJSON_GetObjectItem(json, "categories");
+
+    size_t n = 0;
+    if (cJSON_IsString(header) && cJSON_IsString(content))
+    {
+        n = strlen(header->valuestring) + strlen(content->valuestring);
+
+        const cJSON *item;
+        cJSON_ArrayForEach(item, categories)
+        {
+            if (cJSON_IsNumber(item))
+                n++;
+        }
+
+        n += cJSON_IsTrue(is_hidden);
+    }
+
+    cJSON_Delete(json);
+    return n;
+}
+
+static char *make_post_body(size_t content_len)
+{
+    // Prose with the escapes a real post has: quotes and line breaks
+    static const char words[] = "Lorem ipsum dolor sit amet, \\\"consectetur\\\" adipiscing elit.\\n";
+    size_t words_len = sizeof(words) - 1;
+
+    char *content = malloc(content_len + 1);
+    for (size_t i = 0; i < content_len; i++)
+        content[i] = words[i % words_len];
+    content[content_len] = '\0';
+
+    // Never end on half an escape
+    while (content_len && content[content_len - 1] == '\\')
+        content[--content_len] = '\0';
+
+    size_t size = content_len + 256;
+    char *body = malloc(size);
+    snprintf(body, size,
+             "{\"header\":\"A post about \\\"binding\\\" bodies\",\"content\":\"%s\","
+             "\"is_hidden\":false,\"categories\":[1,4,9]}",
+             content);
+
+    free(content);
+    return body;
+}
+
+static void run(const char *name, size_t (*parse)(Arena *, const char *),
+                Arena *arena, const char *body, int iterations)
+{
+    size_t expected = parse(arena, body);
+    if (expected == 0)
+    {
+        printf("%-22s failed to parse\n", name);
+        return;
+    }
+
+    volatile size_t sink = 0;
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        arena_reset(arena);
+        sink += parse(arena, body);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    (void)sink;
+
+    printf("%-22s %8zu bytes %10.0f ns %8.2f GB/s\n", name, strlen(body),
+           (double)elapsed / iterations, (double)strlen(body) * iterations / elapsed);
+}
+
+int main(void)
+{
+    Arena *arena = arena_new(1 << 20);
+    if (!arena)
+        return 1;
+
+    const char *login = "{\"username\":\"johndoe\",\"password\":\"correct horse battery staple\"}";
+    char *post_5k = make_post_body(5 * 1024);
+    char *post_50k = make_post_body(50 * 1024);
+
+    printf("per body\n");
+    run("login bind_body", login_bind, arena, login, ITERATIONS);
+    run("login cJSON", login_cjson, arena, login, ITERATIONS);
+    run("post 5 KB bind_body", post_bind, arena, post_5k, ITERATIONS / 10);
+    run("post 5 KB cJSON", post_cjson, arena, post_5k, ITERATIONS / 10);
+    run("post 50 KB bind_body", post_bind, arena, post_50k, ITERATIONS / 100);
+    run("post 50 KB cJSON", post_cjson, arena, post_50k, ITERATIONS / 100);
+
+    free(post_5k);
+    free(post_50k);
+    arena_delete(arena);
+    return 0;
+}
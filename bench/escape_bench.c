@@ -0,0 +1,144 @@
+// The scans put_escaped uses to find the next byte that needs an
+// escape: scalar, SSE2 and AVX2, on post-sized bodies. They are static
+// in json.c, so it is compiled in here. tests/escape_test.c checks the
+// vector paths against the scalar one.
+
+#include "support.h"
+#include "../src/utils/json.c"
+
+#define SIZES 3
+#define TARGET_BYTES ((size_t)256 << 20) // scanned per size and path
+
+typedef size_t (*scan_fn)(const char *s, size_t len);
+
+static size_t clean_prefix_scalar(const char *s, size_t len)
+{
+    size_t i = 0;
+    while (i < len && !needs_escape((unsigned char)s[i]))
+        i++;
+    return i;
+}
+
+typedef struct
+{
+    const char *name;
+    scan_fn scan;
+} path_t;
+
+static path_t paths[3];
+static int path_count = 0;
+
+static void find_paths(void)
+{
+    paths[path_count++] = (path_t){"scalar", clean_prefix_scalar};
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    paths[path_count++] = (path_t){"sse2", clean_prefix_sse2};
+
+    if (__builtin_cpu_supports("avx2"))
+        paths[path_count++] = (path_t){"avx2", clean_prefix_avx2};
+    else
+        printf("no AVX2 on this CPU, skipping it\n");
+#endif
+}
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Text that never needs an escape, including UTF-8 and DEL
+static void fill_clean(char *s, size_t len)
+{
+    static const char alphabet[] = "abcdefghij klmnopqrstuvwxyz.,;:!?'0123456789\x7f\xc3\xa9\xe2\x82\xac";
+    for (size_t i = 0; i < len; i++)
+        s[i] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+}
+
+// A post body: prose with a quote or a line break every so often
+static char *make_body(size_t len)
+{
+    char *s = malloc(len);
+    fill_clean(s, len);
+
+    for (size_t i = 0; i < len; i += 60 + next_random() % 200)
+        s[i] = (next_random() & 1) ? '\n' : '"';
+
+    return s;
+}
+
+// Scans the whole body the way put_escaped walks it
+static size_t walk(scan_fn scan, const char *s, size_t len)
+{
+    size_t hits = 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        i += scan(s + i, len - i);
+        if (i < len)
+        {
+            hits++;
+            i++;
+        }
+    }
+
+    return hits;
+}
+
+int main(void)
+{
+    find_paths();
+
+    static const size_t sizes[SIZES] = {5 * 1024, 20 * 1024, 50 * 1024};
+
+    printf("%-8s", "size");
+    for (int p = 0; p < path_count; p++)
+        printf("%14s", paths[p].name);
+    printf("%18s\n", "json_string_len");
+
+    for (int s = 0; s < SIZES; s++)
+    {
+        size_t len = sizes[s];
+        char *body = make_body(len);
+        int rounds = (int)(TARGET_BYTES / len);
+
+        printf("%3zu KB  ", len / 1024);
+
+        volatile size_t sink = 0;
+        for (int p = 0; p < path_count; p++)
+        {
+            uint64_t start = now_ns();
+            for (int r = 0; r < rounds; r++)
+                sink += walk(paths[p].scan, body, len);
+            uint64_t elapsed = now_ns() - start;
+
+            printf("%9.2f GB/s", (double)len * rounds / elapsed);
+        }
+
+        // End to end, with whichever scan json.c picks
+        Arena *arena = arena_new(len * 8 + 4096); // room for the doubling
+        uint64_t start = now_ns();
+        for (int r = 0; r < rounds; r++)
+        {
+            arena_reset(arena);
+            json_t out;
+            json_init(&out, arena);
+            json_string_len(&out, body, len);
+            sink += out.len;
+        }
+        uint64_t elapsed = now_ns() - start;
+        printf("%13.2f GB/s\n", (double)len * rounds / elapsed);
+
+        (void)sink;
+        arena_delete(arena);
+        free(body);
+    }
+
+    return 0;
+}
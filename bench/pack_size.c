@@ -0,0 +1,244 @@
+// Size of a get_all_posts page in each response format, raw and
+// deflated, and the time to write it. The posts are `rendered` and
+// `category_list` text as Postgres stores them, spliced the way the
+// handler does: json_post for JSON, pack_post for MessagePack and CBOR.
+//
+// With a directory argument the three pages are also written there, as
+// page.json, page.msgpack and page.cbor, to check with other decoders.
+
+#include "support.h"
+#include "json.h"
+#include "pack.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define PAGE_POSTS 20
+#define ITERATIONS 20000
+
+typedef struct
+{
+    char *rendered;
+    char *categories;
+} post_t;
+
+static post_t posts[PAGE_POSTS];
+
+static const char *category_names[][2] = {
+    {"C", "c"},
+    {"Databases", "databases"},
+    {"Performance", "performance"},
+    {"Networking", "networking"},
+    {"Caf\xc3\xa9 notes", "cafe-notes"},
+};
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Random prose with what post_render leaves of a post: escaped quotes
+// and line breaks, and some UTF-8
+static char *content(size_t len)
+{
+    static const char *words[] = {
+        "the", "a", "of", "and", "to", "in", "is", "that", "for", "it", "with", "as",
+        "server", "request", "response", "database", "query", "index", "latency",
+        "buffer", "arena", "allocation", "connection", "pool", "cache", "page",
+        "cursor", "encoding", "\\\"quoted\\\"", "caf\xc3\xa9", "na\xc3\xafve",
+        "\xe2\x80\x94", "throughput", "benchmark", "kernel", "socket", "thread",
+    };
+    size_t count = sizeof(words) / sizeof(words[0]);
+
+    char *s = malloc(len + 32);
+    size_t n = 0;
+
+    while (n < len)
+    {
+        const char *word = words[next_random() % count];
+        size_t word_len = strlen(word);
+        memcpy(s + n, word, word_len);
+        n += word_len;
+
+        int r = next_random() % 16;
+        const char *sep = r == 0 ? ".\\n\\n" : r < 3 ? ", " : " ";
+        memcpy(s + n, sep, strlen(sep));
+        n += strlen(sep);
+    }
+
+    s[n] = '\0';
+    return s;
+}
+
+static void make_posts(void)
+{
+    char buf[16384];
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+    {
+        char *text = content(600 + 331 * (size_t)i);
+
+        // json_build_object(...)::text spacing
+        snprintf(buf, sizeof(buf),
+                 "{\"id\" : %d, \"header\" : \"Post number %d about something\", "
+                 "\"slug\" : \"post-number-%d-about-something\", \"content\" : \"%s\", "
+                 "\"reading_time\" : %d, \"author_id\" : 42, \"username\" : \"johndoe\", "
+                 "\"created_at\" : \"2026-10-%02d 12:34:56.789+00\", "
+                 "\"updated_at\" : \"2026-10-%02d 13:00:00+00\", \"is_hidden\" : false}",
+                 1000 + i, i, i, text, 1 + i / 4, 1 + i, 1 + i);
+        posts[i].rendered = strdup(buf);
+        free(text);
+
+        // jsonb text: keys by length, one to three categories
+        size_t len = 0;
+        buf[len++] = '[';
+        for (int c = 0; c <= i % 3; c++)
+        {
+            int id = (i + c) % 5;
+            len += (size_t)snprintf(buf + len, sizeof(buf) - len,
+                                    "%s{\"id\": %d, \"slug\": \"%s\", \"category\": \"%s\"}",
+                                    c ? ", " : "", id + 1, category_names[id][1], category_names[id][0]);
+        }
+        buf[len++] = ']';
+        buf[len] = '\0';
+        posts[i].categories = strdup(buf);
+    }
+}
+
+static const char *next_cursor = "MTc5MDAwMDAwMDAwMDAwMDoxMDAw";
+
+static size_t page_json(Arena *arena, const char **data)
+{
+    json_t out;
+    json_init(&out, arena);
+    json_object_begin(&out);
+    json_key(&out, "posts");
+    json_array_begin(&out);
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+        json_post(&out, posts[i].rendered, posts[i].categories);
+
+    json_array_end(&out);
+    json_key(&out, "next_cursor");
+    json_string(&out, next_cursor);
+    json_object_end(&out);
+
+    *data = json_text(&out);
+    return *data ? out.len : 0;
+}
+
+static size_t page_pack(Arena *arena, format_t format, const char **data)
+{
+    pack_t pack;
+    pack_init(&pack, arena, format);
+    pack_map(&pack, 2);
+    pack_string(&pack, "posts");
+    size_t at = pack_open_array(&pack);
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+    {
+        if (!pack_post(&pack, posts[i].rendered, posts[i].categories))
+            return 0;
+    }
+
+    pack_close(&pack, at, PAGE_POSTS);
+    pack_string(&pack, "next_cursor");
+    pack_string(&pack, next_cursor);
+
+    *data = pack.data;
+    return pack.failed ? 0 : pack.len;
+}
+
+static size_t page_msgpack(Arena *arena, const char **data)
+{
+    return page_pack(arena, FORMAT_MSGPACK, data);
+}
+
+static size_t page_cbor(Arena *arena, const char **data)
+{
+    return page_pack(arena, FORMAT_CBOR, data);
+}
+
+// At level 6, the default GZIP_LEVEL
+static size_t deflated(const char *data, size_t len)
+{
+    uLongf size = compressBound(len);
+    Bytef *out = malloc(size);
+    if (!out || compress2(out, &size, (const Bytef *)data, len, 6) != Z_OK)
+        size = 0;
+
+    free(out);
+    return size;
+}
+
+static void save(const char *dir, const char *name, const char *data, size_t len)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, len, f) != len)
+        fprintf(stderr, "could not write %s\n", path);
+    if (f)
+        fclose(f);
+}
+
+static void run(const char *name, const char *file, const char *dir,
+                size_t (*render)(Arena *, const char **), Arena *arena, size_t json_len)
+{
+    const char *data;
+    arena_reset(arena);
+    size_t len = render(arena, &data);
+    if (!len)
+    {
+        printf("%-8s failed\n", name);
+        return;
+    }
+
+    size_t packed = deflated(data, len);
+    if (dir)
+        save(dir, file, data, len);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        arena_reset(arena);
+        render(arena, &data);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    printf("%-8s %8zu bytes %6.1f%% %8zu deflated %8.2f us\n", name, len,
+           100.0 * (double)len / (double)json_len, packed, elapsed / 1e3 / ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : NULL;
+
+    make_posts();
+
+    Arena *arena = arena_new(1 << 20);
+    if (!arena)
+        return 1;
+
+    const char *data;
+    size_t json_len = page_json(arena, &data);
+
+    printf("a page of %d posts, sizes against JSON\n", PAGE_POSTS);
+    run("json", "page.json", dir, page_json, arena, json_len);
+    run("msgpack", "page.msgpack", dir, page_msgpack, arena, json_len);
+    run("cbor", "page.cbor", dir, page_cbor, arena, json_len);
+
+    for (int i = 0; i < PAGE_POSTS; i++)
+    {
+        free(posts[i].rendered);
+        free(posts[i].categories);
+    }
+    arena_delete(arena);
+    return 0;
+}
@@ -0,0 +1,46 @@
+// k6 load script for the list routes PG_JSON_ROUTES can move into
+// Postgres: /users, /user/:user/posts and /user/:user/filter/posts.
+// It only reads, anonymously, so only public posts are listed.
+//
+// scripts/pg_json_routes.sh runs it and records where the CPU went,
+// see the README. On its own:
+//
+//   k6 run -e BASE_URL=http://localhost:3000 -e USERNAME=johndoe \
+//          -e CATEGORY=programming scripts/pg_json_routes.js
+
+import http from 'k6/http';
+import { check } from 'k6';
+import { Trend } from 'k6/metrics';
+
+const BASE_URL = __ENV.BASE_URL || 'http://localhost:3000';
+const USERNAME = __ENV.USERNAME || 'johndoe';
+const CATEGORY = __ENV.CATEGORY || 'programming';
+const LIMIT = __ENV.LIMIT || '20';
+
+const usersLatency = new Trend('users_ms', true);
+const postsLatency = new Trend('posts_ms', true);
+const categoryLatency = new Trend('category_posts_ms', true);
+
+export const options = {
+    vus: Number(__ENV.VUS || 16),
+    duration: __ENV.DURATION || '60s',
+    summaryTrendStats: ['avg', 'p(50)', 'p(90)', 'p(99)', 'max'],
+};
+
+// Uncompressed JSON, so compression does not blur the comparison
+const PARAMS = { headers: { 'Accept': 'application/json', 'Accept-Encoding': 'identity' } };
+
+export default function () {
+    const users = http.get(`${BASE_URL}/users`, PARAMS);
+    usersLatency.add(users.timings.duration);
+    check(users, { 'users': (r) => r.status === 200 });
+
+    const posts = http.get(`${BASE_URL}/user/${USERNAME}/posts?limit=${LIMIT}`, PARAMS);
+    postsLatency.add(posts.timings.duration);
+    check(posts, { 'posts': (r) => r.status === 200 });
+
+    const category = http.get(
+        `${BASE_URL}/user/${USERNAME}/filter/posts?category=${CATEGORY}&limit=${LIMIT}`, PARAMS);
+    categoryLatency.add(category.timings.duration);
+    check(category, { 'category posts': (r) => r.status === 200 });
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+# One run of scripts/pg_json_routes.js against a running server, with the
+# CPU the server process and Postgres spent on it. Run it once against a
+# server started without PG_JSON_ROUTES and once against one started with
+# PG_JSON_ROUTES=users,posts,category_posts, then compare the two.
+#
+#   SERVER_PID=$(pgrep -n server) scripts/pg_json_routes.sh
+#
+# Database time comes from pg_stat_statements, which must be loaded
+# (shared_preload_libraries = 'pg_stat_statements', then
+# CREATE EXTENSION pg_stat_statements). Its counters are reset at the
+# start of the run, so run nothing else against the database meanwhile.
+# psql connects with the usual PGHOST, PGDATABASE, PGUSER, ... variables.
+#
+# Other settings are passed to k6: BASE_URL, USERNAME, CATEGORY, LIMIT,
+# VUS, DURATION.
+
+set -eu
+
+if [ -z "${SERVER_PID:-}" ] || [ ! -r "/proc/$SERVER_PID/stat" ]; then
+    echo "set SERVER_PID to the server's process id" >&2
+    exit 1
+fi
+
+# utime + stime of the server, in clock ticks
+server_ticks() {
+    awk '{ print $14 + $15 }' "/proc/$SERVER_PID/stat"
+}
+
+psql -qAtc "SELECT pg_stat_statements_reset()" >/dev/null
+before=$(server_ticks)
+
+k6 run \
+    -e BASE_URL="${BASE_URL:-http://localhost:3000}" \
+    -e USERNAME="${USERNAME:-johndoe}" \
+    -e CATEGORY="${CATEGORY:-programming}" \
+    -e LIMIT="${LIMIT:-20}" \
+    -e VUS="${VUS:-16}" \
+    -e DURATION="${DURATION:-60s}" \
+    "$(dirname "$0")/pg_json_routes.js"
+
+after=$(server_ticks)
+hz=$(getconf CLK_TCK)
+
+echo
+echo "PG_JSON_ROUTES of the server: $(tr '\0' '\n' < "/proc/$SERVER_PID/environ" 2>/dev/null \
+    | sed -n 's/^PG_JSON_ROUTES=//p' | grep . || echo '(unset)')"
+echo "server CPU: $(awk -v t="$((after - before))" -v hz="$hz" 'BEGIN { printf "%.2f", t / hz }') s"
+echo
+echo "Postgres time per statement (ms):"
+psql -qc "
+    SELECT calls,
+           round(total_exec_time::numeric, 1) AS total_ms,
+           round(mean_exec_time::numeric, 3) AS mean_ms,
+           left(regexp_replace(query, '\s+', ' ', 'g'), 70) AS query
+    FROM pg_stat_statements
+    WHERE query ILIKE '%posts%' OR query ILIKE '%users%'
+    ORDER BY total_exec_time DESC
+    LIMIT 10"
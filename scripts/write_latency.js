@@ -0,0 +1,67 @@
+// k6 load script for the write path: create a post, then edit it, so
+// both pipelined batches (create_post, edit_post) are measured.
+//
+// Run it once against a server started with the default pipeline and
+// once with DB_PIPELINE=off, then compare the p(50)/p(99) lines:
+//
+//   k6 run -e BASE_URL=http://localhost:3000 -e USERNAME=johndoe \
+//          -e PASSWORD=123123 scripts/write_latency.js
+//
+// The user must exist. Every iteration leaves one post behind.
+
+import http from 'k6/http';
+import { check } from 'k6';
+import { Trend } from 'k6/metrics';
+
+const BASE_URL = __ENV.BASE_URL || 'http://localhost:3000';
+const USERNAME = __ENV.USERNAME || 'johndoe';
+const PASSWORD = __ENV.PASSWORD || '123123';
+
+const createLatency = new Trend('create_post_ms', true);
+const editLatency = new Trend('edit_post_ms', true);
+
+export const options = {
+    vus: Number(__ENV.VUS || 16),
+    duration: __ENV.DURATION || '60s',
+    summaryTrendStats: ['avg', 'p(50)', 'p(90)', 'p(99)', 'max'],
+};
+
+const JSON_HEADERS = { headers: { 'Content-Type': 'application/json' } };
+
+// A few KB, close to a real post
+const CONTENT = 'Lorem ipsum dolor sit amet, consectetur adipiscing elit. '.repeat(60);
+
+let loggedIn = false;
+
+function login() {
+    const res = http.post(`${BASE_URL}/login`,
+        JSON.stringify({ username: USERNAME, password: PASSWORD }), JSON_HEADERS);
+
+    // Each VU has its own cookie jar, so the session sticks to it
+    check(res, { 'logged in': (r) => r.status === 200 });
+    loggedIn = res.status === 200;
+}
+
+export default function () {
+    if (!loggedIn) {
+        login();
+        if (!loggedIn)
+            return;
+    }
+
+    // Lowercase and dash-separated, so the slug is the header itself
+    const header = `bench-${__VU}-${__ITER}-${Date.now()}`;
+
+    const created = http.post(`${BASE_URL}/create/post`,
+        JSON.stringify({ header, content: CONTENT, is_hidden: false }), JSON_HEADERS);
+    createLatency.add(created.timings.duration);
+    check(created, { 'created': (r) => r.status === 201 });
+
+    if (created.status !== 201)
+        return;
+
+    const edited = http.put(`${BASE_URL}/user/${USERNAME}/posts/${header}`,
+        JSON.stringify({ header, content: CONTENT + ' Edited.', is_hidden: false }), JSON_HEADERS);
+    editLatency.add(edited.timings.duration);
+    check(edited, { 'edited': (r) => r.status === 200 });
+}
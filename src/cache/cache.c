@@ -0,0 +1,398 @@
+#include "cache.h"
+#include "uv.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_INITIAL_BUCKETS 256
+#define CACHE_TOMBSTONES 64
+
+typedef struct entry
+{
+    struct entry *bucket_next;
+    struct entry *lru_prev; // towards most recently used
+    struct entry *lru_next;
+    uint64_t hash;
+    uint64_t expires_at; // 0 when the cache has no TTL
+    size_t key_len;
+    size_t len;
+    char *key;   // both live in the same allocation as the entry
+    char *value;
+} entry_t;
+
+typedef struct
+{
+    char *key;
+    bool prefix;
+    uint64_t at;
+} tombstone_t;
+
+struct cache
+{
+    entry_t **buckets;
+    size_t bucket_count;
+
+    entry_t *lru_head; // most recently used
+    entry_t *lru_tail;
+
+    size_t max_bytes;
+    uint64_t settle_ms;
+    uint64_t ttl_ms;
+
+    // Recent invalidations, oldest overwritten first
+    tombstone_t tombstones[CACHE_TOMBSTONES];
+    int tombstone_next;
+
+    // Overwriting a tombstone still in its settle window forgets which
+    // key it protected, so every put is refused until it would have ended
+    uint64_t overflow_until;
+
+    cache_stats_t stats;
+};
+
+static uint64_t hash_key(const char *key, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static size_t entry_size(const entry_t *entry)
+{
+    return sizeof(entry_t) + entry->key_len + entry->len + 2;
+}
+
+static uint64_t now_ms(void)
+{
+    return uv_now(uv_default_loop());
+}
+
+cache_t *cache_create(size_t max_bytes, uint64_t settle_ms)
+{
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if (!cache)
+        return NULL;
+
+    cache->buckets = calloc(CACHE_INITIAL_BUCKETS, sizeof(entry_t *));
+    if (!cache->buckets)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    cache->bucket_count = CACHE_INITIAL_BUCKETS;
+    cache->max_bytes = max_bytes;
+    cache->settle_ms = settle_ms;
+    cache->stats.max_bytes = max_bytes;
+    return cache;
+}
+
+void cache_set_ttl(cache_t *cache, uint64_t ttl_ms)
+{
+    if (cache)
+        cache->ttl_ms = ttl_ms;
+}
+
+void cache_destroy(cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    entry_t *entry = cache->lru_head;
+    while (entry)
+    {
+        entry_t *next = entry->lru_next;
+        free(entry);
+        entry = next;
+    }
+
+    for (int i = 0; i < CACHE_TOMBSTONES; i++)
+        free(cache->tombstones[i].key);
+
+    free(cache->buckets);
+    free(cache);
+}
+
+static entry_t **find_slot(cache_t *cache, const char *key, size_t key_len, uint64_t hash)
+{
+    entry_t **slot = &cache->buckets[hash & (cache->bucket_count - 1)];
+
+    while (*slot)
+    {
+        entry_t *entry = *slot;
+        if (entry->hash == hash && entry->key_len == key_len &&
+            memcmp(entry->key, key, key_len) == 0)
+        {
+            break;
+        }
+        slot = &entry->bucket_next;
+    }
+
+    return slot;
+}
+
+static void lru_unlink(cache_t *cache, entry_t *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(cache_t *cache, entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = entry;
+    else
+        cache->lru_tail = entry;
+
+    cache->lru_head = entry;
+}
+
+static void remove_entry(cache_t *cache, entry_t *entry)
+{
+    entry_t **slot = find_slot(cache, entry->key, entry->key_len, entry->hash);
+    *slot = entry->bucket_next;
+
+    lru_unlink(cache, entry);
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry_size(entry);
+    free(entry);
+}
+
+static void grow(cache_t *cache)
+{
+    size_t count = cache->bucket_count * 2;
+    entry_t **buckets = calloc(count, sizeof(entry_t *));
+    if (!buckets)
+        return; // keep working with longer chains
+
+    for (size_t i = 0; i < cache->bucket_count; i++)
+    {
+        entry_t *entry = cache->buckets[i];
+        while (entry)
+        {
+            entry_t *next = entry->bucket_next;
+            entry_t **slot = &buckets[entry->hash & (count - 1)];
+            entry->bucket_next = *slot;
+            *slot = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = count;
+}
+
+static bool settling(const cache_t *cache, const char *key)
+{
+    uint64_t now = now_ms();
+
+    if (now < cache->overflow_until)
+        return true;
+
+    for (int i = 0; i < CACHE_TOMBSTONES; i++)
+    {
+        const tombstone_t *t = &cache->tombstones[i];
+        if (!t->key || now - t->at >= cache->settle_ms)
+            continue;
+
+        bool match = t->prefix
+                         ? strncmp(key, t->key, strlen(t->key)) == 0
+                         : strcmp(key, t->key) == 0;
+        if (match)
+            return true;
+    }
+
+    return false;
+}
+
+static void add_tombstone(cache_t *cache, const char *key, bool prefix)
+{
+    if (cache->settle_ms == 0)
+        return;
+
+    tombstone_t *t = &cache->tombstones[cache->tombstone_next];
+    cache->tombstone_next = (cache->tombstone_next + 1) % CACHE_TOMBSTONES;
+
+    uint64_t now = now_ms();
+    if (t->key && now - t->at < cache->settle_ms && t->at + cache->settle_ms > cache->overflow_until)
+        cache->overflow_until = t->at + cache->settle_ms;
+
+    free(t->key);
+    t->key = strdup(key);
+    t->prefix = prefix;
+    t->at = now;
+
+    // A tombstone that could not be kept is forgotten as well
+    if (!t->key)
+        cache->overflow_until = now + cache->settle_ms;
+}
+
+const char *cache_get(cache_t *cache, const char *key, size_t *len)
+{
+    if (!cache || !key)
+        return NULL;
+
+    size_t key_len = strlen(key);
+    entry_t *entry = *find_slot(cache, key, key_len, hash_key(key, key_len));
+
+    if (entry && entry->expires_at && now_ms() >= entry->expires_at)
+    {
+        remove_entry(cache, entry);
+        cache->stats.expired++;
+        entry = NULL;
+    }
+
+    if (!entry)
+    {
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    cache->stats.hits++;
+
+    if (cache->lru_head != entry)
+    {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+    }
+
+    if (len)
+        *len = entry->len;
+
+    return entry->value;
+}
+
+void cache_put(cache_t *cache, const char *key, const char *value, size_t len)
+{
+    if (!cache || !key || !value)
+        return;
+
+    size_t key_len = strlen(key);
+    size_t size = sizeof(entry_t) + key_len + len + 2;
+
+    // One huge body should not flush everything else
+    if (size > cache->max_bytes / 4 || settling(cache, key))
+    {
+        cache->stats.rejected++;
+        return;
+    }
+
+    uint64_t hash = hash_key(key, key_len);
+    entry_t *old = *find_slot(cache, key, key_len, hash);
+    if (old)
+        remove_entry(cache, old);
+
+    while (cache->lru_tail && cache->stats.bytes + size > cache->max_bytes)
+    {
+        remove_entry(cache, cache->lru_tail);
+        cache->stats.evictions++;
+    }
+
+    entry_t *entry = malloc(size);
+    if (!entry)
+        return;
+
+    entry->hash = hash;
+    entry->expires_at = cache->ttl_ms ? now_ms() + cache->ttl_ms : 0;
+    entry->key_len = key_len;
+    entry->len = len;
+    entry->key = (char *)(entry + 1);
+    entry->value = entry->key + key_len + 1;
+
+    memcpy(entry->key, key, key_len + 1);
+    memcpy(entry->value, value, len);
+    entry->value[len] = '\0';
+
+    if (cache->stats.entries >= cache->bucket_count - cache->bucket_count / 4)
+        grow(cache);
+
+    entry_t **slot = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->bucket_next = *slot;
+    *slot = entry;
+
+    lru_push_front(cache, entry);
+
+    cache->stats.entries++;
+    cache->stats.bytes += size;
+}
+
+void cache_remove(cache_t *cache, const char *key)
+{
+    if (!cache || !key)
+        return;
+
+    add_tombstone(cache, key, false);
+
+    size_t key_len = strlen(key);
+    entry_t *entry = *find_slot(cache, key, key_len, hash_key(key, key_len));
+    if (!entry)
+        return;
+
+    remove_entry(cache, entry);
+    cache->stats.invalidations++;
+}
+
+void cache_remove_prefix(cache_t *cache, const char *prefix)
+{
+    if (!cache || !prefix)
+        return;
+
+    add_tombstone(cache, prefix, true);
+
+    // Walks every entry, meant for rare writes like category edits
+    size_t prefix_len = strlen(prefix);
+    entry_t *entry = cache->lru_head;
+
+    while (entry)
+    {
+        entry_t *next = entry->lru_next;
+
+        if (entry->key_len >= prefix_len && memcmp(entry->key, prefix, prefix_len) == 0)
+        {
+            remove_entry(cache, entry);
+            cache->stats.invalidations++;
+        }
+
+        entry = next;
+    }
+}
+
+void cache_stats(const cache_t *cache, cache_stats_t *out)
+{
+    if (!cache)
+    {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    *out = cache->stats;
+}
+
+void cache_each_key(const cache_t *cache, size_t max, cache_key_cb cb, void *data)
+{
+    if (!cache)
+        return;
+
+    size_t n = 0;
+    for (const entry_t *entry = cache->lru_head; entry && n < max; entry = entry->lru_next, n++)
+        cb(entry->key, data);
+}
@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size-bounded LRU map from string keys to response bodies. Everything
+// runs on the event loop thread, so there is no locking.
+//
+// Entries that were just invalidated may still be re-filled by a read
+// that started before the write, or by a replica that has not replayed
+// it yet. To keep that stale copy out, puts on a key (or prefix)
+// invalidated in the last settle_ms are dropped. Past the number of
+// invalidations it can remember in that window, all puts are dropped
+// until the forgotten ones have settled.
+
+typedef struct cache cache_t;
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t rejected; // puts dropped by the settle window or the size limit
+    uint64_t expired;
+    size_t entries;
+    size_t bytes;
+    size_t max_bytes;
+} cache_stats_t;
+
+cache_t *cache_create(size_t max_bytes, uint64_t settle_ms);
+void cache_destroy(cache_t *cache);
+
+// Entries put from now on expire after ttl_ms, 0 keeps them until evicted
+void cache_set_ttl(cache_t *cache, uint64_t ttl_ms);
+
+// The body stays valid until the next put or remove on this cache
+const char *cache_get(cache_t *cache, const char *key, size_t *len);
+
+void cache_put(cache_t *cache, const char *key, const char *value, size_t len);
+void cache_remove(cache_t *cache, const char *key);
+void cache_remove_prefix(cache_t *cache, const char *prefix);
+
+void cache_stats(const cache_t *cache, cache_stats_t *out);
+
+typedef void (*cache_key_cb)(const char *key, void *data);
+
+// Up to max keys, most recently used first. Expired entries included.
+void cache_each_key(const cache_t *cache, size_t max, cache_key_cb cb, void *data);
+
+#endif
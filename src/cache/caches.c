@@ -0,0 +1,434 @@
+#include "caches.h"
+#include "utils.h"
+#include "notify.h"
+#include "db.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keeps usernames and slugs apart in keys, neither can contain it
+#define KEY_SEP "\x1f"
+
+// Stands in for the slug in a profile's keys
+#define PROFILE_KEY "@"
+
+// First byte of a notify payload, followed by the key parts
+#define NOTIFY_POST 'p'
+#define NOTIFY_USER 'u'
+#define NOTIFY_MISSING_POST 'm'
+#define NOTIFY_MISSING_USER 'n'
+#define NOTIFY_USER_ID 'i'
+
+// Same lifetime as the session cookie set by login
+#define AUTH_TTL_MS (3600 * 1000)
+
+// CACHE_SETTLE_MS when there is no replica
+#define SETTLE_MS 2000
+
+// On top of the replica's staleness, for the read query itself
+#define SETTLE_MARGIN_MS 1000
+
+static cache_t *posts = NULL;
+static cache_t *missing = NULL;
+static cache_t *auth = NULL;
+static cache_t *user_ids = NULL;
+
+static void on_notify(const char *payload);
+
+int caches_init(void)
+{
+    size_t post_bytes = (size_t)env_int("POST_CACHE_MB", 32) * 1024 * 1024;
+    size_t missing_bytes = (size_t)env_int("MISS_CACHE_KB", 1024) * 1024;
+    uint64_t missing_ttl_ms = (uint64_t)env_int("MISS_CACHE_TTL_MS", 30000);
+    size_t auth_bytes = (size_t)env_int("AUTH_CACHE_KB", 1024) * 1024;
+    size_t user_id_bytes = (size_t)env_int("USER_ID_CACHE_KB", 1024) * 1024;
+
+    // A put is only refused while a replica may still return the row
+    // from before the write, so the window has to outlast that
+    uint64_t stale_ms = (uint64_t)db_read_staleness_ms() + SETTLE_MARGIN_MS;
+    uint64_t settle_ms = (uint64_t)env_int("CACHE_SETTLE_MS", stale_ms > SETTLE_MS ? (int)stale_ms : SETTLE_MS);
+
+    if (db_read_staleness_ms() > 0 && settle_ms < stale_ms)
+        fprintf(stderr, "[Cache] CACHE_SETTLE_MS=%llu is below the replica's %llu ms, "
+                        "stale posts may be cached\n",
+                (unsigned long long)settle_ms, (unsigned long long)stale_ms);
+
+    posts = cache_create(post_bytes, settle_ms);
+    missing = cache_create(missing_bytes, settle_ms);
+    auth = cache_create(auth_bytes, settle_ms);
+    user_ids = cache_create(user_id_bytes, settle_ms);
+
+    if (!posts || !missing || !auth || !user_ids)
+    {
+        fprintf(stderr, "[Cache] Failed to create caches\n");
+        caches_cleanup();
+        return -1;
+    }
+
+    cache_set_ttl(missing, missing_ttl_ms);
+    cache_set_ttl(auth, AUTH_TTL_MS);
+
+    db_notify_subscribe(on_notify);
+
+    printf("[Cache] Post cache: %zu MB, miss cache: %zu KB for %llu ms, auth cache: %zu KB, "
+           "settle: %llu ms\n",
+           post_bytes / (1024 * 1024), missing_bytes / 1024,
+           (unsigned long long)missing_ttl_ms, auth_bytes / 1024, (unsigned long long)settle_ms);
+    return 0;
+}
+
+void caches_cleanup(void)
+{
+    db_notify_subscribe(NULL);
+
+    cache_destroy(posts);
+    cache_destroy(missing);
+    cache_destroy(auth);
+    cache_destroy(user_ids);
+    posts = NULL;
+    missing = NULL;
+    auth = NULL;
+    user_ids = NULL;
+}
+
+cache_t *post_cache(void)
+{
+    return posts;
+}
+
+cache_t *miss_cache(void)
+{
+    return missing;
+}
+
+cache_t *auth_cache(void)
+{
+    return auth;
+}
+
+cache_t *user_id_cache(void)
+{
+    return user_ids;
+}
+
+char *post_cache_key(Arena *arena, const char *username, const char *slug, bool is_author)
+{
+    return arena_sprintf(arena, "%s" KEY_SEP "%s" KEY_SEP "%c",
+                         username, slug, is_author ? 'a' : 'p');
+}
+
+char *profile_cache_key(Arena *arena, const char *username, bool is_author)
+{
+    return post_cache_key(arena, username, PROFILE_KEY, is_author);
+}
+
+// An entry is the length of each encoding, 0 for the ones it lacks,
+// then their bytes in the same order, identity first
+typedef uint32_t lengths_t[ENCODING_COUNT];
+
+void post_cache_put(const char *key, const char *body, size_t len,
+                    Arena *arena, encoding_t encoding, encoded_body_t *out)
+{
+    char *encoded[ENCODING_COUNT] = {0};
+    lengths_t lengths = {0};
+    size_t total = sizeof(lengths_t) + len;
+
+    lengths[ENCODING_IDENTITY] = (uint32_t)len;
+
+    for (int e = ENCODING_IDENTITY + 1; e < ENCODING_COUNT; e++)
+    {
+        if (!encoding_available((encoding_t)e) || !worth_compressing(len))
+            continue;
+
+        size_t n = 0;
+        encoded[e] = compress_body(arena, (encoding_t)e, body, len, &n);
+        if (encoded[e])
+        {
+            lengths[e] = (uint32_t)n;
+            total += n;
+        }
+    }
+
+    char *entry = malloc(total);
+    if (entry)
+    {
+        memcpy(entry, lengths, sizeof(lengths_t));
+
+        char *p = entry + sizeof(lengths_t);
+        memcpy(p, body, len);
+        p += len;
+
+        for (int e = ENCODING_IDENTITY + 1; e < ENCODING_COUNT; e++)
+        {
+            if (!encoded[e])
+                continue;
+            memcpy(p, encoded[e], lengths[e]);
+            p += lengths[e];
+        }
+
+        cache_put(posts, key, entry, total);
+        free(entry);
+    }
+
+    if (out)
+    {
+        memset(out, 0, sizeof(*out));
+        out->data = body;
+        out->len = len;
+
+        if (encoded[encoding])
+        {
+            out->encoding = encoding;
+            out->encoded = encoded[encoding];
+            out->encoded_len = lengths[encoding];
+        }
+    }
+
+    if (arena)
+        return;
+
+    for (int e = 0; e < ENCODING_COUNT; e++)
+        free(encoded[e]);
+}
+
+bool post_cache_get(const char *key, encoding_t encoding, encoded_body_t *out)
+{
+    size_t total = 0;
+    const char *entry = cache_get(posts, key, &total);
+    if (!entry || total < sizeof(lengths_t))
+        return false;
+
+    lengths_t lengths;
+    memcpy(lengths, entry, sizeof(lengths_t));
+
+    const char *p = entry + sizeof(lengths_t);
+    memset(out, 0, sizeof(*out));
+    out->data = p;
+    out->len = lengths[ENCODING_IDENTITY];
+
+    if (encoding == ENCODING_IDENTITY || lengths[encoding] == 0)
+        return true;
+
+    p += lengths[ENCODING_IDENTITY];
+    for (int e = ENCODING_IDENTITY + 1; e < (int)encoding; e++)
+        p += lengths[e];
+
+    out->encoding = encoding;
+    out->encoded = p;
+    out->encoded_len = lengths[encoding];
+    return true;
+}
+
+static void write_key(const char *key, void *data)
+{
+    FILE *file = (FILE *)data;
+    fprintf(file, "%s\n", key);
+}
+
+int save_cache_snapshot(const char *path, size_t max)
+{
+    size_t size = strlen(path) + 5;
+    char *tmp = malloc(size);
+    if (!tmp)
+        return -1;
+
+    // Written aside and renamed, a crash never leaves half a file
+    snprintf(tmp, size, "%s.tmp", path);
+
+    FILE *file = fopen(tmp, "w");
+    if (!file)
+    {
+        fprintf(stderr, "[Cache] Cannot write snapshot %s\n", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    cache_each_key(posts, max, write_key, file);
+
+    int rc = (fclose(file) == 0 && rename(tmp, path) == 0) ? 0 : -1;
+    if (rc != 0)
+        fprintf(stderr, "[Cache] Cannot save snapshot %s\n", path);
+
+    free(tmp);
+    return rc;
+}
+
+// malloc'd, so it also works from callbacks that have no arena handy
+static char *make_key(const char *username, const char *slug, const char *view)
+{
+    size_t size = strlen(username) + strlen(slug) + strlen(view) + 3;
+    char *key = malloc(size);
+    if (key)
+        snprintf(key, size, "%s" KEY_SEP "%s" KEY_SEP "%s", username, slug, view);
+    return key;
+}
+
+static void remove_key(cache_t *cache, const char *username, const char *slug, const char *view)
+{
+    char *key = make_key(username, slug, view);
+    if (!key)
+        return;
+
+    cache_remove(cache, key);
+    free(key);
+}
+
+static void remove_user(cache_t *cache, const char *username)
+{
+    size_t size = strlen(username) + 2;
+    char *prefix = malloc(size);
+    if (!prefix)
+        return;
+
+    snprintf(prefix, size, "%s" KEY_SEP, username);
+    cache_remove_prefix(cache, prefix);
+    free(prefix);
+}
+
+static void publish(char kind, const char *username, const char *slug)
+{
+    size_t size = strlen(username) + (slug ? strlen(slug) + 1 : 0) + 2;
+    char *payload = malloc(size);
+    if (!payload)
+        return;
+
+    if (slug)
+        snprintf(payload, size, "%c%s" KEY_SEP "%s", kind, username, slug);
+    else
+        snprintf(payload, size, "%c%s", kind, username);
+
+    db_notify(payload);
+    free(payload);
+}
+
+static void drop_post(const char *username, const char *slug)
+{
+    remove_key(posts, username, slug, "a");
+    remove_key(posts, username, slug, "p");
+}
+
+static void drop_missing_post(const char *username, const char *slug)
+{
+    remove_key(missing, username, slug, "a");
+    remove_key(missing, username, slug, "p");
+}
+
+void post_cache_invalidate(const char *username, const char *slug)
+{
+    drop_post(username, slug);
+    publish(NOTIFY_POST, username, slug);
+}
+
+void post_cache_invalidate_user(const char *username)
+{
+    remove_user(posts, username);
+    publish(NOTIFY_USER, username, NULL);
+}
+
+bool is_missing(const char *key)
+{
+    return cache_get(missing, key, NULL) != NULL;
+}
+
+void remember_missing(const char *key)
+{
+    cache_put(missing, key, "", 0);
+}
+
+char *profile_miss_key(Arena *arena, const char *username)
+{
+    return arena_sprintf(arena, "%s" KEY_SEP PROFILE_KEY KEY_SEP, username);
+}
+
+void forget_missing_post(const char *username, const char *slug)
+{
+    drop_missing_post(username, slug);
+    publish(NOTIFY_MISSING_POST, username, slug);
+}
+
+void forget_missing_user(const char *username)
+{
+    remove_user(missing, username);
+    publish(NOTIFY_MISSING_USER, username, NULL);
+}
+
+char *cached_user_id(Arena *arena, const char *username)
+{
+    const char *id = cache_get(user_ids, username, NULL);
+    if (!id)
+        return NULL;
+
+    return arena_strdup(arena, id);
+}
+
+void remember_user_id(const char *username, const char *id)
+{
+    cache_put(user_ids, username, id, strlen(id));
+}
+
+void forget_user_id(const char *username)
+{
+    cache_remove(user_ids, username);
+    publish(NOTIFY_USER_ID, username, NULL);
+}
+
+void forget_auth(const char *session_id)
+{
+    cache_remove(auth, session_id);
+}
+
+// Applies another process's invalidation, without publishing it again
+static void on_notify(const char *payload)
+{
+    // The bus was down, or a peer dropped invalidations it could not
+    // queue: anything may be stale. Sessions are per process, so the
+    // auth cache is not affected.
+    if (!payload)
+    {
+        printf("[Cache] Notifications were missed, flushing\n");
+        cache_remove_prefix(posts, "");
+        cache_remove_prefix(missing, "");
+        cache_remove_prefix(user_ids, "");
+        return;
+    }
+
+    char kind = payload[0];
+    const char *username = payload + 1;
+
+    if (kind == NOTIFY_USER)
+    {
+        remove_user(posts, username);
+        return;
+    }
+
+    if (kind == NOTIFY_MISSING_USER)
+    {
+        remove_user(missing, username);
+        return;
+    }
+
+    if (kind == NOTIFY_USER_ID)
+    {
+        cache_remove(user_ids, username);
+        return;
+    }
+
+    const char *sep = strchr(username, KEY_SEP[0]);
+    if (!sep)
+        return;
+
+    size_t len = (size_t)(sep - username);
+    char *user = malloc(len + 1);
+    if (!user)
+        return;
+
+    memcpy(user, username, len);
+    user[len] = '\0';
+
+    if (kind == NOTIFY_POST)
+        drop_post(user, sep + 1);
+    else if (kind == NOTIFY_MISSING_POST)
+        drop_missing_post(user, sep + 1);
+
+    free(user);
+}
@@ -0,0 +1,72 @@
+#ifndef CACHES_H
+#define CACHES_H
+
+#include "ecewo.h"
+#include "cache.h"
+#include "compress.h"
+#include <stdbool.h>
+
+// The app's cache instances, sized from the environment
+
+int caches_init(void);
+void caches_cleanup(void);
+
+// Rendered get_post and get_profile bodies, keyed by (username, post
+// slug, is_author)
+cache_t *post_cache(void);
+
+char *post_cache_key(Arena *arena, const char *username, const char *slug, bool is_author);
+
+// Post cache entries hold the body together with every encoding built
+// in, compressed once here, so hits are sent without compressing again.
+// With an arena, the compressed forms are made there and out is set to
+// the body in encoding, to send it without compressing it twice.
+void post_cache_put(const char *key, const char *body, size_t len,
+                    Arena *arena, encoding_t encoding, encoded_body_t *out);
+
+// The body, and its form in encoding if it was large enough to have one
+bool post_cache_get(const char *key, encoding_t encoding, encoded_body_t *out);
+
+// Profiles share the post cache, under a key no post slug can take
+char *profile_cache_key(Arena *arena, const char *username, bool is_author);
+
+// Writes the keys of the most recently used responses to path, one per
+// line, so the next start can render them again before it listens
+int save_cache_snapshot(const char *path, size_t max);
+
+// Both the author's and the public view of one post
+void post_cache_invalidate(const char *username, const char *slug);
+
+// Every post of a user, e.g. after one of their categories changed
+void post_cache_invalidate_user(const char *username);
+
+// Lookups that found nothing, kept for MISS_CACHE_TTL_MS so repeated
+// requests for missing posts and users do not reach the database.
+// Post misses use post_cache_key(), profile misses profile_miss_key().
+cache_t *miss_cache(void);
+
+char *profile_miss_key(Arena *arena, const char *username);
+
+bool is_missing(const char *key);
+void remember_missing(const char *key);
+
+// After a write that may have created what was missing
+void forget_missing_post(const char *username, const char *slug);
+void forget_missing_user(const char *username);
+
+// users.id by username, so post reads filter on posts.author_id
+// without joining users. Filled as usernames are looked up.
+cache_t *user_id_cache(void);
+
+// Arena copy of the cached id, NULL when not cached
+char *cached_user_id(Arena *arena, const char *username);
+void remember_user_id(const char *username, const char *id);
+void forget_user_id(const char *username);
+
+// Auth contexts parsed by is_auth, keyed by session id. A session
+// outlives neither its entry's TTL nor logout, which drops the entry.
+cache_t *auth_cache(void);
+
+void forget_auth(const char *session_id);
+
+#endif
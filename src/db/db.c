@@ -1,121 +1,745 @@
-#include "ecewo-postgres.h"
 #include "dotenv.h"
+#include "db.h"
+#include "migrate.h"
+#include "notify.h"
+#include "query.h"
+#include "uv.h"
+#include "utils.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static PGpool *db_pool = NULL;
+#define REPLICA_CHECK_MS 1000
+#define RECENT_WRITES_SLOTS 1024
+#define RECENT_WRITES_PROBE 4
 
-static int create_tables(void)
+static db_pool_t *db_pool = NULL;
+static db_pool_t *read_pool = NULL;
+
+// Replay delay of the replica, refreshed by lag_timer
+static uv_timer_t lag_timer;
+static bool lag_check_running = false;
+static bool replica_healthy = false;
+static long replica_lag_ms = -1;
+static int replica_max_lag_ms;
+static int read_your_writes_ms;
+static uint64_t reads_primary = 0;
+static uint64_t reads_replica = 0;
+
+// Users who wrote recently keep reading from the primary for a while
+typedef struct
+{
+    long user_id;
+    uint64_t written_at;
+} recent_write_t;
+
+static recent_write_t recent_writes[RECENT_WRITES_SLOTS];
+
+// Zero while the replica is in sync or not a standby at all,
+// NULL when it has not replayed anything yet
+static const char *replica_lag_sql =
+    "SELECT CASE "
+    "  WHEN NOT pg_is_in_recovery() "
+    "    OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+    "  ELSE (EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000)::bigint "
+    "END";
+
+typedef struct
+{
+    const char *name;
+    const char *sql;
+} db_statement_t;
+
+// posts.category_list as it is written by the statements below: the
+// post's categories as [{"id", "category", "slug"}], ordered by id
+#define CATEGORY_LIST_OF(ids) \
+    "(SELECT COALESCE(jsonb_agg(jsonb_build_object(" \
+    "    'id', c.id, 'category', c.category, 'slug', c.slug) ORDER BY c.id), '[]') " \
+    " FROM categories c WHERE c.id = ANY(" ids "))"
+
+// posts.rendered as post_render writes it: post p as a JSON object
+// without its categories, which readers splice in
+#define POST_RENDERED(username) \
+    "json_build_object(" \
+    "  'id', p.id, 'header', p.header, 'slug', p.slug, 'content', p.content, " \
+    "  'reading_time', p.reading_time, 'author_id', p.author_id, " \
+    "  'username', " username ", 'created_at', p.created_at::text, " \
+    "  'updated_at', p.updated_at::text, 'is_hidden', p.is_hidden)::text"
+
+// Posts written before they were pre-rendered
+#define POST_RENDERED_OR_NOW \
+    "COALESCE(p.rendered, " \
+    POST_RENDERED("(SELECT username FROM users WHERE id = p.author_id)") ")"
+
+// Only the category with slug $2, for the per-category listings
+#define POST_CATEGORY_MATCH_JOIN \
+    "JOIN post_categories pc ON pc.post_id = p.id " \
+    "JOIN categories c ON c.id = pc.category_id AND c.slug = $2 "
+
+// The category written by the CTE `written`, once per author whose
+// posts it was synced into (any author may list it), username NULL
+// when none were
+#define CATEGORY_AUTHORS(written) \
+    "SELECT w.id, a.username " \
+    "FROM " written " w " \
+    "LEFT JOIN (SELECT DISTINCT author_id FROM synced) s ON TRUE " \
+    "LEFT JOIN users a ON a.id = s.author_id"
+
+// Keyset pages of author $1, newest first: rows before
+// ($2 created_at, $3 id), $4 of them.
+#define POSTS_BY_AUTHOR(filter) \
+    "SELECT p.id, p.created_at, p.is_hidden, " \
+    "       " POST_RENDERED_OR_NOW " as rendered, " \
+    "       p.category_list as categories " \
+    "FROM posts p " \
+    "WHERE p.author_id = $1::int " filter \
+    "  AND (p.created_at, p.id) < ($2::timestamp, $3::int) " \
+    "ORDER BY p.created_at DESC, p.id DESC " \
+    "LIMIT $4"
+
+// Same paging with the category slug as $2. As before, only the
+// matching category is listed for each post.
+#define POSTS_BY_CATEGORY(filter) \
+    "SELECT p.id, p.header, p.slug, p.reading_time, " \
+    "       p.author_id, p.created_at, p.updated_at, p.is_hidden, " \
+    "       c.category as categories, c.slug as category_slugs, " \
+    "       c.id::text as category_ids " \
+    "FROM posts p " \
+    POST_CATEGORY_MATCH_JOIN \
+    "WHERE p.author_id = $1::int " filter \
+    "  AND (p.created_at, p.id) < ($3::timestamp, $4::int) " \
+    "ORDER BY p.created_at DESC, p.id DESC " \
+    "LIMIT $5"
+
+// A page of one of the listings above as a single document built by
+// the server. Rows are fetched one past the page (see page_t): the
+// rest become "posts", a JSON array of item over row l, and has_more
+// and the last listed row give the cursor.
+#define JSON_PAGE(rows, fetch, item) \
+    "SELECT COALESCE(json_agg(" item " ORDER BY l.n) " \
+    "         FILTER (WHERE l.n < " fetch "::int), '[]')::text AS posts, " \
+    "       count(*) >= " fetch "::int AS has_more, " \
+    "       max(l.created_at) FILTER (WHERE l.n = " fetch "::int - 1) AS last_created_at, " \
+    "       max(l.id) FILTER (WHERE l.n = " fetch "::int - 1) AS last_id " \
+    "FROM (SELECT r.*, row_number() OVER (ORDER BY r.created_at DESC, r.id DESC) AS n " \
+    "      FROM (" rows ") r) l"
+
+// What the handlers write for a row, the rendered post with its
+// categories spliced in, or a per-category listing row
+#define POST_ITEM \
+    "(left(l.rendered, -1) || ', \"categories\" : ' || l.categories::text || '}')::json"
+
+#define CATEGORY_POST_ITEM \
+    "json_build_object(" \
+    "  'header', l.header, 'slug', l.slug, " \
+    "  'created_at', l.created_at::text, 'updated_at', l.updated_at::text, " \
+    "  'categories', l.categories, 'category_slugs', l.category_slugs, " \
+    "  'category_ids', l.category_ids, 'reading_time', l.reading_time, " \
+    "  'author_id', l.author_id, 'is_hidden', l.is_hidden, " \
+    "  'username', (SELECT username FROM users WHERE id = $1::int))"
+
+// Every query the handlers run, prepared once per pooled connection
+// so the JOIN reads are parsed and planned only once
+static const db_statement_t statements[] = {
+    {"users_all",
+     "SELECT id, name, username FROM users"},
+
+    {"users_all_json",
+     "SELECT COALESCE(json_agg(json_build_object("
+     "  'id', id, 'name', name, 'username', username)), '[]')::text "
+     "FROM users"},
+
+    {"user_login",
+     "SELECT id, name, password FROM users WHERE username = $1"},
+
+    {"user_exists",
+     "SELECT COUNT(*) FROM users WHERE username = $1 OR email = $2"},
+
+    {"user_insert",
+     "INSERT INTO users (name, username, password, email, about) "
+     "VALUES ($1, $2, $3, $4, $5)"},
+
+    {"user_id",
+     "SELECT id FROM users WHERE username = $1"},
+
+    {"user_profile",
+     "SELECT id, name, username, email, about FROM users WHERE username = $1"},
+
+    {"post_get",
+     "SELECT p.id, p.created_at, p.is_hidden, "
+     "       " POST_RENDERED_OR_NOW " as rendered, "
+     "       p.category_list as categories "
+     "FROM posts p "
+     "WHERE p.author_id = $1::int AND p.slug = $2"},
+
+    {"post_get_public",
+     "SELECT p.id, p.created_at, p.is_hidden, "
+     "       " POST_RENDERED_OR_NOW " as rendered, "
+     "       p.category_list as categories "
+     "FROM posts p "
+     "WHERE p.author_id = $1::int AND p.slug = $2 AND p.is_hidden = FALSE"},
+
+    {"posts_by_author", POSTS_BY_AUTHOR("")},
+    {"posts_by_author_public", POSTS_BY_AUTHOR("AND p.is_hidden = FALSE ")},
+
+    {"posts_by_category", POSTS_BY_CATEGORY("")},
+    {"posts_by_category_public", POSTS_BY_CATEGORY("AND p.is_hidden = FALSE ")},
+
+    // The same pages rendered by the server, see JSON_PAGE
+    {"posts_by_author_json",
+     JSON_PAGE(POSTS_BY_AUTHOR(""), "$4", POST_ITEM)},
+    {"posts_by_author_public_json",
+     JSON_PAGE(POSTS_BY_AUTHOR("AND p.is_hidden = FALSE "), "$4", POST_ITEM)},
+    {"posts_by_category_json",
+     JSON_PAGE(POSTS_BY_CATEGORY(""), "$5", CATEGORY_POST_ITEM)},
+    {"posts_by_category_public_json",
+     JSON_PAGE(POSTS_BY_CATEGORY("AND p.is_hidden = FALSE "), "$5", CATEGORY_POST_ITEM)},
+
+    // Slug check, insert and category links in one statement.
+    // Returns no row when the slug is already taken.
+    {"post_create",
+     "WITH new_post AS ("
+     "  INSERT INTO posts "
+     "  (header, slug, content, reading_time, author_id, created_at, updated_at, is_hidden, "
+     "   category_list) "
+     "  SELECT $1, $2, $3, $4::int, $5::int, to_timestamp($6), to_timestamp($7), $8::boolean, "
+     "         " CATEGORY_LIST_OF("$9::int[]") " "
+     "  WHERE NOT EXISTS (SELECT 1 FROM posts WHERE slug = $2) "
+     "  RETURNING id"
+     "), new_categories AS ("
+     "  INSERT INTO post_categories (post_id, category_id) "
+     "  SELECT new_post.id, unnest($9::int[]) FROM new_post "
+     "  ON CONFLICT DO NOTHING"
+     ") "
+     "SELECT id FROM new_post"},
+
+    // Run after every write to a post, in the same batch. Only the row
+    // that write left behind: slug $1, author $2, updated_at $3.
+    {"post_render",
+     "UPDATE posts p SET rendered = " POST_RENDERED("u.username") " "
+     "FROM users u "
+     "WHERE u.id = p.author_id AND p.slug = $1 "
+     "AND p.author_id = $2::int AND p.updated_at = to_timestamp($3)"},
+
+    {"post_owner",
+     "SELECT id, author_id FROM posts WHERE slug = $1"},
+
+    {"post_slug_taken",
+     "SELECT 1 FROM posts WHERE slug = $1 AND slug != $2"},
+
+    // The post of author $9 and its category links, $8 is an int[]
+    // literal such as {1,2,3}. Returns nothing when it is not theirs.
+    {"post_update",
+     "WITH updated AS ("
+     "  UPDATE posts SET "
+     "  header = $1, "
+     "  slug = $2, "
+     "  content = $3, "
+     "  reading_time = $4, "
+     "  updated_at = to_timestamp($5), "
+     "  is_hidden = $6, "
+     "  category_list = " CATEGORY_LIST_OF("$8::int[]") " "
+     "  WHERE slug = $7 AND author_id = $9::int "
+     "  RETURNING id"
+     "), pruned AS ("
+     "  DELETE FROM post_categories pc USING updated "
+     "  WHERE pc.post_id = updated.id AND pc.category_id <> ALL($8::int[])"
+     "), added AS ("
+     "  INSERT INTO post_categories (post_id, category_id) "
+     "  SELECT updated.id, unnest($8::int[]) FROM updated "
+     "  ON CONFLICT DO NOTHING"
+     ") "
+     "SELECT id FROM updated"},
+
+    {"post_delete",
+     "DELETE FROM posts p "
+     "WHERE p.author_id = $1 "
+     "AND p.slug     = $2"},
+
+    {"category_insert",
+     "INSERT INTO categories (category, slug, author_id) "
+     "SELECT $1, $2, $3 "
+     "WHERE NOT EXISTS ("
+     "    SELECT 1 FROM categories WHERE slug = $2"
+     ")"},
+
+    {"category_owner",
+     "SELECT id, author_id FROM categories WHERE slug = $1"},
+
+    {"category_slug_taken",
+     "SELECT 1 FROM categories WHERE slug = $1 AND slug != $2"},
+
+    // Both rewrite the copies in posts.category_list in the same
+    // statement, so no reader sees the old name after the commit
+    {"category_update",
+     "WITH updated AS ("
+     "  UPDATE categories SET "
+     "  category = $1, "
+     "  slug = $2 "
+     "  WHERE slug = $3 "
+     "  RETURNING id, category, slug"
+     "), synced AS ("
+     "  UPDATE posts p SET category_list = ("
+     "    SELECT jsonb_agg(CASE WHEN (e->>'id')::int = u.id "
+     "                     THEN jsonb_build_object('id', u.id, 'category', u.category, 'slug', u.slug) "
+     "                     ELSE e END ORDER BY n) "
+     "    FROM jsonb_array_elements(p.category_list) WITH ORDINALITY AS x(e, n)"
+     "  ) "
+     "  FROM updated u "
+     "  WHERE p.id IN (SELECT post_id FROM post_categories WHERE category_id = u.id) "
+     "  RETURNING p.author_id"
+     ") "
+     CATEGORY_AUTHORS("updated")},
+
+    {"category_delete",
+     "WITH deleted AS ("
+     "  DELETE FROM categories "
+     "  WHERE author_id = $1 "
+     "  AND slug = $2 "
+     "  RETURNING id"
+     "), synced AS ("
+     "  UPDATE posts p SET category_list = COALESCE(("
+     "    SELECT jsonb_agg(e ORDER BY n) "
+     "    FROM jsonb_array_elements(p.category_list) WITH ORDINALITY AS x(e, n) "
+     "    WHERE (e->>'id')::int NOT IN (SELECT id FROM deleted)"
+     "  ), '[]') "
+     "  WHERE p.id IN (SELECT pc.post_id FROM post_categories pc "
+     "                 JOIN deleted d ON pc.category_id = d.id) "
+     "  RETURNING p.author_id"
+     ") "
+     CATEGORY_AUTHORS("deleted")},
+};
+
+static const size_t statement_count = sizeof(statements) / sizeof(statements[0]);
+
+const char *db_statement_sql(const char *name)
+{
+    for (size_t i = 0; i < statement_count; ++i) {
+        if (strcmp(statements[i].name, name) == 0)
+            return statements[i].sql;
+    }
+
+    return NULL;
+}
+
+PGresult *db_exec_prepared(PGconn *conn, const char *name,
+                           int nparams, const char *const *params)
+{
+    PGresult *result = PQexecPrepared(conn, name, nparams, params, NULL, NULL, 0);
+
+    const char *state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+    if (!state || strcmp(state, SQLSTATE_UNDEFINED_PSTATEMENT) != 0)
+        return result;
+
+    // Connection opened after db_init(), prepare and try again
+    PQclear(result);
+
+    const char *sql = db_statement_sql(name);
+    if (!sql)
+        return NULL;
+
+    result = PQprepare(conn, name, sql, 0, NULL);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+        return result;
+
+    PQclear(result);
+    return PQexecPrepared(conn, name, nparams, params, NULL, NULL, 0);
+}
+
+static PGresult *stream_once(PGconn *conn, const char *name, int nparams,
+                             const char *const *params,
+                             db_row_cb on_row, void *data)
+{
+    if (!PQsendQueryPrepared(conn, name, nparams, params, NULL, NULL, 0))
+        return NULL;
+
+    PQsetSingleRowMode(conn);
+
+    PGresult *last = NULL;
+    PGresult *result;
+
+    while ((result = PQgetResult(conn))) {
+        if (PQresultStatus(result) == PGRES_SINGLE_TUPLE) {
+            on_row(result, data);
+            PQclear(result);
+            continue;
+        }
+
+        if (!last)
+            last = result;
+        else
+            PQclear(result);
+    }
+
+    return last;
+}
+
+PGresult *db_stream_prepared(PGconn *conn, const char *name,
+                             int nparams, const char *const *params,
+                             db_row_cb on_row, void *data)
+{
+    PGresult *result = stream_once(conn, name, nparams, params, on_row, data);
+
+    // The error comes before any row, so nothing was streamed yet
+    const char *state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+    if (!state || strcmp(state, SQLSTATE_UNDEFINED_PSTATEMENT) != 0)
+        return result;
+
+    PQclear(result);
+
+    const char *sql = db_statement_sql(name);
+    if (!sql)
+        return NULL;
+
+    result = PQprepare(conn, name, sql, 0, NULL);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+        return result;
+
+    PQclear(result);
+    return stream_once(conn, name, nparams, params, on_row, data);
+}
+
+static int prepare_statements(PGconn *conn)
+{
+    for (size_t i = 0; i < statement_count; ++i) {
+        PGresult *result = PQprepare(conn, statements[i].name, statements[i].sql, 0, NULL);
+
+        if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "Preparing '%s' failed: %s\n",
+                    statements[i].name, PQerrorMessage(conn));
+            PQclear(result);
+            return -1;
+        }
+
+        PQclear(result);
+    }
+
+    return 0;
+}
+
+static int prepare_pool(db_pool_t *pool, int size)
+{
+    // Hold every connection at once so each one of them gets prepared.
+    // Connections the pool opens later are prepared on first use.
+    PGconn **conns = calloc(size, sizeof(PGconn *));
+    if (!conns)
+        return -1;
+
+    int borrowed = 0;
+    int rc = 0;
+
+    for (; borrowed < size; ++borrowed) {
+        conns[borrowed] = db_pool_borrow(pool);
+        if (!conns[borrowed])
+            break;
+    }
+
+    for (int i = 0; i < borrowed && rc == 0; ++i)
+        rc = prepare_statements(conns[i]);
+
+    for (int i = 0; i < borrowed; ++i)
+        db_pool_release(pool, conns[i]);
+
+    free(conns);
+
+    if (borrowed == 0) {
+        fprintf(stderr, "Failed to acquire connection\n");
+        return -1;
+    }
+
+    if (rc == 0)
+        printf("%zu statements prepared on %d connections.\n", statement_count, borrowed);
+
+    return rc;
+}
+
+static int run_migrations(void)
 {
     // This fn is gonna run sync because
     // I dont want server to start
-    // before all the tables created
-    PGconn *conn = pg_pool_borrow(db_pool);
+    // before the schema is up to date
+    PGconn *conn = db_pool_borrow(db_pool);
     if (!conn) {
         fprintf(stderr, "Failed to acquire connection\n");
         return -1;
     }
 
-    const char *queries[] = {
-        "CREATE TABLE IF NOT EXISTS users ("
-        "  id SERIAL PRIMARY KEY, "
-        "  name TEXT NOT NULL, "
-        "  username TEXT NOT NULL, "
-        "  password TEXT NOT NULL, "
-        "  email TEXT NOT NULL, "
-        "  about TEXT, "
-        "  created_at TIMESTAMP WITHOUT TIME ZONE DEFAULT NOW()"
-        ");",
-
-        "CREATE TABLE IF NOT EXISTS posts ("
-        "  id SERIAL PRIMARY KEY, "
-        "  header TEXT NOT NULL, "
-        "  slug TEXT NOT NULL, "
-        "  content TEXT NOT NULL, "
-        "  reading_time INTEGER NOT NULL, "
-        "  author_id INTEGER NOT NULL REFERENCES users(id), "
-        "  created_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW(), "
-        "  updated_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW(), "
-        "  is_hidden BOOLEAN NOT NULL DEFAULT FALSE"
-        ");",
-
-        "CREATE TABLE IF NOT EXISTS categories ("
-        "  id SERIAL PRIMARY KEY, "
-        "  category TEXT NOT NULL, "
-        "  slug TEXT NOT NULL, "
-        "  author_id INTEGER NOT NULL REFERENCES users(id)"
-        ");",
-
-        "CREATE TABLE IF NOT EXISTS post_categories ("
-        "  post_id INTEGER NOT NULL REFERENCES posts(id) ON DELETE CASCADE, "
-        "  category_id INTEGER NOT NULL REFERENCES categories(id) ON DELETE CASCADE, "
-        "  PRIMARY KEY(post_id, category_id)"
-        ");",
-    };
+    int rc = db_migrate(conn);
+    db_pool_release(db_pool, conn);
+    return rc;
+}
 
-    size_t count = sizeof(queries) / sizeof(queries[0]);
+static void set_replica_lag(const PGresult *result)
+{
+    bool was_healthy = replica_healthy;
 
-    for (size_t i = 0; i < count; ++i) {
-        PGresult *result = PQexec(conn, queries[i]);
-        ExecStatusType status = PQresultStatus(result);
-        
-        if (status != PGRES_COMMAND_OK) {
-            fprintf(stderr, "Table creation failed: %s\n", PQerrorMessage(conn));
-            PQclear(result);
-            pg_pool_return(db_pool, conn);
-            return -1;
-        }
-        
+    if (!result || PQresultStatus(result) != PGRES_TUPLES_OK ||
+        PQntuples(result) != 1 || PQgetisnull(result, 0, 0)) {
+        replica_lag_ms = -1;
+        replica_healthy = false;
+    } else {
+        replica_lag_ms = atol(PQgetvalue(result, 0, 0));
+        replica_healthy = replica_lag_ms <= replica_max_lag_ms;
+    }
+
+    if (was_healthy && !replica_healthy)
+        printf("[DB] Replica unavailable (lag %ld ms), reading from primary\n", replica_lag_ms);
+    else if (!was_healthy && replica_healthy)
+        printf("[DB] Replica in sync (lag %ld ms), reading from replica\n", replica_lag_ms);
+}
+
+static void on_replica_lag(db_query_t *pg, PGresult *result, void *data)
+{
+    lag_check_running = false;
+    set_replica_lag(result);
+}
+
+static void on_lag_timer(uv_timer_t *handle)
+{
+    if (lag_check_running)
+        return;
+
+    db_query_t *pg = db_query_create(read_pool);
+    if (!pg) {
+        set_replica_lag(NULL);
+        return;
+    }
+
+    if (db_query_queue(pg, replica_lag_sql, 0, NULL, on_replica_lag, NULL) != 0 ||
+        db_query_exec(pg) != 0) {
+        set_replica_lag(NULL);
+        return;
+    }
+
+    lag_check_running = true;
+}
+
+static int init_read_pool(const db_pool_config_t *primary)
+{
+    const char *host = getenv("DB_READ_HOST");
+    if (!host || *host == '\0')
+        return 0;
+
+    db_pool_config_t config = *primary;
+    config.host = host;
+
+    const char *value;
+    if ((value = getenv("DB_READ_PORT")))
+        config.port = value;
+    if ((value = getenv("DB_READ_NAME")))
+        config.dbname = value;
+    if ((value = getenv("DB_READ_USER")))
+        config.user = value;
+    if ((value = getenv("DB_READ_PASSWORD")))
+        config.password = value;
+
+    replica_max_lag_ms = env_int("DB_REPLICA_MAX_LAG_MS", 1000);
+    read_your_writes_ms = env_int("DB_READ_YOUR_WRITES_MS", 5000);
+
+    printf("[DB] Replica: host=%s port=%s max_lag=%dms\n",
+           config.host,
+           config.port ? config.port : "NULL",
+           replica_max_lag_ms);
+
+    read_pool = db_pool_create(&config);
+
+    // Not fatal, every read simply stays on the primary
+    if (!read_pool) {
+        fprintf(stderr, "[DB] Failed to create replica pool, reading from primary\n");
+        return 0;
+    }
+
+    if (prepare_pool(read_pool, config.min_size) != 0) {
+        fprintf(stderr, "[DB] Statements couldn't be prepared on the replica\n");
+        return -1;
+    }
+
+    PGconn *conn = db_pool_borrow(read_pool);
+    if (conn) {
+        PGresult *result = PQexec(conn, replica_lag_sql);
+        set_replica_lag(result);
         PQclear(result);
+        db_pool_release(read_pool, conn);
     }
 
-    pg_pool_return(db_pool, conn);
-    printf("All tables created or they already exist.\n");
+    uv_timer_init(uv_default_loop(), &lag_timer);
+    uv_timer_start(&lag_timer, on_lag_timer, REPLICA_CHECK_MS, REPLICA_CHECK_MS);
+    uv_unref((uv_handle_t *)&lag_timer);
+    lag_timer.data = read_pool;
+
     return 0;
 }
 
 int db_init(void)
 {
-    PGPoolConfig config = {
+    db_pool_config_t config = {
         .host = getenv("DB_HOST"),
         .port = getenv("DB_PORT"),
         .dbname = getenv("DB_NAME"),
         .user = getenv("DB_USER"),
         .password = getenv("DB_PASSWORD"),
-        .pool_size = 10,
-        .timeout_ms = 5000
+        .min_size = env_int("DB_POOL_MIN", 2),
+        .max_size = env_int("DB_POOL_MAX", 10),
+        .max_waiters = env_int("DB_POOL_QUEUE", 256),
+        .timeout_ms = env_int("DB_POOL_TIMEOUT_MS", 5000),
+        .idle_timeout_ms = env_int("DB_POOL_IDLE_MS", 30000)
     };
+
+    if (config.max_size < config.min_size)
+        config.max_size = config.min_size;
     
-    printf("[DB] Config: host=%s port=%s db=%s user=%s\n",
+    printf("[DB] Config: host=%s port=%s db=%s user=%s pool=%d..%d\n",
            config.host ? config.host : "NULL",
            config.port ? config.port : "NULL",
            config.dbname ? config.dbname : "NULL",
-           config.user ? config.user : "NULL");
+           config.user ? config.user : "NULL",
+           config.min_size, config.max_size);
 
-    db_pool = pg_pool_create(&config);
+    db_pool = db_pool_create(&config);
     
     if (!db_pool) {
         fprintf(stderr, "[DB] Failed to create database pool\n");
         return -1;
     }
     
-    if (create_tables() != 0) {
-        fprintf(stderr, "[DB] Tables couldn't be created\n");
+    if (run_migrations() != 0) {
+        fprintf(stderr, "[DB] Schema migration failed\n");
+        return -1;
+    }
+
+    if (prepare_pool(db_pool, config.min_size) != 0) {
+        fprintf(stderr, "[DB] Statements couldn't be prepared\n");
+        return -1;
+    }
+
+    if (init_read_pool(&config) != 0)
+        return -1;
+
+    // Cache invalidations go to the primary, like the writes behind them
+    if (db_notify_start(&config) != 0) {
+        fprintf(stderr, "[DB] Failed to start the notify listener\n");
         return -1;
     }
     
     return 0;
 }
 
-PGpool *db_get_pool(void)
+db_pool_t *db_get_pool(void)
 {
     return db_pool;
 }
 
+static long parse_user_id(const char *user_id)
+{
+    if (!user_id)
+        return 0;
+
+    char *end = NULL;
+    long id = strtol(user_id, &end, 10);
+    return (*end == '\0' && id > 0) ? id : 0;
+}
+
+static recent_write_t *find_recent_write(long id)
+{
+    size_t start = (size_t)id % RECENT_WRITES_SLOTS;
+
+    for (size_t i = 0; i < RECENT_WRITES_PROBE; ++i) {
+        recent_write_t *entry = &recent_writes[(start + i) % RECENT_WRITES_SLOTS];
+        if (entry->user_id == id)
+            return entry;
+    }
+
+    return NULL;
+}
+
+void db_note_write(const char *user_id)
+{
+    long id = parse_user_id(user_id);
+    if (!read_pool || id == 0)
+        return;
+
+    recent_write_t *entry = find_recent_write(id);
+
+    // Otherwise take over the oldest entry in the probe window
+    if (!entry) {
+        size_t start = (size_t)id % RECENT_WRITES_SLOTS;
+        entry = &recent_writes[start];
+
+        for (size_t i = 1; i < RECENT_WRITES_PROBE; ++i) {
+            recent_write_t *candidate = &recent_writes[(start + i) % RECENT_WRITES_SLOTS];
+            if (candidate->written_at < entry->written_at)
+                entry = candidate;
+        }
+    }
+
+    entry->user_id = id;
+    entry->written_at = uv_now(uv_default_loop());
+}
+
+static bool wrote_recently(const char *user_id)
+{
+    long id = parse_user_id(user_id);
+    if (id == 0)
+        return false;
+
+    recent_write_t *entry = find_recent_write(id);
+    return entry &&
+           uv_now(uv_default_loop()) - entry->written_at < (uint64_t)read_your_writes_ms;
+}
+
+db_pool_t *db_get_read_pool(const char *user_id)
+{
+    if (!read_pool || !replica_healthy || wrote_recently(user_id)) {
+        reads_primary++;
+        return db_pool;
+    }
+
+    reads_replica++;
+    return read_pool;
+}
+
+void db_replica_stats(db_replica_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    out->enabled = read_pool != NULL;
+    out->healthy = replica_healthy;
+    out->lag_ms = replica_lag_ms;
+    out->reads_primary = reads_primary;
+    out->reads_replica = reads_replica;
+
+    if (read_pool)
+        db_pool_stats(read_pool, &out->pool);
+}
+
+long db_read_staleness_ms(void)
+{
+    // The lag is only checked every REPLICA_CHECK_MS, so it may have
+    // grown past the limit since
+    if (!read_pool)
+        return 0;
+
+    return (long)replica_max_lag_ms + REPLICA_CHECK_MS;
+}
+
 void db_cleanup(void)
 {
+    db_notify_stop();
+
+    if (read_pool) {
+        if (lag_timer.data) {
+            uv_timer_stop(&lag_timer);
+            uv_close((uv_handle_t *)&lag_timer, NULL);
+            lag_timer.data = NULL;
+        }
+
+        db_pool_destroy(read_pool);
+        read_pool = NULL;
+    }
+
     if (db_pool) {
         printf("[DB] Cleaning up database pool\n");
-        pg_pool_destroy(db_pool);
+        db_pool_destroy(db_pool);
         db_pool = NULL;
     }
 }
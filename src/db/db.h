@@ -1,12 +1,54 @@
 #ifndef DB_H
 #define DB_H
 
-#include "ecewo-postgres.h"
+#include "pool.h"
+#include <stdbool.h>
+
+// SQLSTATE for "prepared statement does not exist"
+#define SQLSTATE_UNDEFINED_PSTATEMENT "26000"
 
 // Synchronous initialization
 int db_init(void);
 
-PGpool *db_get_pool(void);
+typedef struct
+{
+    bool enabled;
+    bool healthy;
+    long lag_ms; // -1 when unknown
+    uint64_t reads_primary;
+    uint64_t reads_replica;
+    db_pool_stats_t pool;
+} db_replica_stats_t;
+
+// Primary, for writes and for reads that must see the latest data
+db_pool_t *db_get_pool(void);
+
+// Replica from DB_READ_HOST while it keeps up, otherwise the primary.
+// user_id (may be NULL) reads its own writes from the primary for
+// DB_READ_YOUR_WRITES_MS after db_note_write().
+db_pool_t *db_get_read_pool(const char *user_id);
+void db_note_write(const char *user_id);
+void db_replica_stats(db_replica_stats_t *out);
+
+// How far behind the primary a read may be: 0 without a replica,
+// otherwise DB_REPLICA_MAX_LAG_MS plus the time to the next lag check
+long db_read_staleness_ms(void);
+
 void db_cleanup(void);
 
-#endif
\ No newline at end of file
+// SQL text of a registered prepared statement, NULL if unknown
+const char *db_statement_sql(const char *name);
+
+// Blocking PQexecPrepared that prepares the statement on first use
+PGresult *db_exec_prepared(PGconn *conn, const char *name,
+                           int nparams, const char *const *params);
+
+typedef void (*db_row_cb)(const PGresult *row, void *data);
+
+// Same in single-row mode: on_row gets each row as it arrives, the
+// returned result is the final status (no rows) or the error
+PGresult *db_stream_prepared(PGconn *conn, const char *name,
+                             int nparams, const char *const *params,
+                             db_row_cb on_row, void *data);
+
+#endif
@@ -0,0 +1,233 @@
+#include "decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define USECS_PER_DAY INT64_C(86400000000)
+#define USECS_PER_SEC INT64_C(1000000)
+
+// Days between 1970-01-01 and 2000-01-01
+#define PG_EPOCH_DAYS 10957
+
+static int64_t read_be(const unsigned char *p, int len)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < len; i++)
+        value = (value << 8) | p[i];
+
+    // Sign-extend int2/int4
+    if (len < 8 && (p[0] & 0x80))
+        value |= ~UINT64_C(0) << (len * 8);
+
+    return (int64_t)value;
+}
+
+// Proleptic Gregorian calendar, days relative to 1970-01-01
+
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t *y, int *m, int *d)
+{
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+static char *put_digits(char *p, int64_t value, int width)
+{
+    for (int i = width - 1; i >= 0; i--)
+    {
+        p[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return p + width;
+}
+
+int64_t db_get_int(const PGresult *result, int row, int col)
+{
+    if (PQgetisnull(result, row, col))
+        return 0;
+
+    const char *value = PQgetvalue(result, row, col);
+
+    if (PQfformat(result, col) == 0)
+        return strtoll(value, NULL, 10);
+
+    int len = PQgetlength(result, row, col);
+    if (len != 2 && len != 4 && len != 8)
+        return 0;
+
+    return read_be((const unsigned char *)value, len);
+}
+
+bool db_get_bool(const PGresult *result, int row, int col)
+{
+    if (PQgetisnull(result, row, col))
+        return false;
+
+    const char *value = PQgetvalue(result, row, col);
+
+    if (PQfformat(result, col) == 0)
+        return value[0] == 't';
+
+    return PQgetlength(result, row, col) == 1 && value[0] != 0;
+}
+
+int64_t db_get_timestamp(const PGresult *result, int row, int col)
+{
+    if (PQgetisnull(result, row, col))
+        return 0;
+
+    const char *value = PQgetvalue(result, row, col);
+
+    if (PQfformat(result, col) != 0)
+    {
+        if (PQgetlength(result, row, col) != 8)
+            return 0;
+        return read_be((const unsigned char *)value, 8);
+    }
+
+    if (strcmp(value, "infinity") == 0)
+        return INT64_MAX;
+    if (strcmp(value, "-infinity") == 0)
+        return INT64_MIN;
+
+    long long y;
+    int m, d, hh, mm, ss, consumed = 0;
+    if (sscanf(value, "%lld-%d-%d %d:%d:%d%n", &y, &m, &d, &hh, &mm, &ss, &consumed) != 6)
+        return 0;
+
+    int64_t usecs = 0;
+    const char *frac = value + consumed;
+    if (*frac == '.')
+    {
+        int scale = 100000;
+        for (frac++; *frac >= '0' && *frac <= '9' && scale > 0; frac++, scale /= 10)
+            usecs += (*frac - '0') * scale;
+    }
+
+    if (strstr(frac, " BC"))
+        y = 1 - y;
+
+    int64_t days = days_from_civil(y, m, d) - PG_EPOCH_DAYS;
+    return days * USECS_PER_DAY + ((hh * 60 + mm) * 60 + ss) * USECS_PER_SEC + usecs;
+}
+
+size_t db_format_timestamp(int64_t usecs, char *buf, size_t size)
+{
+    if (usecs == INT64_MAX || usecs == INT64_MIN)
+    {
+        int n = snprintf(buf, size, "%s", usecs == INT64_MAX ? "infinity" : "-infinity");
+        return n < 0 ? 0 : (size_t)n;
+    }
+
+    int64_t days = usecs / USECS_PER_DAY;
+    int64_t rem = usecs % USECS_PER_DAY;
+    if (rem < 0)
+    {
+        rem += USECS_PER_DAY;
+        days--;
+    }
+
+    int64_t y;
+    int m, d;
+    civil_from_days(days + PG_EPOCH_DAYS, &y, &m, &d);
+
+    bool bc = y <= 0;
+    if (bc)
+        y = 1 - y;
+
+    int64_t secs = rem / USECS_PER_SEC;
+    int64_t frac = rem % USECS_PER_SEC;
+
+    // Years past 9999 are rare enough to leave to snprintf
+    if (y > 9999)
+    {
+        int n = snprintf(buf, size, "%lld-%02d-%02d %02d:%02d:%02d",
+                         (long long)y, m, d,
+                         (int)(secs / 3600), (int)(secs / 60 % 60), (int)(secs % 60));
+        return n < 0 || (size_t)n >= size ? 0 : (size_t)n;
+    }
+
+    if (size < DB_TIMESTAMP_LEN)
+        return 0;
+
+    char *p = buf;
+    p = put_digits(p, y, 4);
+    *p++ = '-';
+    p = put_digits(p, m, 2);
+    *p++ = '-';
+    p = put_digits(p, d, 2);
+    *p++ = ' ';
+    p = put_digits(p, secs / 3600, 2);
+    *p++ = ':';
+    p = put_digits(p, secs / 60 % 60, 2);
+    *p++ = ':';
+    p = put_digits(p, secs % 60, 2);
+
+    // Like the server, print the fraction without trailing zeros
+    if (frac)
+    {
+        int width = 6;
+        while (frac % 10 == 0)
+        {
+            frac /= 10;
+            width--;
+        }
+        *p++ = '.';
+        p = put_digits(p, frac, width);
+    }
+
+    if (bc)
+    {
+        memcpy(p, " BC", 3);
+        p += 3;
+    }
+
+    *p = '\0';
+    return (size_t)(p - buf);
+}
+
+const char *db_get_timestamp_text(const PGresult *result, int row, int col,
+                                  char *buf, size_t size)
+{
+    if (PQfformat(result, col) == 0 || PQgetisnull(result, row, col))
+        return PQgetvalue(result, row, col);
+
+    if (db_format_timestamp(db_get_timestamp(result, row, col), buf, size) == 0)
+        return "";
+
+    return buf;
+}
+
+// Binary jsonb is its text form after a version byte, binary json is
+// just the text
+#define JSONB_VERSION 1
+
+const char *db_get_json(const PGresult *result, int row, int col)
+{
+    if (PQgetisnull(result, row, col))
+        return "null";
+
+    const char *value = PQgetvalue(result, row, col);
+
+    if (PQfformat(result, col) != 0 && value[0] == JSONB_VERSION)
+        return value + 1;
+
+    return value;
+}
@@ -0,0 +1,32 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <libpq-fe.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Typed column access for int2/int4/int8, bool, timestamp and json columns.
+// Every getter checks PQfformat(), so the same code reads a text
+// result and a binary one (see db_query_binary). NULL reads as 0.
+
+// Fits "-infinity" and "YYYY-MM-DD HH:MM:SS.ffffff"
+#define DB_TIMESTAMP_LEN 32
+
+int64_t db_get_int(const PGresult *result, int row, int col);
+bool db_get_bool(const PGresult *result, int row, int col);
+
+// Microseconds since 2000-01-01 00:00:00, the server's own encoding
+int64_t db_get_timestamp(const PGresult *result, int row, int col);
+
+// Timestamp as the server prints it in text mode. Text results are
+// returned as they are, binary ones are formatted into buf.
+const char *db_get_timestamp_text(const PGresult *result, int row, int col,
+                                  char *buf, size_t size);
+
+size_t db_format_timestamp(int64_t usecs, char *buf, size_t size);
+
+// json/jsonb column as JSON text, "null" for NULL
+const char *db_get_json(const PGresult *result, int row, int col);
+
+#endif
@@ -0,0 +1,216 @@
+#include "migrate.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Keeps two servers booting at once from migrating the same database
+#define MIGRATION_LOCK_KEY "72307"
+
+typedef struct
+{
+    int version;
+    const char *name;
+    const char *sql;
+} migration_t;
+
+// Append only: a released migration is never edited, a new one is added
+static const migration_t migrations[] = {
+    // IF NOT EXISTS so databases created before versioning adopt it as is
+    {1, "create tables",
+     "CREATE TABLE IF NOT EXISTS users ("
+     "  id SERIAL PRIMARY KEY, "
+     "  name TEXT NOT NULL, "
+     "  username TEXT NOT NULL, "
+     "  password TEXT NOT NULL, "
+     "  email TEXT NOT NULL, "
+     "  about TEXT, "
+     "  created_at TIMESTAMP WITHOUT TIME ZONE DEFAULT NOW()"
+     ");"
+
+     "CREATE TABLE IF NOT EXISTS posts ("
+     "  id SERIAL PRIMARY KEY, "
+     "  header TEXT NOT NULL, "
+     "  slug TEXT NOT NULL, "
+     "  content TEXT NOT NULL, "
+     "  reading_time INTEGER NOT NULL, "
+     "  author_id INTEGER NOT NULL REFERENCES users(id), "
+     "  created_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW(), "
+     "  updated_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW(), "
+     "  is_hidden BOOLEAN NOT NULL DEFAULT FALSE"
+     ");"
+
+     "CREATE TABLE IF NOT EXISTS categories ("
+     "  id SERIAL PRIMARY KEY, "
+     "  category TEXT NOT NULL, "
+     "  slug TEXT NOT NULL, "
+     "  author_id INTEGER NOT NULL REFERENCES users(id)"
+     ");"
+
+     "CREATE TABLE IF NOT EXISTS post_categories ("
+     "  post_id INTEGER NOT NULL REFERENCES posts(id) ON DELETE CASCADE, "
+     "  category_id INTEGER NOT NULL REFERENCES categories(id) ON DELETE CASCADE, "
+     "  PRIMARY KEY(post_id, category_id)"
+     ");"},
+
+    // What the WHERE and ORDER BY clauses of the statements in db.c use
+    {2, "lookup indexes",
+     "CREATE INDEX IF NOT EXISTS users_username_idx ON users (username);"
+     "CREATE INDEX IF NOT EXISTS users_email_idx ON users (email);"
+     "CREATE INDEX IF NOT EXISTS posts_slug_idx ON posts (slug);"
+     "CREATE INDEX IF NOT EXISTS posts_author_created_idx ON posts (author_id, created_at DESC);"
+     "CREATE INDEX IF NOT EXISTS categories_slug_idx ON categories (slug);"
+     "CREATE INDEX IF NOT EXISTS categories_author_idx ON categories (author_id);"
+     "CREATE INDEX IF NOT EXISTS post_categories_category_idx ON post_categories (category_id);"},
+
+    // Keyset pagination orders by (created_at, id)
+    {3, "post listing keyset index",
+     "CREATE INDEX IF NOT EXISTS posts_author_created_id_idx "
+     "  ON posts (author_id, created_at DESC, id DESC);"
+     "DROP INDEX IF EXISTS posts_author_created_idx;"},
+
+    // Each post's categories, kept in sync by the statements that write
+    // posts or categories, so reads need no join or aggregate
+    {4, "denormalized post categories",
+     "ALTER TABLE posts ADD COLUMN IF NOT EXISTS category_list JSONB NOT NULL DEFAULT '[]';"
+     "UPDATE posts p SET category_list = cl.list FROM ("
+     "  SELECT pc.post_id, jsonb_agg(jsonb_build_object("
+     "    'id', c.id, 'category', c.category, 'slug', c.slug) ORDER BY c.id) AS list "
+     "  FROM post_categories pc "
+     "  JOIN categories c ON c.id = pc.category_id "
+     "  GROUP BY pc.post_id"
+     ") cl WHERE p.id = cl.post_id;"},
+
+    // Each post's JSON without categories, written with the post so
+    // reads only splice text. Rows left NULL are rendered on read.
+    {5, "pre-rendered posts",
+     "ALTER TABLE posts ADD COLUMN IF NOT EXISTS rendered TEXT;"
+     "UPDATE posts p SET rendered = json_build_object("
+     "  'id', p.id, 'header', p.header, 'slug', p.slug, 'content', p.content, "
+     "  'reading_time', p.reading_time, 'author_id', p.author_id, "
+     "  'username', u.username, 'created_at', p.created_at::text, "
+     "  'updated_at', p.updated_at::text, 'is_hidden', p.is_hidden)::text "
+     "FROM users u WHERE u.id = p.author_id;"},
+};
+
+static const size_t migration_count = sizeof(migrations) / sizeof(migrations[0]);
+
+static int exec_command(PGconn *conn, const char *sql)
+{
+    PGresult *result = PQexec(conn, sql);
+    ExecStatusType status = PQresultStatus(result);
+    int rc = (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) ? 0 : -1;
+
+    if (rc != 0)
+        fprintf(stderr, "[DB] Migration query failed: %s\n", PQerrorMessage(conn));
+
+    PQclear(result);
+    return rc;
+}
+
+static int query_int(PGconn *conn, const char *sql, int *out)
+{
+    PGresult *result = PQexec(conn, sql);
+    int rc = -1;
+
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1) {
+        *out = atoi(PQgetvalue(result, 0, 0));
+        rc = 0;
+    } else {
+        fprintf(stderr, "[DB] Reading schema version failed: %s\n", PQerrorMessage(conn));
+    }
+
+    PQclear(result);
+    return rc;
+}
+
+// 0 on a database that has never been migrated, -1 on error
+static int current_version(PGconn *conn)
+{
+    int exists = 0;
+    if (query_int(conn, "SELECT (to_regclass('schema_migrations') IS NOT NULL)::int", &exists) != 0)
+        return -1;
+
+    if (!exists)
+        return 0;
+
+    int version = 0;
+    if (query_int(conn, "SELECT COALESCE(MAX(version), 0) FROM schema_migrations", &version) != 0)
+        return -1;
+
+    return version;
+}
+
+static int apply(PGconn *conn, const migration_t *migration)
+{
+    char version[16];
+    snprintf(version, sizeof(version), "%d", migration->version);
+    const char *params[] = {version, migration->name};
+
+    if (exec_command(conn, "BEGIN") != 0)
+        return -1;
+
+    if (exec_command(conn, migration->sql) != 0)
+        goto rollback;
+
+    PGresult *result = PQexecParams(conn,
+        "INSERT INTO schema_migrations (version, name) VALUES ($1, $2)",
+        2, NULL, params, NULL, NULL, 0);
+    bool recorded = PQresultStatus(result) == PGRES_COMMAND_OK;
+    PQclear(result);
+
+    if (!recorded || exec_command(conn, "COMMIT") != 0)
+        goto rollback;
+
+    printf("[DB] Applied migration %d: %s\n", migration->version, migration->name);
+    return 0;
+
+rollback:
+    fprintf(stderr, "[DB] Migration %d (%s) failed\n", migration->version, migration->name);
+    exec_command(conn, "ROLLBACK");
+    return -1;
+}
+
+int db_migrate(PGconn *conn)
+{
+    int latest = migrations[migration_count - 1].version;
+
+    // Common case: two small reads and nothing to do
+    int version = current_version(conn);
+    if (version < 0)
+        return -1;
+
+    if (version >= latest) {
+        printf("[DB] Schema is up to date (version %d)\n", version);
+        return 0;
+    }
+
+    if (exec_command(conn, "SELECT pg_advisory_lock(" MIGRATION_LOCK_KEY ")") != 0)
+        return -1;
+
+    int rc = exec_command(conn,
+        "CREATE TABLE IF NOT EXISTS schema_migrations ("
+        "  version INTEGER PRIMARY KEY, "
+        "  name TEXT NOT NULL, "
+        "  applied_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW()"
+        ")");
+
+    // Another server may have migrated while we waited for the lock
+    if (rc == 0)
+        version = current_version(conn);
+
+    int from = version;
+    if (rc == 0 && version < 0)
+        rc = -1;
+
+    for (size_t i = 0; i < migration_count && rc == 0; ++i) {
+        if (migrations[i].version > version)
+            rc = apply(conn, &migrations[i]);
+    }
+
+    exec_command(conn, "SELECT pg_advisory_unlock(" MIGRATION_LOCK_KEY ")");
+
+    if (rc == 0)
+        printf("[DB] Schema migrated from version %d to %d\n", from, latest);
+
+    return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <libpq-fe.h>
+
+// Applies the migrations in migrate.c that are newer than the version
+// recorded in schema_migrations, each in its own transaction.
+// Returns 0 when the schema is current.
+int db_migrate(PGconn *conn);
+
+#endif
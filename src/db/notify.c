@@ -0,0 +1,408 @@
+#include "notify.h"
+#include "uv.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOTIFY_CHANNEL "cache_invalidate"
+#define NOTIFY_RETRY_MS 1000
+#define NOTIFY_QUEUE 1024
+
+// Sent in place of payloads that could not be queued. No cache payload
+// is empty, and peers take it like a lost connection: flush everything.
+#define NOTIFY_FLUSH ""
+
+typedef struct
+{
+    uv_poll_t poll;
+    int fd;
+} watch_t;
+
+static db_pool_config_t config;
+static PGconn *conn = NULL;
+static watch_t *watch = NULL;
+static uv_timer_t retry_timer;
+static db_notify_cb subscriber = NULL;
+
+static bool started = false;
+static bool listening = false;
+static bool busy = false;   // a command has not returned all its results
+static bool missed = false; // the connection dropped since the last LISTEN
+static bool overflowed = false; // payloads were dropped, NOTIFY_FLUSH goes next
+
+// Payloads waiting to be sent, oldest first
+static char *queue[NOTIFY_QUEUE];
+static int queue_head = 0;
+static int queue_count = 0;
+static char *in_flight = NULL;
+
+static void on_poll(uv_poll_t *handle, int status, int events);
+static void on_retry(uv_timer_t *handle);
+
+static void on_watch_closed(uv_handle_t *handle)
+{
+    free(handle->data);
+}
+
+static void unwatch(void)
+{
+    if (!watch)
+        return;
+
+    uv_poll_stop(&watch->poll);
+    uv_close((uv_handle_t *)&watch->poll, on_watch_closed);
+    watch = NULL;
+}
+
+static int watch_socket(int events, uv_poll_cb cb)
+{
+    int fd = PQsocket(conn);
+    if (fd < 0)
+        return -1;
+
+    // libpq may move to another socket while trying the next address
+    if (watch && watch->fd != fd)
+        unwatch();
+
+    if (!watch)
+    {
+        watch_t *w = calloc(1, sizeof(watch_t));
+        if (!w)
+            return -1;
+
+        w->fd = fd;
+
+        if (uv_poll_init(uv_default_loop(), &w->poll, fd) != 0)
+        {
+            free(w);
+            return -1;
+        }
+
+        w->poll.data = w;
+
+        // The server's own handles decide when the loop is done
+        uv_unref((uv_handle_t *)&w->poll);
+        watch = w;
+    }
+
+    return uv_poll_start(&watch->poll, events, cb);
+}
+
+static void clear_queue(void)
+{
+    while (queue_count > 0)
+    {
+        free(queue[queue_head]);
+        queue_head = (queue_head + 1) % NOTIFY_QUEUE;
+        queue_count--;
+    }
+}
+
+// One flush covers whatever is queued and whatever comes until it is sent
+static void overflow(void)
+{
+    if (!overflowed)
+        fprintf(stderr, "[DB] Notify queue full, peers will flush their caches\n");
+
+    overflowed = true;
+    clear_queue();
+}
+
+// Puts the payload that was being sent back at the front of the queue
+static void requeue_in_flight(void)
+{
+    if (!in_flight)
+        return;
+
+    if (queue_count == NOTIFY_QUEUE)
+    {
+        free(in_flight);
+        overflow();
+    }
+    else
+    {
+        queue_head = (queue_head + NOTIFY_QUEUE - 1) % NOTIFY_QUEUE;
+        queue[queue_head] = in_flight;
+        queue_count++;
+    }
+
+    in_flight = NULL;
+}
+
+static void drop_connection(void)
+{
+    fprintf(stderr, "[DB] Notify connection failed: %s", PQerrorMessage(conn));
+
+    unwatch();
+    PQfinish(conn);
+    conn = NULL;
+
+    requeue_in_flight();
+    listening = false;
+    busy = false;
+    missed = true;
+
+    if (started)
+        uv_timer_start(&retry_timer, on_retry, NOTIFY_RETRY_MS, 0);
+}
+
+static int flush_output(void)
+{
+    int rc = PQflush(conn);
+    if (rc < 0)
+        return -1;
+
+    // Wait for the socket to drain before sending the rest
+    return watch_socket(rc == 1 ? UV_READABLE | UV_WRITABLE : UV_READABLE, on_poll);
+}
+
+static int send_command(const char *sql, int nparams, const char *const *params)
+{
+    if (!PQsendQueryParams(conn, sql, nparams, NULL, params, NULL, NULL, 0))
+        return -1;
+
+    busy = true;
+    return flush_output();
+}
+
+static int send_next(void)
+{
+    if (!listening || busy)
+        return 0;
+
+    if (overflowed)
+    {
+        // Tried again on the next socket event if this fails
+        in_flight = strdup(NOTIFY_FLUSH);
+        if (!in_flight)
+            return 0;
+
+        overflowed = false;
+    }
+    else
+    {
+        if (queue_count == 0)
+            return 0;
+
+        in_flight = queue[queue_head];
+        queue_head = (queue_head + 1) % NOTIFY_QUEUE;
+        queue_count--;
+    }
+
+    const char *params[] = {NOTIFY_CHANNEL, in_flight};
+    return send_command("SELECT pg_notify($1, $2)", 2, params);
+}
+
+static void on_listening(void)
+{
+    listening = true;
+    printf("[DB] Listening on %s\n", NOTIFY_CHANNEL);
+
+    if (missed && subscriber)
+        subscriber(NULL);
+
+    missed = false;
+}
+
+static int read_results(void)
+{
+    bool failed = false;
+
+    while (busy && !PQisBusy(conn))
+    {
+        PGresult *result = PQgetResult(conn);
+
+        if (result)
+        {
+            ExecStatusType status = PQresultStatus(result);
+            if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK)
+            {
+                fprintf(stderr, "[DB] Notify command failed: %s", PQresultErrorMessage(result));
+                failed = true;
+            }
+
+            PQclear(result);
+            continue;
+        }
+
+        busy = false;
+
+        // Without LISTEN the connection is useless, try again later
+        if (!listening)
+        {
+            if (failed)
+                return -1;
+
+            on_listening();
+        }
+
+        // A payload the server refused would only fail again
+        free(in_flight);
+        in_flight = NULL;
+    }
+
+    return 0;
+}
+
+static void deliver_notifications(void)
+{
+    int self = PQbackendPID(conn);
+    PGnotify *notify;
+
+    while ((notify = PQnotifies(conn)))
+    {
+        // This process already applied its own invalidations
+        if (notify->be_pid != self && subscriber)
+            subscriber(strcmp(notify->extra, NOTIFY_FLUSH) == 0 ? NULL : notify->extra);
+
+        PQfreemem(notify);
+    }
+}
+
+static void on_poll(uv_poll_t *handle, int status, int events)
+{
+    if (status < 0)
+    {
+        drop_connection();
+        return;
+    }
+
+    if ((events & UV_WRITABLE) && flush_output() != 0)
+    {
+        drop_connection();
+        return;
+    }
+
+    if (events & UV_READABLE)
+    {
+        if (!PQconsumeInput(conn) || read_results() != 0)
+        {
+            drop_connection();
+            return;
+        }
+
+        deliver_notifications();
+    }
+
+    if (send_next() != 0)
+        drop_connection();
+}
+
+static void on_connect_poll(uv_poll_t *handle, int status, int events)
+{
+    PostgresPollingStatusType polling = status < 0 ? PGRES_POLLING_FAILED
+                                                   : PQconnectPoll(conn);
+
+    switch (polling)
+    {
+    case PGRES_POLLING_READING:
+        if (watch_socket(UV_READABLE, on_connect_poll) == 0)
+            return;
+        break;
+
+    case PGRES_POLLING_WRITING:
+        if (watch_socket(UV_WRITABLE, on_connect_poll) == 0)
+            return;
+        break;
+
+    case PGRES_POLLING_OK:
+        if (PQsetnonblocking(conn, 1) == 0 &&
+            send_command("LISTEN " NOTIFY_CHANNEL, 0, NULL) == 0)
+            return;
+        break;
+
+    default:
+        break;
+    }
+
+    drop_connection();
+}
+
+static void on_retry(uv_timer_t *handle)
+{
+    const char *keys[] = {"host", "port", "dbname", "user", "password", NULL};
+    const char *values[] = {
+        config.host,
+        config.port,
+        config.dbname,
+        config.user,
+        config.password,
+        NULL};
+
+    conn = PQconnectStartParams(keys, values, 0);
+
+    if (!conn || PQstatus(conn) == CONNECTION_BAD ||
+        watch_socket(UV_WRITABLE, on_connect_poll) != 0)
+    {
+        drop_connection();
+    }
+}
+
+int db_notify_start(const db_pool_config_t *pool_config)
+{
+    if (started)
+        return 0;
+
+    config = *pool_config;
+
+    if (uv_timer_init(uv_default_loop(), &retry_timer) != 0)
+        return -1;
+
+    uv_unref((uv_handle_t *)&retry_timer);
+
+    started = true;
+    on_retry(&retry_timer);
+    return 0;
+}
+
+void db_notify_stop(void)
+{
+    if (!started)
+        return;
+
+    started = false;
+
+    uv_timer_stop(&retry_timer);
+    uv_close((uv_handle_t *)&retry_timer, NULL);
+
+    unwatch();
+    PQfinish(conn);
+    conn = NULL;
+
+    free(in_flight);
+    in_flight = NULL;
+
+    clear_queue();
+    overflowed = false;
+
+    listening = false;
+    busy = false;
+}
+
+void db_notify_subscribe(db_notify_cb cb)
+{
+    subscriber = cb;
+}
+
+void db_notify(const char *payload)
+{
+    if (!started || !payload)
+        return;
+
+    // Peers cannot be told which entries are stale, so they are told to
+    // drop everything rather than keep serving them
+    char *copy = overflowed || queue_count == NOTIFY_QUEUE ? NULL : strdup(payload);
+    if (!copy)
+    {
+        overflow();
+    }
+    else
+    {
+        queue[(queue_head + queue_count) % NOTIFY_QUEUE] = copy;
+        queue_count++;
+    }
+
+    if (conn && send_next() != 0)
+        drop_connection();
+}
@@ -0,0 +1,26 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "pool.h"
+
+// Invalidation bus between server processes: one connection outside
+// the pools that LISTENs on a channel and also sends this process's
+// own notifications. It is watched by the event loop, never polled.
+
+typedef void (*db_notify_cb)(const char *payload);
+
+// Connects in the background and reconnects when the connection drops
+int db_notify_start(const db_pool_config_t *config);
+void db_notify_stop(void);
+
+// Gets payloads sent by other processes. After the connection was lost
+// it gets NULL once LISTEN is back, since anything may have been missed.
+// It also gets NULL when a peer had more invalidations than it could
+// queue and sent one flush in their place.
+void db_notify_subscribe(db_notify_cb cb);
+
+// Queued until the connection is up, never delivered to this process.
+// Past NOTIFY_QUEUE waiting payloads, peers are sent a flush instead.
+void db_notify(const char *payload);
+
+#endif
@@ -0,0 +1,508 @@
+#include "pool.h"
+#include "uv.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_TICK_MS 100
+
+typedef enum
+{
+    SLOT_FREE,
+    SLOT_CONNECTING,
+    SLOT_IDLE,
+    SLOT_BUSY
+} slot_state_t;
+
+typedef struct connect_s connect_t;
+
+typedef struct
+{
+    PGconn *conn;
+    slot_state_t state;
+    uint64_t idle_since;
+    connect_t *connect;
+} slot_t;
+
+// Watches a connection that is still being opened
+struct connect_s
+{
+    db_pool_t *pool;
+    int slot;
+    int fd;
+    uv_poll_t poll;
+};
+
+typedef struct
+{
+    db_acquire_cb cb;
+    void *data;
+    uint64_t since;
+} waiter_t;
+
+struct db_pool
+{
+    db_pool_config_t config;
+    slot_t *slots;
+
+    // FIFO ring of borrowers waiting for a connection
+    waiter_t *waiters;
+    int waiters_head;
+    int waiters_count;
+
+    uv_timer_t timer;
+    db_pool_stats_t stats;
+};
+
+static uint64_t now_ms(void)
+{
+    return uv_hrtime() / 1000000;
+}
+
+static PGconn *connect_params(const db_pool_t *pool, bool async)
+{
+    const char *keys[] = {"host", "port", "dbname", "user", "password", NULL};
+    const char *values[] = {
+        pool->config.host,
+        pool->config.port,
+        pool->config.dbname,
+        pool->config.user,
+        pool->config.password,
+        NULL};
+
+    return async ? PQconnectStartParams(keys, values, 0)
+                 : PQconnectdbParams(keys, values, 0);
+}
+
+static int count_slots(const db_pool_t *pool, slot_state_t state)
+{
+    int n = 0;
+    for (int i = 0; i < pool->config.max_size; i++)
+    {
+        if (pool->slots[i].state == state)
+            n++;
+    }
+    return n;
+}
+
+static int find_slot(const db_pool_t *pool, slot_state_t state)
+{
+    for (int i = 0; i < pool->config.max_size; i++)
+    {
+        if (pool->slots[i].state == state)
+            return i;
+    }
+    return -1;
+}
+
+static void close_slot(db_pool_t *pool, slot_t *slot)
+{
+    PQfinish(slot->conn);
+    slot->conn = NULL;
+    slot->state = SLOT_FREE;
+    pool->stats.closed++;
+}
+
+static bool pop_waiter(db_pool_t *pool, waiter_t *out)
+{
+    if (pool->waiters_count == 0)
+        return false;
+
+    *out = pool->waiters[pool->waiters_head];
+    pool->waiters_head = (pool->waiters_head + 1) % pool->config.max_waiters;
+    pool->waiters_count--;
+    return true;
+}
+
+static void hand_out(slot_t *slot, db_acquire_cb cb, void *data)
+{
+    slot->state = SLOT_BUSY;
+    cb(slot->conn, data);
+}
+
+// A connection became available: the oldest waiter gets it first
+static void make_available(db_pool_t *pool, slot_t *slot)
+{
+    waiter_t waiter;
+
+    if (pop_waiter(pool, &waiter))
+    {
+        uint64_t waited = now_ms() - waiter.since;
+        pool->stats.wait_ms_total += waited;
+        if (waited > pool->stats.wait_ms_max)
+            pool->stats.wait_ms_max = waited;
+
+        hand_out(slot, waiter.cb, waiter.data);
+        return;
+    }
+
+    slot->state = SLOT_IDLE;
+    slot->idle_since = now_ms();
+}
+
+static void on_connect_closed(uv_handle_t *handle)
+{
+    free(handle->data);
+}
+
+static void connect_done(connect_t *c)
+{
+    c->pool->slots[c->slot].connect = NULL;
+    uv_poll_stop(&c->poll);
+    uv_close((uv_handle_t *)&c->poll, on_connect_closed);
+}
+
+static int watch_connect(db_pool_t *pool, int index, int events);
+
+static void on_connect_poll(uv_poll_t *handle, int status, int events)
+{
+    connect_t *c = (connect_t *)handle->data;
+    db_pool_t *pool = c->pool;
+    int index = c->slot;
+    slot_t *slot = &pool->slots[index];
+
+    PostgresPollingStatusType polling = status < 0 ? PGRES_POLLING_FAILED
+                                                   : PQconnectPoll(slot->conn);
+
+    switch (polling)
+    {
+    case PGRES_POLLING_READING:
+        if (watch_connect(pool, index, UV_READABLE) == 0)
+            return;
+        break;
+
+    case PGRES_POLLING_WRITING:
+        if (watch_connect(pool, index, UV_WRITABLE) == 0)
+            return;
+        break;
+
+    case PGRES_POLLING_OK:
+        connect_done(c);
+        pool->stats.created++;
+        make_available(pool, slot);
+        return;
+
+    default:
+        break;
+    }
+
+    fprintf(stderr, "[DB] Pool connection failed: %s", PQerrorMessage(slot->conn));
+    if (slot->connect)
+        connect_done(slot->connect);
+    PQfinish(slot->conn);
+    slot->conn = NULL;
+    slot->state = SLOT_FREE;
+}
+
+static int watch_connect(db_pool_t *pool, int index, int events)
+{
+    slot_t *slot = &pool->slots[index];
+    int fd = PQsocket(slot->conn);
+
+    // libpq may move to another socket while trying the next address
+    if (slot->connect && slot->connect->fd != fd)
+        connect_done(slot->connect);
+
+    if (!slot->connect)
+    {
+        connect_t *c = calloc(1, sizeof(connect_t));
+        if (!c)
+            return -1;
+
+        c->pool = pool;
+        c->slot = index;
+        c->fd = fd;
+
+        if (uv_poll_init(uv_default_loop(), &c->poll, fd) != 0)
+        {
+            free(c);
+            return -1;
+        }
+
+        c->poll.data = c;
+        slot->connect = c;
+    }
+
+    return uv_poll_start(&slot->connect->poll, events, on_connect_poll);
+}
+
+// Opens one more connection without blocking the loop
+static void grow(db_pool_t *pool)
+{
+    int index = find_slot(pool, SLOT_FREE);
+    if (index < 0)
+        return;
+
+    slot_t *slot = &pool->slots[index];
+
+    slot->conn = connect_params(pool, true);
+    if (!slot->conn || PQstatus(slot->conn) == CONNECTION_BAD)
+    {
+        fprintf(stderr, "[DB] Pool connection failed: %s", PQerrorMessage(slot->conn));
+        PQfinish(slot->conn);
+        slot->conn = NULL;
+        return;
+    }
+
+    slot->state = SLOT_CONNECTING;
+
+    if (watch_connect(pool, index, UV_WRITABLE) != 0)
+    {
+        if (slot->connect)
+            connect_done(slot->connect);
+        PQfinish(slot->conn);
+        slot->conn = NULL;
+        slot->state = SLOT_FREE;
+    }
+}
+
+static void on_tick(uv_timer_t *handle)
+{
+    db_pool_t *pool = (db_pool_t *)handle->data;
+    uint64_t now = now_ms();
+
+    // The queue is FIFO, so expired waiters are always at the front
+    while (pool->waiters_count > 0)
+    {
+        waiter_t *oldest = &pool->waiters[pool->waiters_head];
+        if (now - oldest->since < (uint64_t)pool->config.timeout_ms)
+            break;
+
+        waiter_t waiter;
+        pop_waiter(pool, &waiter);
+        pool->stats.timeouts++;
+        waiter.cb(NULL, waiter.data);
+    }
+
+    if (pool->waiters_count > 0)
+        return;
+
+    // Shrink one connection per tick so a short lull does not drain the pool
+    int open = pool->config.max_size - count_slots(pool, SLOT_FREE);
+    if (open <= pool->config.min_size)
+        return;
+
+    for (int i = 0; i < pool->config.max_size; i++)
+    {
+        slot_t *slot = &pool->slots[i];
+        if (slot->state == SLOT_IDLE &&
+            now - slot->idle_since >= (uint64_t)pool->config.idle_timeout_ms)
+        {
+            close_slot(pool, slot);
+            return;
+        }
+    }
+}
+
+db_pool_t *db_pool_create(const db_pool_config_t *config)
+{
+    if (!config || config->min_size < 1 || config->max_size < config->min_size ||
+        config->max_waiters < 1)
+        return NULL;
+
+    db_pool_t *pool = calloc(1, sizeof(db_pool_t));
+    if (!pool)
+        return NULL;
+
+    pool->config = *config;
+    pool->slots = calloc(config->max_size, sizeof(slot_t));
+    pool->waiters = calloc(config->max_waiters, sizeof(waiter_t));
+
+    if (!pool->slots || !pool->waiters)
+    {
+        free(pool->slots);
+        free(pool->waiters);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < config->min_size; i++)
+    {
+        slot_t *slot = &pool->slots[i];
+
+        slot->conn = connect_params(pool, false);
+        if (PQstatus(slot->conn) != CONNECTION_OK)
+        {
+            fprintf(stderr, "[DB] Connection failed: %s", PQerrorMessage(slot->conn));
+            PQfinish(slot->conn);
+            slot->conn = NULL;
+            db_pool_destroy(pool);
+            return NULL;
+        }
+
+        slot->state = SLOT_IDLE;
+        slot->idle_since = now_ms();
+        pool->stats.created++;
+    }
+
+    uv_timer_init(uv_default_loop(), &pool->timer);
+    pool->timer.data = pool;
+    uv_timer_start(&pool->timer, on_tick, POOL_TICK_MS, POOL_TICK_MS);
+
+    // Housekeeping alone should not keep the loop alive
+    uv_unref((uv_handle_t *)&pool->timer);
+
+    return pool;
+}
+
+static void on_timer_closed(uv_handle_t *handle)
+{
+    db_pool_t *pool = (db_pool_t *)handle->data;
+    free(pool->slots);
+    free(pool->waiters);
+    free(pool);
+}
+
+void db_pool_destroy(db_pool_t *pool)
+{
+    if (!pool)
+        return;
+
+    waiter_t waiter;
+    while (pop_waiter(pool, &waiter))
+        waiter.cb(NULL, waiter.data);
+
+    for (int i = 0; i < pool->config.max_size; i++)
+    {
+        slot_t *slot = &pool->slots[i];
+
+        if (slot->connect)
+            connect_done(slot->connect);
+
+        if (slot->conn)
+            close_slot(pool, slot);
+    }
+
+    if (pool->timer.data)
+    {
+        uv_timer_stop(&pool->timer);
+        uv_close((uv_handle_t *)&pool->timer, on_timer_closed);
+    }
+    else
+    {
+        on_timer_closed((uv_handle_t *)&pool->timer);
+    }
+}
+
+PGconn *db_pool_borrow(db_pool_t *pool)
+{
+    if (!pool)
+        return NULL;
+
+    pool->stats.borrows++;
+
+    int index = find_slot(pool, SLOT_IDLE);
+    if (index >= 0)
+    {
+        pool->slots[index].state = SLOT_BUSY;
+        return pool->slots[index].conn;
+    }
+
+    // Nobody can release a connection while we block the loop,
+    // so the only option left is a new one
+    index = find_slot(pool, SLOT_FREE);
+    if (index < 0)
+    {
+        pool->stats.rejected++;
+        return NULL;
+    }
+
+    slot_t *slot = &pool->slots[index];
+    slot->conn = connect_params(pool, false);
+
+    if (PQstatus(slot->conn) != CONNECTION_OK)
+    {
+        fprintf(stderr, "[DB] Connection failed: %s", PQerrorMessage(slot->conn));
+        PQfinish(slot->conn);
+        slot->conn = NULL;
+        pool->stats.rejected++;
+        return NULL;
+    }
+
+    pool->stats.created++;
+    slot->state = SLOT_BUSY;
+    return slot->conn;
+}
+
+int db_pool_acquire(db_pool_t *pool, db_acquire_cb cb, void *data)
+{
+    if (!pool || !cb)
+        return -1;
+
+    int index = find_slot(pool, SLOT_IDLE);
+    if (index >= 0)
+    {
+        pool->stats.borrows++;
+
+        // Last idle connection went out: open the next one ahead of time
+        if (count_slots(pool, SLOT_IDLE) == 1 && count_slots(pool, SLOT_CONNECTING) == 0)
+            grow(pool);
+
+        hand_out(&pool->slots[index], cb, data);
+        return 0;
+    }
+
+    if (pool->waiters_count == pool->config.max_waiters)
+    {
+        pool->stats.rejected++;
+        return -1;
+    }
+
+    int tail = (pool->waiters_head + pool->waiters_count) % pool->config.max_waiters;
+    pool->waiters[tail].cb = cb;
+    pool->waiters[tail].data = data;
+    pool->waiters[tail].since = now_ms();
+    pool->waiters_count++;
+
+    pool->stats.borrows++;
+    pool->stats.waits++;
+
+    // Grow while there are more waiters than connections on the way
+    if (count_slots(pool, SLOT_CONNECTING) < pool->waiters_count)
+        grow(pool);
+
+    return 0;
+}
+
+void db_pool_release(db_pool_t *pool, PGconn *conn)
+{
+    if (!pool || !conn)
+        return;
+
+    for (int i = 0; i < pool->config.max_size; i++)
+    {
+        slot_t *slot = &pool->slots[i];
+        if (slot->conn != conn)
+            continue;
+
+        if (PQstatus(conn) != CONNECTION_OK ||
+            PQtransactionStatus(conn) != PQTRANS_IDLE)
+        {
+            // Broken or left mid-transaction: replace it instead
+            close_slot(pool, slot);
+            if (pool->waiters_count > 0)
+                grow(pool);
+            return;
+        }
+
+        make_available(pool, slot);
+        return;
+    }
+
+    // Not from this pool
+    PQfinish(conn);
+}
+
+void db_pool_stats(const db_pool_t *pool, db_pool_stats_t *out)
+{
+    if (!pool || !out)
+        return;
+
+    *out = pool->stats;
+    out->in_use = count_slots(pool, SLOT_BUSY);
+    out->idle = count_slots(pool, SLOT_IDLE);
+    out->connecting = count_slots(pool, SLOT_CONNECTING);
+    out->total = out->in_use + out->idle;
+    out->waiting = pool->waiters_count;
+}
@@ -0,0 +1,63 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <libpq-fe.h>
+#include <stdint.h>
+
+// Connection pool that grows between min_size and max_size while
+// borrowers have to wait, and closes connections that stay idle.
+// Async borrowers that cannot be served right away wait in a bounded
+// FIFO queue until a connection is released or their timeout expires.
+
+typedef struct db_pool db_pool_t;
+
+typedef struct
+{
+    const char *host;
+    const char *port;
+    const char *dbname;
+    const char *user;
+    const char *password;
+    int min_size;
+    int max_size;
+    int max_waiters;
+    int timeout_ms;      // longest an async borrower waits
+    int idle_timeout_ms; // idle connections above min_size are closed after this
+} db_pool_config_t;
+
+typedef struct
+{
+    int total;
+    int in_use;
+    int idle;
+    int connecting;
+    int waiting;
+    uint64_t borrows;
+    uint64_t waits;     // borrows that had to queue
+    uint64_t timeouts;  // queued borrowers that gave up
+    uint64_t rejected;  // queue full, or sync borrow with nothing free
+    uint64_t created;
+    uint64_t closed;
+    uint64_t wait_ms_total;
+    uint64_t wait_ms_max;
+} db_pool_stats_t;
+
+// conn is NULL when the borrow failed or timed out
+typedef void (*db_acquire_cb)(PGconn *conn, void *data);
+
+// Opens min_size connections synchronously
+db_pool_t *db_pool_create(const db_pool_config_t *config);
+void db_pool_destroy(db_pool_t *pool);
+
+// Never waits: an idle connection, a new one if below max_size, or NULL
+PGconn *db_pool_borrow(db_pool_t *pool);
+
+// cb may run before this returns if a connection is idle.
+// Returns -1 (without calling cb) when the wait queue is full.
+int db_pool_acquire(db_pool_t *pool, db_acquire_cb cb, void *data);
+
+void db_pool_release(db_pool_t *pool, PGconn *conn);
+
+void db_pool_stats(const db_pool_t *pool, db_pool_stats_t *out);
+
+#endif
@@ -0,0 +1,924 @@
+#include "query.h"
+#include "db.h"
+#include "uv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct db_step
+{
+    struct db_step *next;
+    char *command; // SQL text, or the statement name if prepared
+    bool prepared;
+    bool reprepared;
+    bool internal; // PREPARE or BEGIN/COMMIT sent by the layer itself
+    bool binary;   // ask for binary result columns
+    bool single_row; // rows go to the callback as they arrive
+    bool prepare_first; // PREPARE before sending, see replay_txn
+    int nparams;
+    char **params;
+    db_callback_t cb;
+    void *data;
+    PGresult *result; // first result, kept until the step is delivered
+} db_step_t;
+
+struct db_query
+{
+    db_pool_t *pool;
+    PGconn *conn;
+    uv_poll_t poll;
+    bool running;
+    bool pipeline;
+    bool cancelled;
+    bool preparing; // current step is waiting on a re-PREPARE
+    bool binary;    // applies to steps queued from now on
+    bool single_row;
+    db_step_t *head;
+    db_step_t *tail;
+    db_step_t *current;
+    char *writer; // user whose reads follow this query to the primary
+
+    // Pipeline batch in flight, results are read into the steps in order
+    db_step_t *batch;
+    db_step_t *reading;
+    int pending_syncs;
+
+    // The same batch run step by step when pipelining is off, see start_txn
+    bool in_txn;
+    bool txn_replay; // rolled back to prepare a statement, run it again
+    db_step_t *txn_todo;
+    db_step_t *txn_done;
+    db_step_t **txn_done_tail;
+};
+
+static void step_free(db_step_t *step)
+{
+    if (!step)
+        return;
+
+    for (int i = 0; i < step->nparams; i++)
+        free(step->params[i]);
+
+    PQclear(step->result);
+    free(step->params);
+    free(step->command);
+    free(step);
+}
+
+static void steps_free(db_step_t *step)
+{
+    while (step)
+    {
+        db_step_t *next = step->next;
+        step_free(step);
+        step = next;
+    }
+}
+
+static void query_free(db_query_t *pg)
+{
+    steps_free(pg->head);
+    steps_free(pg->batch);
+    steps_free(pg->txn_todo);
+    steps_free(pg->txn_done);
+    step_free(pg->current);
+    free(pg->writer);
+    free(pg);
+}
+
+static void on_poll_closed(uv_handle_t *handle)
+{
+    db_query_t *pg = (db_query_t *)handle->data;
+
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQpipelineStatus(pg->conn) != PQ_PIPELINE_OFF)
+        PQexitPipelineMode(pg->conn);
+#endif
+
+    PQsetnonblocking(pg->conn, 0);
+    db_pool_release(pg->pool, pg->conn);
+
+    // Committed by now, so replica reads may lag behind it from here on
+    if (pg->writer)
+        db_note_write(pg->writer);
+
+    query_free(pg);
+}
+
+static void query_finish(db_query_t *pg)
+{
+    uv_poll_stop(&pg->poll);
+    uv_close((uv_handle_t *)&pg->poll, on_poll_closed);
+}
+
+static void on_poll(uv_poll_t *handle, int status, int events);
+
+static int watch(db_query_t *pg)
+{
+    int events = UV_READABLE;
+
+    int flushed = PQflush(pg->conn);
+    if (flushed < 0)
+        return -1;
+    if (flushed == 1)
+        events |= UV_WRITABLE;
+
+    return uv_poll_start(&pg->poll, events, on_poll);
+}
+
+static int send_step(PGconn *conn, db_step_t *step, bool prepare)
+{
+    if (prepare)
+    {
+        const char *sql = db_statement_sql(step->command);
+        return sql && PQsendPrepare(conn, step->command, sql, 0, NULL);
+    }
+
+    if (step->prepared)
+    {
+        return PQsendQueryPrepared(conn, step->command, step->nparams,
+                                   (const char *const *)step->params,
+                                   NULL, NULL, step->binary);
+    }
+
+    return PQsendQueryParams(conn, step->command, step->nparams, NULL,
+                             (const char *const *)step->params,
+                             NULL, NULL, step->binary);
+}
+
+static bool needs_prepare(const db_step_t *step)
+{
+    if (!step->prepared || step->reprepared || step->internal)
+        return false;
+
+    const char *state = PQresultErrorField(step->result, PG_DIAG_SQLSTATE);
+    return state && strcmp(state, SQLSTATE_UNDEFINED_PSTATEMENT) == 0;
+}
+
+static bool failed(const PGresult *result)
+{
+    ExecStatusType status = PQresultStatus(result);
+    return status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK;
+}
+
+static void run_next(db_query_t *pg);
+static void replay_txn(db_query_t *pg);
+
+// DB_PIPELINE=off runs every batch step by step, to compare the two
+static bool pipeline_allowed(void)
+{
+    static int allowed = -1;
+
+    if (allowed < 0)
+    {
+        const char *value = getenv("DB_PIPELINE");
+        allowed = !(value && strcmp(value, "off") == 0);
+    }
+
+    return allowed;
+}
+
+// Sequential mode: one step on the wire at a time
+
+static int send_current(db_query_t *pg)
+{
+    if (!send_step(pg->conn, pg->current, pg->preparing))
+        return -1;
+
+    if (pg->current->single_row && !pg->preparing)
+        PQsetSingleRowMode(pg->conn);
+
+    return watch(pg);
+}
+
+static void txn_step_done(db_query_t *pg, db_step_t *step);
+
+static void deliver(db_query_t *pg, PGresult *result)
+{
+    db_step_t *step = pg->current;
+    pg->current = NULL;
+
+    if (pg->in_txn)
+    {
+        txn_step_done(pg, step);
+        return;
+    }
+
+    // The result is owned by the query, the callback only borrows it
+    if (!pg->cancelled)
+        step->cb(pg, result, step->data);
+
+    step_free(step);
+    run_next(pg);
+}
+
+static void fail_current(db_query_t *pg)
+{
+    PQclear(pg->current->result);
+    pg->current->result = NULL;
+    pg->preparing = false;
+    deliver(pg, NULL);
+}
+
+static void complete_current(db_query_t *pg)
+{
+    db_step_t *step = pg->current;
+
+    if (pg->preparing)
+    {
+        // The statement exists on this connection now, run the step again
+        pg->preparing = false;
+        bool prepared = PQresultStatus(step->result) == PGRES_COMMAND_OK;
+        PQclear(step->result);
+        step->result = NULL;
+
+        if (!prepared || send_current(pg) != 0)
+            fail_current(pg);
+        return;
+    }
+
+    // The pool may hand out a connection that was opened after db_init()
+    // prepared the registry, so prepare lazily and retry once
+    if (needs_prepare(step))
+    {
+        PQclear(step->result);
+        step->result = NULL;
+        step->reprepared = true;
+
+        if (pg->in_txn)
+        {
+            replay_txn(pg);
+            return;
+        }
+
+        pg->preparing = true;
+
+        if (send_current(pg) != 0)
+            fail_current(pg);
+        return;
+    }
+
+    deliver(pg, step->result);
+}
+
+// Sequential batch: what db_query_pipeline() asks for when pipelining
+// is off. The steps run one at a time inside BEGIN/COMMIT and stop at
+// the first failure, which is rolled back. As in complete_batch, the
+// callbacks get the results in order once the transaction has ended,
+// up to and including the failed step.
+
+static int send_control(db_query_t *pg, const char *sql)
+{
+    db_step_t *step = calloc(1, sizeof(db_step_t));
+    if (!step || !(step->command = strdup(sql)))
+    {
+        free(step);
+        return -1;
+    }
+
+    step->internal = true;
+    pg->current = step;
+
+    if (send_current(pg) != 0)
+    {
+        pg->current = NULL;
+        step_free(step);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void complete_txn(db_query_t *pg)
+{
+    db_step_t *done = pg->txn_done;
+
+    steps_free(pg->txn_todo);
+    pg->txn_todo = pg->txn_done = NULL;
+    pg->txn_done_tail = &pg->txn_done;
+    pg->in_txn = false;
+
+    for (db_step_t *step = done; step && !pg->cancelled; step = step->next)
+        step->cb(pg, step->result, step->data);
+
+    steps_free(done);
+    run_next(pg);
+}
+
+static void fail_txn(db_query_t *pg)
+{
+    // Report to the first step, the rest of the chain is dropped
+    db_step_t *first = pg->txn_done ? pg->txn_done : pg->txn_todo;
+    if (first && !pg->cancelled)
+        first->cb(pg, NULL, first->data);
+
+    steps_free(pg->txn_todo);
+    steps_free(pg->txn_done);
+    pg->txn_todo = pg->txn_done = NULL;
+    pg->txn_done_tail = &pg->txn_done;
+    pg->in_txn = false;
+    pg->txn_replay = false;
+
+    pg->cancelled = true;
+    run_next(pg);
+}
+
+static void send_txn_next(db_query_t *pg)
+{
+    db_step_t *step = pg->txn_todo;
+    if (!step)
+    {
+        if (send_control(pg, "COMMIT") != 0)
+            fail_txn(pg);
+        return;
+    }
+
+    pg->txn_todo = step->next;
+    step->next = NULL;
+    pg->current = step;
+    pg->preparing = step->prepare_first;
+    step->prepare_first = false;
+
+    if (send_current(pg) != 0)
+        fail_current(pg);
+}
+
+static void start_txn(db_query_t *pg)
+{
+    pg->in_txn = true;
+    pg->txn_todo = pg->head;
+    pg->head = pg->tail = NULL;
+    pg->txn_done = NULL;
+    pg->txn_done_tail = &pg->txn_done;
+
+    // Results are held back until the end, so rows are not streamed
+    for (db_step_t *step = pg->txn_todo; step; step = step->next)
+        step->single_row = false;
+
+    if (send_control(pg, "BEGIN") != 0)
+        fail_txn(pg);
+}
+
+// A missing statement aborted the transaction: roll back, then run the
+// whole batch again with the statement prepared ahead of its step
+static void replay_txn(db_query_t *pg)
+{
+    db_step_t *step = pg->current;
+    pg->current = NULL;
+
+    step->prepare_first = true;
+    step->next = pg->txn_todo;
+    *pg->txn_done_tail = step;
+
+    for (db_step_t *s = pg->txn_done; s; s = s->next)
+    {
+        PQclear(s->result);
+        s->result = NULL;
+    }
+
+    pg->txn_todo = pg->txn_done;
+    pg->txn_done = NULL;
+    pg->txn_done_tail = &pg->txn_done;
+    pg->txn_replay = true;
+
+    if (send_control(pg, "ROLLBACK") != 0)
+        fail_txn(pg);
+}
+
+static void txn_step_done(db_query_t *pg, db_step_t *step)
+{
+    if (!step->internal)
+    {
+        // Kept, in order, for complete_txn
+        *pg->txn_done_tail = step;
+        pg->txn_done_tail = &step->next;
+
+        if (!failed(step->result))
+        {
+            send_txn_next(pg);
+            return;
+        }
+
+        // The steps behind it never run, as in a pipeline
+        steps_free(pg->txn_todo);
+        pg->txn_todo = NULL;
+
+        // A connection that cannot even roll back is not reused by the pool
+        if (send_control(pg, "ROLLBACK") != 0)
+            complete_txn(pg);
+        return;
+    }
+
+    bool ok = !failed(step->result);
+    bool begin = strcmp(step->command, "BEGIN") == 0;
+    bool commit = strcmp(step->command, "COMMIT") == 0;
+    step_free(step);
+
+    if (begin || commit)
+    {
+        if (!ok)
+            fail_txn(pg);
+        else if (begin)
+            send_txn_next(pg);
+        else
+            complete_txn(pg);
+        return;
+    }
+
+    // ROLLBACK
+    if (pg->txn_replay)
+    {
+        pg->txn_replay = false;
+        if (send_control(pg, "BEGIN") != 0)
+            fail_txn(pg);
+        return;
+    }
+
+    complete_txn(pg);
+}
+
+// Pipeline mode: every queued step is sent at once and followed by a
+// single sync, so the batch runs as one implicit transaction and costs
+// one round trip. Results are handed out after the sync, in order.
+
+#ifdef LIBPQ_HAS_PIPELINING
+
+static int send_batch(db_query_t *pg)
+{
+    if (PQpipelineStatus(pg->conn) == PQ_PIPELINE_OFF &&
+        !PQenterPipelineMode(pg->conn))
+        return -1;
+
+    for (db_step_t *step = pg->batch; step; step = step->next)
+    {
+        if (!send_step(pg->conn, step, step->internal))
+            return -1;
+
+        // A PREPARE gets its own sync, so an "already exists" error
+        // cannot abort the statements behind it
+        if (step->internal)
+        {
+            if (!PQpipelineSync(pg->conn))
+                return -1;
+            pg->pending_syncs++;
+        }
+    }
+
+    if (!PQpipelineSync(pg->conn))
+        return -1;
+
+    pg->pending_syncs++;
+    pg->reading = pg->batch;
+
+    return watch(pg);
+}
+
+static void fail_batch(db_query_t *pg)
+{
+    db_step_t *batch = pg->batch;
+    pg->batch = NULL;
+    pg->reading = NULL;
+    pg->pending_syncs = 0;
+
+    // Report to the first step, the rest of the chain is dropped
+    for (db_step_t *step = batch; step; step = step->next)
+    {
+        if (!step->internal)
+        {
+            if (!pg->cancelled)
+                step->cb(pg, NULL, step->data);
+            break;
+        }
+    }
+
+    steps_free(batch);
+    pg->cancelled = true;
+    run_next(pg);
+}
+
+static bool replay_batch(db_query_t *pg)
+{
+    bool missing = false;
+    for (db_step_t *step = pg->batch; step; step = step->next)
+    {
+        if (needs_prepare(step))
+            missing = true;
+    }
+
+    if (!missing)
+        return false;
+
+    // A missing statement aborted the whole transaction, so prepare
+    // everything the batch uses and send it again
+    db_step_t *prepares = NULL;
+    db_step_t **tail = &prepares;
+
+    for (db_step_t **link = &pg->batch; *link;)
+    {
+        db_step_t *step = *link;
+
+        if (step->internal)
+        {
+            *link = step->next;
+            step_free(step);
+            continue;
+        }
+
+        PQclear(step->result);
+        step->result = NULL;
+
+        if (step->prepared)
+        {
+            step->reprepared = true;
+
+            db_step_t *prepare = calloc(1, sizeof(db_step_t));
+            if (prepare && (prepare->command = strdup(step->command)))
+            {
+                prepare->prepared = true;
+                prepare->internal = true;
+                *tail = prepare;
+                tail = &prepare->next;
+            }
+            else
+            {
+                free(prepare);
+            }
+        }
+
+        link = &step->next;
+    }
+
+    *tail = pg->batch;
+    pg->batch = prepares;
+
+    if (send_batch(pg) != 0)
+        fail_batch(pg);
+
+    return true;
+}
+
+static void complete_batch(db_query_t *pg)
+{
+    if (!PQexitPipelineMode(pg->conn))
+    {
+        fail_batch(pg);
+        return;
+    }
+
+    if (replay_batch(pg))
+        return;
+
+    db_step_t *batch = pg->batch;
+    pg->batch = NULL;
+    pg->reading = NULL;
+
+    // After the first failure the server aborted everything behind it,
+    // those steps are not reported
+    bool aborted = false;
+
+    for (db_step_t *step = batch; step; step = step->next)
+    {
+        if (step->internal || aborted || pg->cancelled)
+            continue;
+
+        step->cb(pg, step->result, step->data);
+        aborted = failed(step->result);
+    }
+
+    steps_free(batch);
+    run_next(pg);
+}
+
+static void read_batch(db_query_t *pg)
+{
+    while (!PQisBusy(pg->conn))
+    {
+        PGresult *result = PQgetResult(pg->conn);
+
+        if (!result)
+        {
+            // End of the results of one step. Every step yields at least
+            // one result, even when aborted, so a bare NULL is skipped.
+            if (pg->reading && pg->reading->result)
+                pg->reading = pg->reading->next;
+            continue;
+        }
+
+        if (PQresultStatus(result) == PGRES_PIPELINE_SYNC)
+        {
+            PQclear(result);
+            if (--pg->pending_syncs == 0)
+            {
+                complete_batch(pg);
+                return;
+            }
+            continue;
+        }
+
+        if (pg->reading && !pg->reading->result)
+            pg->reading->result = result;
+        else
+            PQclear(result);
+    }
+}
+
+#endif
+
+static void fail_query(db_query_t *pg)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (pg->batch)
+    {
+        fail_batch(pg);
+        return;
+    }
+#endif
+
+    fail_current(pg);
+}
+
+static void run_next(db_query_t *pg)
+{
+    if (pg->cancelled)
+    {
+        steps_free(pg->head);
+        pg->head = pg->tail = NULL;
+    }
+
+    if (!pg->head)
+    {
+        query_finish(pg);
+        return;
+    }
+
+    if (pg->pipeline)
+    {
+#ifdef LIBPQ_HAS_PIPELINING
+        if (pipeline_allowed())
+        {
+            pg->batch = pg->head;
+            pg->head = pg->tail = NULL;
+
+            if (send_batch(pg) != 0)
+            {
+                fprintf(stderr, "[DB] Failed to send pipeline: %s", PQerrorMessage(pg->conn));
+                fail_batch(pg);
+            }
+            return;
+        }
+#endif
+        start_txn(pg);
+        return;
+    }
+
+    pg->current = pg->head;
+    pg->head = pg->head->next;
+    if (!pg->head)
+        pg->tail = NULL;
+
+    pg->current->next = NULL;
+
+    if (send_current(pg) != 0)
+    {
+        fprintf(stderr, "[DB] Failed to send query: %s", PQerrorMessage(pg->conn));
+        deliver(pg, NULL);
+    }
+}
+
+static void on_poll(uv_poll_t *handle, int status, int events)
+{
+    db_query_t *pg = (db_query_t *)handle->data;
+
+    if (status < 0)
+    {
+        fprintf(stderr, "[DB] Poll error: %s\n", uv_strerror(status));
+        fail_query(pg);
+        return;
+    }
+
+    if (events & UV_WRITABLE)
+    {
+        if (watch(pg) != 0)
+        {
+            fail_query(pg);
+            return;
+        }
+    }
+
+    if (!(events & UV_READABLE))
+        return;
+
+    if (!PQconsumeInput(pg->conn))
+    {
+        fprintf(stderr, "[DB] Connection error: %s", PQerrorMessage(pg->conn));
+        fail_query(pg);
+        return;
+    }
+
+#ifdef LIBPQ_HAS_PIPELINING
+    if (pg->batch)
+    {
+        read_batch(pg);
+        return;
+    }
+#endif
+
+    while (!PQisBusy(pg->conn))
+    {
+        PGresult *result = PQgetResult(pg->conn);
+
+        if (!result)
+        {
+            complete_current(pg);
+            return;
+        }
+
+        // Streamed rows are only borrowed by the callback, like results
+        if (PQresultStatus(result) == PGRES_SINGLE_TUPLE)
+        {
+            if (!pg->cancelled)
+                pg->current->cb(pg, result, pg->current->data);
+
+            PQclear(result);
+            continue;
+        }
+
+        // Keep the first result, a single statement only produces one
+        if (!pg->current->result)
+            pg->current->result = result;
+        else
+            PQclear(result);
+    }
+}
+
+db_query_t *db_query_create(db_pool_t *pool)
+{
+    if (!pool)
+        return NULL;
+
+    db_query_t *pg = calloc(1, sizeof(db_query_t));
+    if (!pg)
+        return NULL;
+
+    pg->pool = pool;
+    return pg;
+}
+
+void db_query_pipeline(db_query_t *pg, bool enabled)
+{
+    // Without libpq 14, or with DB_PIPELINE=off, see start_txn
+    if (pg)
+        pg->pipeline = enabled;
+}
+
+void db_query_binary(db_query_t *pg, bool enabled)
+{
+    if (pg)
+        pg->binary = enabled;
+}
+
+void db_query_single_row(db_query_t *pg, bool enabled)
+{
+    if (pg)
+        pg->single_row = enabled;
+}
+
+void db_query_writer(db_query_t *pg, const char *user_id)
+{
+    if (!pg || !user_id)
+        return;
+
+    free(pg->writer);
+    pg->writer = strdup(user_id);
+}
+
+void db_query_cancel(db_query_t *pg)
+{
+    if (pg)
+        pg->cancelled = true;
+}
+
+static int enqueue(db_query_t *pg, const char *command, bool prepared,
+                   int nparams, const char **params,
+                   db_callback_t cb, void *data)
+{
+    db_step_t *step = calloc(1, sizeof(db_step_t));
+    if (!step)
+        goto fail;
+
+    step->prepared = prepared;
+    step->binary = pg->binary;
+    step->single_row = pg->single_row;
+    step->cb = cb;
+    step->data = data;
+    step->command = strdup(command);
+    if (!step->command)
+        goto fail;
+
+    // Callers often pass stack buffers, so parameters are copied
+    if (nparams > 0)
+    {
+        step->params = calloc(nparams, sizeof(char *));
+        if (!step->params)
+            goto fail;
+
+        step->nparams = nparams;
+
+        for (int i = 0; i < nparams; i++)
+        {
+            if (params[i] && !(step->params[i] = strdup(params[i])))
+                goto fail;
+        }
+    }
+
+    if (pg->tail)
+        pg->tail->next = step;
+    else
+        pg->head = step;
+
+    pg->tail = step;
+    return 0;
+
+fail:
+    step_free(step);
+    if (!pg->running)
+        query_free(pg);
+    return -1;
+}
+
+int db_query_queue(db_query_t *pg, const char *sql, int nparams,
+                   const char **params, db_callback_t cb, void *data)
+{
+    if (!pg || !sql || !cb)
+        return -1;
+
+    return enqueue(pg, sql, false, nparams, params, cb, data);
+}
+
+int db_query_queue_prepared(db_query_t *pg, const char *name, int nparams,
+                            const char **params, db_callback_t cb, void *data)
+{
+    if (!pg || !name || !cb)
+        return -1;
+
+    return enqueue(pg, name, true, nparams, params, cb, data);
+}
+
+static void abort_query(db_query_t *pg)
+{
+    // No connection was ever attached, report to the first step only
+    db_step_t *step = pg->head;
+    if (step && !pg->cancelled)
+        step->cb(pg, NULL, step->data);
+
+    query_free(pg);
+}
+
+static void on_acquired(PGconn *conn, void *data)
+{
+    db_query_t *pg = (db_query_t *)data;
+
+    if (!conn)
+    {
+        fprintf(stderr, "[DB] Timed out waiting for a connection\n");
+        abort_query(pg);
+        return;
+    }
+
+    if (PQsetnonblocking(conn, 1) != 0 ||
+        uv_poll_init(uv_default_loop(), &pg->poll, PQsocket(conn)) != 0)
+    {
+        db_pool_release(pg->pool, conn);
+        abort_query(pg);
+        return;
+    }
+
+    pg->conn = conn;
+    pg->poll.data = pg;
+
+    run_next(pg);
+}
+
+int db_query_exec(db_query_t *pg)
+{
+    if (!pg || pg->running)
+        return -1;
+
+    if (!pg->head)
+    {
+        query_free(pg);
+        return -1;
+    }
+
+    pg->running = true;
+
+    // May run the first step right away, pg must not be touched after
+    if (db_pool_acquire(pg->pool, on_acquired, pg) != 0)
+    {
+        fprintf(stderr, "[DB] Connection pool wait queue is full\n");
+        query_free(pg);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "pool.h"
+#include "decode.h"
+#include <stdbool.h>
+
+// Async query chain on a pooled connection, driven by the libuv loop:
+// queue one or more steps, call db_query_exec(), and queue further
+// steps from inside the callbacks if needed. The connection goes back
+// to the pool once the last step completes.
+
+typedef struct db_query db_query_t;
+
+typedef void (*db_callback_t)(db_query_t *pg, PGresult *result, void *data);
+
+db_query_t *db_query_create(db_pool_t *pool);
+
+// Plain SQL with text parameters
+int db_query_queue(db_query_t *pg, const char *sql, int nparams,
+                   const char **params, db_callback_t cb, void *data);
+
+// Named statement from the registry in db.c
+int db_query_queue_prepared(db_query_t *pg, const char *name, int nparams,
+                            const char **params, db_callback_t cb, void *data);
+
+// Send every queued step in one libpq pipeline instead of one by one.
+// A batch runs as one transaction; callbacks get the results in order
+// after it finished, and the steps behind a failed one are dropped.
+// On libpq older than 14, or with DB_PIPELINE=off, the steps go out
+// one at a time between BEGIN and COMMIT, with the same guarantees.
+void db_query_pipeline(db_query_t *pg, bool enabled);
+
+// Steps queued after this return their columns in binary format.
+// Read them with the getters in decode.h, which handle both formats.
+void db_query_binary(db_query_t *pg, bool enabled);
+
+// Steps queued after this run in libpq single-row mode: the callback
+// gets one PGRES_SINGLE_TUPLE result per row as it arrives, then a
+// final PGRES_TUPLES_OK with no rows, or an error result. Only applies
+// to steps outside a batch; in one the whole result is delivered.
+void db_query_single_row(db_query_t *pg, bool enabled);
+
+// Marks the query as a write by user_id, whose reads then go to the
+// primary for a while once it has finished (see db_get_read_pool)
+void db_query_writer(db_query_t *pg, const char *user_id);
+
+// Called from a callback to drop whatever is still pending
+void db_query_cancel(db_query_t *pg);
+
+// Both return 0 on success. If a query fails before it has started
+// running it is released, so the caller only has to send the error.
+// When the pool has no free connection the query waits for one; if
+// that wait times out the first step gets a NULL result.
+int db_query_exec(db_query_t *pg);
+
+#endif
@@ -6,7 +6,7 @@ typedef struct
     Res *res;
 } ctx_t;
 
-static void on_cat_deleted(PGquery *pg, PGresult *result, void *data);
+static void on_cat_deleted(db_query_t *pg, PGresult *result, void *data);
 
 void del_category(Req *req, Res *res)
 {
@@ -29,52 +29,53 @@ void del_category(Req *req, Res *res)
 
     ctx->res = res;
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *delete_sql =
-        "DELETE FROM categories "
-        "WHERE author_id = $1 "
-        "AND slug = $2;";
+    db_query_writer(pg, auth_ctx->id);
 
     const char *params[] = {auth_ctx->id, cat_slug};
 
-    if (pg_query_queue(pg, delete_sql, 2, params, on_cat_deleted, ctx) != 0)
+    if (db_query_queue_prepared(pg, "category_delete", 2, params, on_cat_deleted, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue delete");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute delete");
         return;
     }
 }
 
-static void on_cat_deleted(PGquery *pg, PGresult *result, void *data)
+static void on_cat_deleted(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
     ExecStatusType status = PQresultStatus(result);
 
-    if (status != PGRES_COMMAND_OK)
+    if (status != PGRES_TUPLES_OK)
     {
         printf("Category could not be deleted: %s\n", PQresultErrorMessage(result));
         send_text(ctx->res, 500, "Category could not be deleted");
         return;
     }
 
-    const char *affected = PQcmdTuples(result);
-
-    if (!affected || affected[0] == '\0' || strcmp(affected, "0") == 0) {
+    if (PQntuples(result) == 0) {
         send_text(ctx->res, 404, "Category not found");
         return;
     }
 
+    // Every author whose posts list the category, not only this one
+    for (int i = 0; i < PQntuples(result); i++)
+    {
+        if (!PQgetisnull(result, i, 1))
+            post_cache_invalidate_user(PQgetvalue(result, i, 1));
+    }
     send_text(ctx->res, 200, "Category deleted successfully");
 }
\ No newline at end of file
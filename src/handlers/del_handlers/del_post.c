@@ -5,9 +5,11 @@
 typedef struct
 {
     Res *res;
+    char *username;
+    char *post_slug;
 } ctx_t;
 
-static void on_post_deleted(PGquery *pg, PGresult *result, void *data);
+static void on_post_deleted(db_query_t *pg, PGresult *result, void *data);
 
 void del_post(Req *req, Res *res)
 {
@@ -29,35 +31,34 @@ void del_post(Req *req, Res *res)
     }
 
     ctx->res = res;
+    ctx->username = arena_strdup(res->arena, auth_ctx->username);
+    ctx->post_slug = arena_strdup(res->arena, post_slug);
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *delete_sql =
-        "DELETE FROM posts p "
-        "WHERE p.author_id = $1 "
-        "AND p.slug     = $2;";
+    db_query_writer(pg, auth_ctx->id);
 
     const char *params[] = {auth_ctx->id, post_slug};
 
-    if (pg_query_queue(pg, delete_sql, 2, params, on_post_deleted, ctx) != 0)
+    if (db_query_queue_prepared(pg, "post_delete", 2, params, on_post_deleted, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue delete");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute delete");
         return;
     }
 }
 
-static void on_post_deleted(PGquery *pg, PGresult *result, void *data)
+static void on_post_deleted(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -77,5 +78,6 @@ static void on_post_deleted(PGquery *pg, PGresult *result, void *data)
         return;
     }
 
+    post_cache_invalidate(ctx->username, ctx->post_slug);
     send_text(ctx->res, 200, "Post deleted successfully");
 }
@@ -7,9 +7,45 @@ typedef struct
 {
     Res *res;
     bool is_author;
+    int limit;
+    page_t page;
+
+    // Output is written as the rows arrive, in one of the two
+    format_t format;
+    json_t out;
+    pack_t pack;
+    size_t posts_at; // count of the packed posts array
+    uint32_t posts;
+    int rows;
+    bool has_more;
+    int64_t last_created_at;
+    int64_t last_id;
+
+    // Column numbers, looked up on the first row
+    int col_id;
+    int col_created_at;
+    int col_is_hidden;
+    int col_rendered;
+    int col_categories;
+    char *if_none_match;
+    encoding_t encoding;
 } ctx_t;
 
-static void posts_result_callback(PGquery *pg, PGresult *result, void *data);
+static int query_posts(db_query_t *pg, const char *author_id, void *data);
+static void posts_result_callback(db_query_t *pg, PGresult *result, void *data);
+static void posts_json_callback(db_query_t *pg, PGresult *result, void *data);
+static void send_page(ctx_t *ctx);
+
+// PG_JSON_ROUTES=posts has the server render the page, see JSON_PAGE
+static bool json_in_db(void)
+{
+    static int enabled = -1;
+
+    if (enabled < 0)
+        enabled = env_list_has("PG_JSON_ROUTES", "posts");
+
+    return enabled;
+}
 
 void get_all_posts(Req *req, Res *res)
 {
@@ -22,56 +58,52 @@ void get_all_posts(Req *req, Res *res)
         return;
     }
 
-    ctx->res = res;
-    ctx->is_author = auth_ctx->is_author;
-
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
-    if (!pg)
+    if (!parse_page(req, &ctx->page))
     {
-        send_text(res, 500, "Failed to create async context");
+        send_text(res, 400, "Invalid limit or cursor");
         return;
     }
 
-    const char *sql;
+    ctx->res = res;
+    ctx->if_none_match = if_none_match(req);
+    ctx->encoding = accept_encoding(req);
+    ctx->is_author = auth_ctx->is_author;
+    ctx->limit = ctx->page.limit;
+    ctx->format = accept_format(req);
 
-    if (auth_ctx->is_author)
+    if (ctx->format == FORMAT_JSON)
     {
-        sql =
-            "SELECT p.id, p.header, p.slug, p.content, p.reading_time, "
-            "       p.author_id, u.username, p.created_at, p.updated_at, p.is_hidden, "
-            "       COALESCE(string_agg(c.category, ','), '') as categories, "
-            "       COALESCE(string_agg(c.slug, ','), '') as category_slugs, "
-            "       COALESCE(string_agg(c.id::text, ','), '') as category_ids "
-            "FROM posts p "
-            "JOIN users u ON p.author_id = u.id "
-            "LEFT JOIN post_categories pc ON p.id = pc.post_id "
-            "LEFT JOIN categories c ON pc.category_id = c.id "
-            "WHERE u.username = $1 "
-            "GROUP BY p.id, u.username "
-            "ORDER BY p.created_at DESC";
+        json_init(&ctx->out, req->arena);
+        json_object_begin(&ctx->out);
+        json_key(&ctx->out, "posts");
+        json_array_begin(&ctx->out);
     }
     else
     {
-        sql =
-            "SELECT p.id, p.header, p.slug, p.content, p.reading_time, "
-            "       p.author_id, u.username, p.created_at, p.updated_at, p.is_hidden, "
-            "       COALESCE(string_agg(c.category, ','), '') as categories, "
-            "       COALESCE(string_agg(c.slug, ','), '') as category_slugs, "
-            "       COALESCE(string_agg(c.id::text, ','), '') as category_ids "
-            "FROM posts p "
-            "JOIN users u ON p.author_id = u.id "
-            "LEFT JOIN post_categories pc ON p.id = pc.post_id "
-            "LEFT JOIN categories c ON pc.category_id = c.id "
-            "WHERE u.username = $1 "
-            "  AND p.is_hidden = FALSE "
-            "GROUP BY p.id, u.username "
-            "ORDER BY p.created_at DESC";
+        pack_init(&ctx->pack, req->arena, ctx->format);
+        pack_map(&ctx->pack, 2);
+        pack_string(&ctx->pack, "posts");
+        ctx->posts_at = pack_open_array(&ctx->pack);
+        ctx->posts = 0;
     }
 
-    const char *params[] = {auth_ctx->user_slug};
+    ctx->rows = 0;
+    ctx->has_more = false;
 
-    if (pg_query_queue(pg, sql, 1, params, posts_result_callback, ctx) != 0 ||
-        pg_query_exec(pg) != 0)
+    db_query_t *pg = db_query_create(db_get_read_pool(auth_ctx->id));
+    if (!pg)
+    {
+        send_text(res, 500, "Failed to create async context");
+        return;
+    }
+
+    // Numbers, flags and timestamps come back binary, see decode.h
+    db_query_binary(pg, true);
+
+    if (resolve_author(pg, res, auth_ctx->user_slug, query_posts, ctx) != 0)
+        return;
+
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to queue or execute query");
         return;
@@ -80,87 +112,153 @@ void get_all_posts(Req *req, Res *res)
     // Function returns here, callback will be called when query completes
 }
 
-static void posts_result_callback(PGquery *pg, PGresult *result, void *data)
+static int query_posts(db_query_t *pg, const char *author_id, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
-    if (PQresultStatus(result) != PGRES_TUPLES_OK)
+    if (!author_id)
     {
-        send_text(ctx->res, 500, "DB select failed");
-        return;
+        send_page(ctx); // no rows, an empty page
+        return -1;
     }
 
-    int rows = PQntuples(result);
-    cJSON *root = cJSON_CreateObject();
-    cJSON *posts = cJSON_CreateArray();
+    const char *params[] = {
+        author_id,
+        ctx->page.after_created_at,
+        ctx->page.after_id,
+        ctx->page.fetch,
+    };
 
-    for (int i = 0; i < rows; i++)
+    // The server only renders JSON
+    if (ctx->format == FORMAT_JSON && json_in_db())
     {
-        bool hidden = (PQgetvalue(result, i, PQfnumber(result, "is_hidden"))[0] == 't');
-        if (!ctx->is_author && hidden)
+        const char *stmt = ctx->is_author ? "posts_by_author_json" : "posts_by_author_public_json";
+
+        if (db_query_queue_prepared(pg, stmt, 4, params, posts_json_callback, ctx) != 0)
         {
-            continue;
+            send_text(ctx->res, 500, "Failed to queue query");
+            return -1;
         }
 
-        cJSON *obj = cJSON_CreateObject();
+        return 0;
+    }
 
-        cJSON_AddStringToObject(obj, "header", PQgetvalue(result, i, PQfnumber(result, "header")));
-        cJSON_AddStringToObject(obj, "slug", PQgetvalue(result, i, PQfnumber(result, "slug")));
-        cJSON_AddStringToObject(obj, "content", PQgetvalue(result, i, PQfnumber(result, "content")));
-        cJSON_AddStringToObject(obj, "username", PQgetvalue(result, i, PQfnumber(result, "username")));
-        cJSON_AddStringToObject(obj, "created_at", PQgetvalue(result, i, PQfnumber(result, "created_at")));
-        cJSON_AddStringToObject(obj, "updated_at", PQgetvalue(result, i, PQfnumber(result, "updated_at")));
+    const char *stmt = ctx->is_author ? "posts_by_author" : "posts_by_author_public";
 
-        cJSON_AddNumberToObject(obj, "reading_time", atoi(PQgetvalue(result, i, PQfnumber(result, "reading_time"))));
-        cJSON_AddNumberToObject(obj, "author_id", atoi(PQgetvalue(result, i, PQfnumber(result, "author_id"))));
+    // Each row is serialized as it arrives, so neither the whole
+    // PGresult nor a cJSON tree of the page is held in memory
+    db_query_single_row(pg, true);
 
-        cJSON_AddBoolToObject(obj, "is_hidden", strcmp(PQgetvalue(result, i, PQfnumber(result, "is_hidden")), "t") == 0);
+    if (db_query_queue_prepared(pg, stmt, 4, params, posts_result_callback, ctx) != 0)
+    {
+        send_text(ctx->res, 500, "Failed to queue query");
+        return -1;
+    }
 
-        char *categories_str = PQgetvalue(result, i, PQfnumber(result, "categories"));
-        char *category_slugs_str = PQgetvalue(result, i, PQfnumber(result, "category_slugs"));
-        char *category_ids_str = PQgetvalue(result, i, PQfnumber(result, "category_ids"));
+    return 0;
+}
 
-        cJSON *categories_array = cJSON_CreateArray();
+static void lookup_columns(ctx_t *ctx, const PGresult *result)
+{
+    ctx->col_id = PQfnumber(result, "id");
+    ctx->col_created_at = PQfnumber(result, "created_at");
+    ctx->col_is_hidden = PQfnumber(result, "is_hidden");
+    ctx->col_rendered = PQfnumber(result, "rendered");
+    ctx->col_categories = PQfnumber(result, "categories");
+}
 
-        if (strlen(categories_str) > 0)
-        {
-            char *categories_copy = strdup(categories_str);
-            char *slugs_copy = strdup(category_slugs_str);
-            char *ids_copy = strdup(category_ids_str);
-
-            char *cat_tok, *slug_tok, *id_tok;
-            char *cat_saveptr, *slug_saveptr, *id_saveptr;
-
-            cat_tok = strtok_r(categories_copy, ",", &cat_saveptr);
-            slug_tok = strtok_r(slugs_copy, ",", &slug_saveptr);
-            id_tok = strtok_r(ids_copy, ",", &id_saveptr);
-
-            while (cat_tok && slug_tok && id_tok)
-            {
-                cJSON *category_obj = cJSON_CreateObject();
-                cJSON_AddNumberToObject(category_obj, "id", atoi(id_tok));
-                cJSON_AddStringToObject(category_obj, "category", cat_tok);
-                cJSON_AddStringToObject(category_obj, "slug", slug_tok);
-                cJSON_AddItemToArray(categories_array, category_obj);
-
-                cat_tok = strtok_r(NULL, ",", &cat_saveptr);
-                slug_tok = strtok_r(NULL, ",", &slug_saveptr);
-                id_tok = strtok_r(NULL, ",", &id_saveptr);
-            }
-
-            free(categories_copy);
-            free(slugs_copy);
-            free(ids_copy);
-        }
+static void on_post_row(ctx_t *ctx, const PGresult *result)
+{
+    if (ctx->rows == 0)
+        lookup_columns(ctx, result);
 
-        cJSON_AddItemToObject(obj, "categories", categories_array);
-        cJSON_AddItemToArray(posts, obj);
+    // One row more than a page was asked for, to know if another follows
+    if (ctx->rows == ctx->limit)
+    {
+        ctx->has_more = true;
+        return;
     }
 
-    cJSON_AddItemToObject(root, "posts", posts);
-    char *out = cJSON_PrintUnformatted(root);
-    send_json(ctx->res, 200, out);
+    ctx->rows++;
+    ctx->last_created_at = db_get_timestamp(result, 0, ctx->col_created_at);
+    ctx->last_id = db_get_int(result, 0, ctx->col_id);
 
-    cJSON_Delete(root);
-    free(out);
+    bool hidden = db_get_bool(result, 0, ctx->col_is_hidden);
+    if (!ctx->is_author && hidden)
+    {
+        return;
+    }
+
+    const char *rendered = PQgetvalue(result, 0, ctx->col_rendered);
+    const char *categories = db_get_json(result, 0, ctx->col_categories);
+
+    if (ctx->format != FORMAT_JSON)
+    {
+        if (!pack_post(&ctx->pack, rendered, categories))
+            ctx->pack.failed = true;
+        ctx->posts++;
+        return;
+    }
+
+    // Spliced from the text rendered at write time, see post_render
+    json_post(&ctx->out, rendered, categories);
+}
+
+static void posts_result_callback(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
+
+    ExecStatusType status = PQresultStatus(result);
+
+    if (status == PGRES_SINGLE_TUPLE)
+    {
+        on_post_row(ctx, result);
+        return;
+    }
+
+    if (status != PGRES_TUPLES_OK)
+    {
+        send_text(ctx->res, 500, "DB select failed");
+        return;
+    }
+
+    send_page(ctx);
+}
+
+static void send_page(ctx_t *ctx)
+{
+    char *next_cursor = NULL;
+    if (ctx->has_more)
+        next_cursor = encode_cursor(ctx->res->arena, ctx->last_created_at, ctx->last_id);
+
+    if (ctx->format != FORMAT_JSON)
+    {
+        pack_close(&ctx->pack, ctx->posts_at, ctx->posts);
+        pack_string(&ctx->pack, "next_cursor");
+        if (next_cursor)
+            pack_string(&ctx->pack, next_cursor);
+        else
+            pack_null(&ctx->pack);
+
+        send_pack_etag(ctx->res, ctx->if_none_match, ctx->encoding, &ctx->pack);
+        return;
+    }
+
+    json_array_end(&ctx->out);
+
+    json_key(&ctx->out, "next_cursor");
+    json_string(&ctx->out, next_cursor);
+    json_object_end(&ctx->out);
+
+    const char *body = json_text(&ctx->out);
+    if (!body)
+        send_text(ctx->res, 500, "Out of memory");
+    else
+        send_json_etag(ctx->res, ctx->if_none_match, ctx->encoding, body);
+}
+
+static void posts_json_callback(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
+    send_json_page(ctx->res, ctx->if_none_match, ctx->encoding, result);
 }
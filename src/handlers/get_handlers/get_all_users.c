@@ -5,14 +5,34 @@
 typedef struct
 {
     Res *res;
+    encoding_t encoding;
+    row_list_t users; // written row by row
 } ctx_t;
 
-static void users_result_callback(PGquery *pg, PGresult *result, void *data);
+const row_field_t user_fields[] = {
+    ROW_FIELD("id", "id", ROW_INT),
+    ROW_FIELD("name", "name", ROW_TEXT),
+    ROW_FIELD("username", "username", ROW_TEXT),
+};
 
-void get_all_users_async(Req *req, Res *res)
+const int user_field_count = ROW_COUNT(user_fields);
+
+static void users_result_callback(db_query_t *pg, PGresult *result, void *data);
+static void users_json_callback(db_query_t *pg, PGresult *result, void *data);
+
+// PG_JSON_ROUTES=users has the server build the array with json_agg
+static bool json_in_db(void)
 {
-    const char *sql = "SELECT id, name, username FROM users;";
+    static int enabled = -1;
+
+    if (enabled < 0)
+        enabled = env_list_has("PG_JSON_ROUTES", "users");
 
+    return enabled;
+}
+
+void get_all_users_async(Req *req, Res *res)
+{
     ctx_t *ctx = arena_alloc(req->arena, sizeof(ctx_t));
     if (!ctx)
     {
@@ -21,32 +41,56 @@ void get_all_users_async(Req *req, Res *res)
     }
 
     ctx->res = res;
+    ctx->encoding = accept_encoding(req);
+    format_t format = accept_format(req);
+    row_list_init(&ctx->users, req->arena, format, user_fields, user_field_count);
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_read_pool(NULL));
     if (!pg)
     {
         send_text(res, 500, "Failed to create async context");
         return;
     }
 
-    if (pg_query_queue(pg, sql, 0, NULL, users_result_callback, ctx) != 0)
+    const char *stmt = "users_all_json";
+    db_callback_t cb = users_json_callback;
+
+    // The server only renders JSON
+    if (format != FORMAT_JSON || !json_in_db())
+    {
+        // Rows are serialized as they arrive instead of after the whole
+        // result, so neither the PGresult nor a tree of every user is
+        // ever held in memory
+        db_query_single_row(pg, true);
+        stmt = "users_all";
+        cb = users_result_callback;
+    }
+
+    if (db_query_queue_prepared(pg, stmt, 0, NULL, cb, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void users_result_callback(PGquery *pg, PGresult *result, void *data)
+static void users_result_callback(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
     ExecStatusType status = PQresultStatus(result);
+
+    if (status == PGRES_SINGLE_TUPLE)
+    {
+        row_list_add(&ctx->users, result, 0);
+        return;
+    }
+
     if (status != PGRES_TUPLES_OK)
     {
         printf("users_result_callback: Query failed: %s\n", PQresultErrorMessage(result));
@@ -54,26 +98,21 @@ static void users_result_callback(PGquery *pg, PGresult *result, void *data)
         return;
     }
 
-    int rows = PQntuples(result);
-    cJSON *json_array = cJSON_CreateArray();
-
-    for (int i = 0; i < rows; i++)
-    {
-        int id = atoi(PQgetvalue(result, i, 0));
-        const char *name = PQgetvalue(result, i, 1);
-        const char *username = PQgetvalue(result, i, 2);
+    row_list_send(&ctx->users, ctx->res, ctx->encoding);
+}
 
-        cJSON *user_json = cJSON_CreateObject();
-        cJSON_AddNumberToObject(user_json, "id", id);
-        cJSON_AddStringToObject(user_json, "name", name);
-        cJSON_AddStringToObject(user_json, "username", username);
+static void users_json_callback(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
 
-        cJSON_AddItemToArray(json_array, user_json);
+    if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+    {
+        printf("users_json_callback: Query failed: %s\n", PQresultErrorMessage(result));
+        send_text(ctx->res, 500, "DB select failed");
+        return;
     }
 
-    char *json_string = cJSON_PrintUnformatted(json_array);
-    send_json(ctx->res, 200, json_string);
-
-    cJSON_Delete(json_array);
-    free(json_string);
+    // The array is the response as the server built it
+    send_compressed(ctx->res, ctx->encoding, "application/json",
+                    PQgetvalue(result, 0, 0), (size_t)PQgetlength(result, 0, 0));
 }
@@ -9,9 +9,13 @@ typedef struct
     const char *username;
     const char *post_slug;
     bool is_author;
+    char *cache_key;
+    char *if_none_match;
+    encoding_t encoding;
 } ctx_t;
 
-static void on_query_posts(PGquery *pg, PGresult *result, void *data);
+static int query_post(db_query_t *pg, const char *author_id, void *data);
+static void on_query_posts(db_query_t *pg, PGresult *result, void *data);
 
 void get_post(Req *req, Res *res)
 {
@@ -36,6 +40,23 @@ void get_post(Req *req, Res *res)
         return;
     }
 
+    char *cache_key = post_cache_key(res->arena, auth_ctx->user_slug, post_slug, auth_ctx->is_author);
+
+    encoding_t encoding = accept_encoding(req);
+
+    encoded_body_t cached;
+    if (post_cache_get(cache_key, encoding, &cached))
+    {
+        send_encoded_etag(res, if_none_match(req), &cached);
+        return;
+    }
+
+    if (is_missing(cache_key))
+    {
+        send_text(res, NOT_FOUND, "Post not found");
+        return;
+    }
+
     ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
     if (!ctx)
     {
@@ -47,175 +68,101 @@ void get_post(Req *req, Res *res)
     ctx->username = auth_ctx->user_slug;
     ctx->post_slug = post_slug;
     ctx->is_author = auth_ctx->is_author;
+    ctx->cache_key = cache_key;
+    ctx->if_none_match = if_none_match(req);
+    ctx->encoding = encoding;
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_read_pool(auth_ctx->id));
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *select_sql;
-    
-    if (ctx->is_author)
-    {
-        select_sql = "SELECT p.id, p.header, p.slug, p.content, p.reading_time, "
-                     "       p.author_id, u.username, p.created_at, p.updated_at, p.is_hidden, "
-                     "       COALESCE(string_agg(c.category, ','), '') as categories, "
-                     "       COALESCE(string_agg(c.slug, ','), '') as category_slugs, "
-                     "       COALESCE(string_agg(c.id::text, ','), '') as category_ids "
-                     "FROM posts p "
-                     "JOIN users u ON p.author_id = u.id "
-                     "LEFT JOIN post_categories pc ON p.id = pc.post_id "
-                     "LEFT JOIN categories c ON pc.category_id = c.id "
-                     "WHERE u.username = $1 AND p.slug = $2 "
-                     "GROUP BY p.id, u.username";
-    }
-    else
-    {
-        select_sql = "SELECT p.id, p.header, p.slug, p.content, p.reading_time, "
-                     "       p.author_id, u.username, p.created_at, p.updated_at, p.is_hidden, "
-                     "       COALESCE(string_agg(c.category, ','), '') as categories, "
-                     "       COALESCE(string_agg(c.slug, ','), '') as category_slugs, "
-                     "       COALESCE(string_agg(c.id::text, ','), '') as category_ids "
-                     "FROM posts p "
-                     "JOIN users u ON p.author_id = u.id "
-                     "LEFT JOIN post_categories pc ON p.id = pc.post_id "
-                     "LEFT JOIN categories c ON pc.category_id = c.id "
-                     "WHERE u.username = $1 AND p.slug = $2 AND p.is_hidden = FALSE "
-                     "GROUP BY p.id, u.username";
-    }
+    // Numbers, flags and timestamps come back binary, see decode.h
+    db_query_binary(pg, true);
 
-    const char *params[] = {ctx->username, ctx->post_slug};
-    
-    if (pg_query_queue(pg, select_sql, 2, params, on_query_posts, ctx) != 0)
-    {
-        send_text(res, 500, "Failed to queue query");
+    if (resolve_author(pg, res, ctx->username, query_post, ctx) != 0)
         return;
-    }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void on_query_posts(PGquery *pg, PGresult *result, void *data)
+static int query_post(db_query_t *pg, const char *author_id, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
-    ExecStatusType status = PQresultStatus(result);
-
-    if (status != PGRES_TUPLES_OK)
+    if (!author_id)
     {
+        remember_missing(ctx->cache_key);
         send_text(ctx->res, NOT_FOUND, "Post not found");
-        return;
+        return -1;
     }
 
-    int ntuples = PQntuples(result);
+    const char *stmt = ctx->is_author ? "post_get" : "post_get_public";
 
-    if (ntuples == 0)
-    {
-        send_text(ctx->res, NOT_FOUND, "Post not found");
-        return;
-    }
+    const char *params[] = {author_id, ctx->post_slug};
 
-    cJSON *response = cJSON_CreateObject();
-    if (!response)
+    if (db_query_queue_prepared(pg, stmt, 2, params, on_query_posts, ctx) != 0)
     {
-        send_text(ctx->res, 500, "JSON could not be created");
-        return;
+        send_text(ctx->res, 500, "Failed to queue query");
+        return -1;
     }
 
-    char *id_val = PQgetvalue(result, 0, PQfnumber(result, "id"));
-    char *reading_time_val = PQgetvalue(result, 0, PQfnumber(result, "reading_time"));
-    char *author_id_val = PQgetvalue(result, 0, PQfnumber(result, "author_id"));
-
-    cJSON_AddNumberToObject(response, "id", atoi(id_val));
-    cJSON_AddNumberToObject(response, "reading_time", atoi(reading_time_val));
-    cJSON_AddNumberToObject(response, "author_id", atoi(author_id_val));
-
-    char *header_val = PQgetvalue(result, 0, PQfnumber(result, "header"));
-    cJSON_AddStringToObject(response, "header", header_val);
-
-    char *slug_val = PQgetvalue(result, 0, PQfnumber(result, "slug"));
-    cJSON_AddStringToObject(response, "slug", slug_val);
+    return 0;
+}
 
-    char *content_val = PQgetvalue(result, 0, PQfnumber(result, "content"));
-    cJSON_AddStringToObject(response, "content", content_val);
+bool render_post(const PGresult *result, json_t *out)
+{
+    // Rendered when the post was written, see post_render
+    json_post(out,
+              PQgetvalue(result, 0, PQfnumber(result, "rendered")),
+              db_get_json(result, 0, PQfnumber(result, "categories")));
 
-    char *username_val = PQgetvalue(result, 0, PQfnumber(result, "username"));
-    cJSON_AddStringToObject(response, "username", username_val);
+    return !out->failed;
+}
 
-    char *created_at_val = PQgetvalue(result, 0, PQfnumber(result, "created_at"));
-    cJSON_AddStringToObject(response, "created_at", created_at_val);
+static void on_query_posts(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
 
-    char *updated_at_val = PQgetvalue(result, 0, PQfnumber(result, "updated_at"));
-    cJSON_AddStringToObject(response, "updated_at", updated_at_val);
+    ExecStatusType status = PQresultStatus(result);
 
-    char *is_hidden_val = PQgetvalue(result, 0, PQfnumber(result, "is_hidden"));
-    bool is_hidden = (strcmp(is_hidden_val, "t") == 0);
-    
-    cJSON_AddBoolToObject(response, "is_hidden", is_hidden);
+    if (status != PGRES_TUPLES_OK)
+    {
+        send_text(ctx->res, NOT_FOUND, "Post not found");
+        return;
+    }
 
-    char *cats = PQgetvalue(result, 0, PQfnumber(result, "categories"));
-    char *slugs = PQgetvalue(result, 0, PQfnumber(result, "category_slugs"));
-    char *ids = PQgetvalue(result, 0, PQfnumber(result, "category_ids"));
+    int ntuples = PQntuples(result);
 
-    cJSON *arr = cJSON_CreateArray();
-    if (!arr)
+    if (ntuples == 0)
     {
-        send_text(ctx->res, 500, "JSON Array could not be created");
-        cJSON_Delete(response);
+        remember_missing(ctx->cache_key);
+        send_text(ctx->res, NOT_FOUND, "Post not found");
         return;
     }
 
-    if (cats && *cats)
+    json_t body;
+    json_init(&body, ctx->res->arena);
+
+    if (!render_post(result, &body))
     {
-        char *c_copy = arena_strdup(ctx->res->arena, cats);
-        char *s_copy = arena_strdup(ctx->res->arena, slugs);
-        char *i_copy = arena_strdup(ctx->res->arena, ids);
-        if (!c_copy || !s_copy || !i_copy)
-        {
-            cJSON_Delete(arr);
-            cJSON_Delete(response);
-            send_text(ctx->res, 500, "Error");
-            return;
-        }
-
-        char *ctok, *stok, *itok;
-        char *save1, *save2, *save3;
-
-        ctok = strtok_r(c_copy, ",", &save1);
-        stok = strtok_r(s_copy, ",", &save2);
-        itok = strtok_r(i_copy, ",", &save3);
-
-        while (ctok && stok && itok)
-        {
-            cJSON *o = cJSON_CreateObject();
-            cJSON_AddNumberToObject(o, "id", atoi(itok));
-            cJSON_AddStringToObject(o, "category", ctok);
-            cJSON_AddStringToObject(o, "slug", stok);
-            cJSON_AddItemToArray(arr, o);
-
-            ctok = strtok_r(NULL, ",", &save1);
-            stok = strtok_r(NULL, ",", &save2);
-            itok = strtok_r(NULL, ",", &save3);
-        }
+        send_text(ctx->res, 500, "Error while building the response");
+        return;
     }
 
-    cJSON_AddItemToObject(response, "categories", arr);
-
-    char *json_str = cJSON_PrintUnformatted(response);
-    if (!json_str)
+    if (!ctx->cache_key)
     {
-        cJSON_Delete(response);
-        send_text(ctx->res, 500, "Error while printing the JSON object");
+        send_json_etag(ctx->res, ctx->if_none_match, ctx->encoding, json_text(&body));
         return;
     }
 
-    send_json(ctx->res, OK, json_str);
-    free(json_str);
-    cJSON_Delete(response);
+    encoded_body_t encoded;
+    post_cache_put(ctx->cache_key, body.data, body.len, ctx->res->arena, ctx->encoding, &encoded);
+    send_encoded_etag(ctx->res, ctx->if_none_match, &encoded);
 }
@@ -6,10 +6,42 @@
 typedef struct
 {
     Res *res;
+    const char *username;
+    const char *category;
     bool is_author;
+    int limit;
+    page_t page;
+    char *if_none_match;
+    encoding_t encoding;
 } ctx_t;
 
-void on_result(PGquery *pg, PGresult *result, void *data);
+static const row_field_t post_fields[] = {
+    ROW_FIELD("header", "header", ROW_TEXT),
+    ROW_FIELD("slug", "slug", ROW_TEXT),
+    ROW_FIELD("created_at", "created_at", ROW_TIMESTAMP),
+    ROW_FIELD("updated_at", "updated_at", ROW_TIMESTAMP),
+    ROW_FIELD("categories", "categories", ROW_TEXT),
+    ROW_FIELD("category_slugs", "category_slugs", ROW_TEXT),
+    ROW_FIELD("category_ids", "category_ids", ROW_TEXT),
+    ROW_FIELD("reading_time", "reading_time", ROW_INT),
+    ROW_FIELD("author_id", "author_id", ROW_INT),
+    ROW_FIELD("is_hidden", "is_hidden", ROW_BOOL),
+};
+
+static int query_posts(db_query_t *pg, const char *author_id, void *data);
+void on_result(db_query_t *pg, PGresult *result, void *data);
+static void on_json_result(db_query_t *pg, PGresult *result, void *data);
+
+// PG_JSON_ROUTES=category_posts has the server render the page
+static bool json_in_db(void)
+{
+    static int enabled = -1;
+
+    if (enabled < 0)
+        enabled = env_list_has("PG_JSON_ROUTES", "category_posts");
+
+    return enabled;
+}
 
 void get_posts_by_cat(Req *req, Res *res)
 {
@@ -30,46 +62,77 @@ void get_posts_by_cat(Req *req, Res *res)
         return;
     }
 
+    if (!parse_page(req, &ctx->page))
+    {
+        send_text(res, BAD_REQUEST, "Invalid limit or cursor");
+        return;
+    }
+
     ctx->res = res;
+    ctx->username = auth_ctx->user_slug;
+    ctx->category = arena_strdup(req->arena, category);
+    ctx->if_none_match = if_none_match(req);
+    ctx->encoding = accept_encoding(req);
     ctx->is_author = auth_ctx->is_author;
+    ctx->limit = ctx->page.limit;
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_read_pool(auth_ctx->id));
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *select_sql =
-        "SELECT p.id, p.header, p.slug, p.reading_time, "
-        "       p.author_id, u.username, p.created_at, p.updated_at, p.is_hidden, "
-        "       COALESCE(string_agg(c.category, ','), '') as categories, "
-        "       COALESCE(string_agg(c.slug, ','), '') as category_slugs, "
-        "       COALESCE(string_agg(c.id::text, ','), '') as category_ids "
-        "FROM posts p "
-        "JOIN users u ON p.author_id = u.id "
-        "JOIN post_categories pc ON p.id = pc.post_id "
-        "JOIN categories c ON pc.category_id = c.id "
-        "WHERE u.username = $1 AND c.slug = $2 "
-        "GROUP BY p.id, u.username "
-        "ORDER BY p.created_at DESC";
-
-    const char *params[] = {auth_ctx->user_slug, category};
-
-    if (pg_query_queue(pg, select_sql, 2, params, on_result, ctx) != 0)
-    {
-        send_text(res, 500, "Failed to queue query");
+    // Numbers, flags and timestamps come back binary, see decode.h
+    db_query_binary(pg, true);
+
+    if (resolve_author(pg, res, ctx->username, query_posts, ctx) != 0)
         return;
-    }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-void on_result(PGquery *pg, PGresult *result, void *data)
+static int query_posts(db_query_t *pg, const char *author_id, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
+
+    if (!author_id)
+    {
+        send_json_etag(ctx->res, ctx->if_none_match, ctx->encoding, "{\"posts\":[],\"next_cursor\":null}");
+        return -1;
+    }
+
+    const char *stmt = ctx->is_author ? "posts_by_category" : "posts_by_category_public";
+    db_callback_t cb = on_result;
+
+    if (json_in_db())
+    {
+        stmt = ctx->is_author ? "posts_by_category_json" : "posts_by_category_public_json";
+        cb = on_json_result;
+    }
+
+    const char *params[] = {
+        author_id,
+        ctx->category,
+        ctx->page.after_created_at,
+        ctx->page.after_id,
+        ctx->page.fetch,
+    };
+
+    if (db_query_queue_prepared(pg, stmt, 5, params, cb, ctx) != 0)
+    {
+        send_text(ctx->res, 500, "Failed to queue query");
+        return -1;
+    }
+
+    return 0;
+}
+
+void on_result(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -79,51 +142,70 @@ void on_result(PGquery *pg, PGresult *result, void *data)
         return;
     }
 
+    // One row more than a page was asked for, to know if another follows
     int rows = PQntuples(result);
+    bool has_more = rows > ctx->limit;
+    if (has_more)
+        rows = ctx->limit;
+
+    row_map_t map;
+    row_map_init(&map, post_fields, ROW_COUNT(post_fields));
 
-    cJSON *root = cJSON_CreateObject();
-    cJSON *posts = cJSON_CreateArray();
+    int col_id = PQfnumber(result, "id");
+    int col_created_at = PQfnumber(result, "created_at");
+    int col_is_hidden = PQfnumber(result, "is_hidden");
 
-    if (rows == 0)
+    if (!row_map_bind(&map, result) || col_id < 0)
     {
-        cJSON_AddItemToObject(root, "posts", posts);
-        char *out = cJSON_PrintUnformatted(root);
-        send_json(ctx->res, 200, out);
-        cJSON_Delete(root);
-        free(out);
+        send_text(ctx->res, 500, "Unexpected result columns");
         return;
     }
 
+    json_t out;
+    json_init(&out, ctx->res->arena);
+
+    json_object_begin(&out);
+    json_key(&out, "posts");
+    json_array_begin(&out);
+
     for (int i = 0; i < rows; i++)
     {
-        bool hidden = (PQgetvalue(result, i, PQfnumber(result, "is_hidden"))[0] == 't');
-
-        if (!ctx->is_author && hidden)
+        if (!ctx->is_author && db_get_bool(result, i, col_is_hidden))
             continue;
 
-        cJSON *obj = cJSON_CreateObject();
+        json_object_begin(&out);
+        row_map_fields(&map, result, i, &out);
+        json_key(&out, "username");
+        json_string(&out, ctx->username);
+        json_object_end(&out);
+    }
 
-        cJSON_AddStringToObject(obj, "header", PQgetvalue(result, i, PQfnumber(result, "header")));
-        cJSON_AddStringToObject(obj, "slug", PQgetvalue(result, i, PQfnumber(result, "slug")));
-        cJSON_AddStringToObject(obj, "username", PQgetvalue(result, i, PQfnumber(result, "username")));
-        cJSON_AddStringToObject(obj, "created_at", PQgetvalue(result, i, PQfnumber(result, "created_at")));
-        cJSON_AddStringToObject(obj, "updated_at", PQgetvalue(result, i, PQfnumber(result, "updated_at")));
-        cJSON_AddStringToObject(obj, "categories", PQgetvalue(result, i, PQfnumber(result, "categories")));
-        cJSON_AddStringToObject(obj, "category_slugs", PQgetvalue(result, i, PQfnumber(result, "category_slugs")));
-        cJSON_AddStringToObject(obj, "category_ids", PQgetvalue(result, i, PQfnumber(result, "category_ids")));
+    json_array_end(&out);
 
-        cJSON_AddNumberToObject(obj, "reading_time", atoi(PQgetvalue(result, i, PQfnumber(result, "reading_time"))));
-        cJSON_AddNumberToObject(obj, "author_id", atoi(PQgetvalue(result, i, PQfnumber(result, "author_id"))));
+    char *next_cursor = NULL;
+    if (has_more)
+    {
+        next_cursor = encode_cursor(ctx->res->arena,
+                                    db_get_timestamp(result, rows - 1, col_created_at),
+                                    db_get_int(result, rows - 1, col_id));
+    }
 
-        cJSON_AddBoolToObject(obj, "is_hidden", strcmp(PQgetvalue(result, i, PQfnumber(result, "is_hidden")), "t") == 0);
+    json_key(&out, "next_cursor");
+    json_string(&out, next_cursor);
+    json_object_end(&out);
 
-        cJSON_AddItemToArray(posts, obj);
+    const char *body = json_text(&out);
+    if (!body)
+    {
+        send_text(ctx->res, 500, "Out of memory");
+        return;
     }
 
-    cJSON_AddItemToObject(root, "posts", posts);
-    char *out = cJSON_PrintUnformatted(root);
-    send_json(ctx->res, 200, out);
+    send_json_etag(ctx->res, ctx->if_none_match, ctx->encoding, body);
+}
 
-    cJSON_Delete(root);
-    free(out);
+static void on_json_result(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
+    send_json_page(ctx->res, ctx->if_none_match, ctx->encoding, result);
 }
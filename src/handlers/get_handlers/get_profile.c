@@ -6,14 +6,43 @@ typedef struct
 {
     Res *res;
     bool is_author;
+    char *if_none_match;
+    encoding_t encoding;
+    char *miss_key;
+    char *cache_key;
 } ctx_t;
 
-static void on_result(PGquery *pg, PGresult *result, void *data);
+static const row_field_t profile_fields[] = {
+    ROW_FIELD("id", "id", ROW_INT),
+    ROW_FIELD("name", "name", ROW_TEXT),
+    ROW_FIELD("email", "email", ROW_TEXT),
+    ROW_FIELD("about", "about", ROW_TEXT),
+};
+
+static void on_result(db_query_t *pg, PGresult *result, void *data);
 
 void get_profile(Req *req, Res *res)
 {
     auth_context_t *auth_ctx = (auth_context_t *)get_context(req, "auth_ctx");
 
+    char *miss_key = profile_miss_key(req->arena, auth_ctx->user_slug);
+    if (is_missing(miss_key))
+    {
+        send_text(res, NOT_FOUND, "User not found");
+        return;
+    }
+
+    char *cache_key = profile_cache_key(req->arena, auth_ctx->user_slug, auth_ctx->is_author);
+
+    encoding_t encoding = accept_encoding(req);
+
+    encoded_body_t cached;
+    if (post_cache_get(cache_key, encoding, &cached))
+    {
+        send_encoded_etag(res, if_none_match(req), &cached);
+        return;
+    }
+
     ctx_t *ctx = arena_alloc(req->arena, sizeof(ctx_t));
     if (!ctx)
     {
@@ -22,53 +51,80 @@ void get_profile(Req *req, Res *res)
     }
 
     ctx->res = res;
+    ctx->if_none_match = if_none_match(req);
+    ctx->encoding = encoding;
     ctx->is_author = auth_ctx->is_author;
+    ctx->miss_key = miss_key;
+    ctx->cache_key = cache_key;
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_read_pool(auth_ctx->id));
     if (!pg)
     {
         send_text(res, 500, "Failed to create async context");
         return;
     }
 
-    const char *sql =
-        "SELECT id, name, username, email, about "
-        "FROM users "
-        "WHERE username = $1;";
-
     const char *params[] = {auth_ctx->user_slug};
 
-    if (pg_query_queue(pg, sql, 1, params, on_result, ctx) != 0 ||
-        pg_query_exec(pg) != 0)
+    if (db_query_queue_prepared(pg, "user_profile", 1, params, on_result, ctx) != 0 ||
+        db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to queue or execute query");
         return;
     }
 }
 
-static void on_result(PGquery *pg, PGresult *result, void *data)
+bool render_profile(const PGresult *result, bool is_author, json_t *out)
+{
+    row_map_t map;
+    row_map_init(&map, profile_fields, ROW_COUNT(profile_fields));
+
+    if (!row_map_bind(&map, result))
+        return false;
+
+    json_object_begin(out);
+    row_map_fields(&map, result, 0, out);
+
+    json_key(out, "is_author");
+    json_bool(out, is_author);
+
+    json_object_end(out);
+    return json_text(out) != NULL;
+}
+
+static void on_result(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
-    if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) == 0)
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
     {
         send_text(ctx->res, 500, "No results");
         return;
     }
 
-    cJSON *resp = cJSON_CreateObject();
-
-    cJSON_AddNumberToObject(resp, "id", atoi(PQgetvalue(result, 0, PQfnumber(result, "id"))));
+    if (PQntuples(result) == 0)
+    {
+        remember_missing(ctx->miss_key);
+        send_text(ctx->res, NOT_FOUND, "User not found");
+        return;
+    }
 
-    cJSON_AddStringToObject(resp, "name", PQgetvalue(result, 0, PQfnumber(result, "name")));
-    cJSON_AddStringToObject(resp, "email", PQgetvalue(result, 0, PQfnumber(result, "email")));
-    cJSON_AddStringToObject(resp, "about", PQgetvalue(result, 0, PQfnumber(result, "about")));
+    json_t body;
+    json_init(&body, ctx->res->arena);
 
-    cJSON_AddBoolToObject(resp, "is_author", ctx->is_author);
+    if (!render_profile(result, ctx->is_author, &body))
+    {
+        send_text(ctx->res, 500, "Error while printing the JSON object");
+        return;
+    }
 
-    char *json_str = cJSON_PrintUnformatted(resp);
-    send_json(ctx->res, 200, json_str);
+    if (!ctx->cache_key)
+    {
+        send_json_etag(ctx->res, ctx->if_none_match, ctx->encoding, json_text(&body));
+        return;
+    }
 
-    free(json_str);
-    cJSON_Delete(resp);
+    encoded_body_t encoded;
+    post_cache_put(ctx->cache_key, body.data, body.len, ctx->res->arena, ctx->encoding, &encoded);
+    send_encoded_etag(ctx->res, ctx->if_none_match, &encoded);
 }
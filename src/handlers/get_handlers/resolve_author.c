@@ -0,0 +1,70 @@
+#include "handlers.h"
+#include <stdio.h>
+
+typedef struct
+{
+    Res *res;
+    const char *username;
+    author_cb cb;
+    void *data;
+} ctx_t;
+
+static void on_user_id(db_query_t *pg, PGresult *result, void *data);
+
+int resolve_author(db_query_t *pg, Res *res, const char *username,
+                   author_cb cb, void *data)
+{
+    char *author_id = cached_user_id(res->arena, username);
+    if (author_id)
+        return cb(pg, author_id, data);
+
+    ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
+    if (!ctx)
+    {
+        send_text(res, 500, "Context allocation failed");
+        return -1;
+    }
+
+    ctx->res = res;
+    ctx->username = username;
+    ctx->cb = cb;
+    ctx->data = data;
+
+    const char *params[] = {username};
+
+    if (db_query_queue_prepared(pg, "user_id", 1, params, on_user_id, ctx) != 0)
+    {
+        send_text(res, 500, "Failed to queue query");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void on_user_id(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
+
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
+    {
+        printf("on_user_id: User lookup failed: %s\n", PQresultErrorMessage(result));
+        send_text(ctx->res, 500, "DB select failed");
+        return;
+    }
+
+    if (PQntuples(result) == 0)
+    {
+        ctx->cb(pg, NULL, ctx->data);
+        return;
+    }
+
+    char *author_id = arena_sprintf(ctx->res->arena, "%lld", (long long)db_get_int(result, 0, 0));
+    if (!author_id)
+    {
+        send_text(ctx->res, 500, "Memory allocation failed");
+        return;
+    }
+
+    remember_user_id(ctx->username, author_id);
+    ctx->cb(pg, author_id, ctx->data);
+}
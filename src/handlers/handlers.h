@@ -3,12 +3,39 @@
 
 #include "ecewo.h"
 #include "cJSON.h"
-#include "ecewo-postgres.h"
 #include "db.h" // db_get_pool();
+#include "query.h"
+#include "caches.h"
 #include "utils.h"
+#include "json.h"
+#include "bind.h"
+#include "row_map.h"
+
+// author_id is NULL when there is no such user. cb queues the steps
+// that need it on pg; it returns -1 once it has sent an error.
+typedef int (*author_cb)(db_query_t *pg, const char *author_id, void *data);
+
+// Runs cb right away if the username is cached, otherwise after a
+// lookup step queued on pg. Returns -1 once an error has been sent,
+// in which case pg must not be executed.
+int resolve_author(db_query_t *pg, Res *res, const char *username,
+                   author_cb cb, void *data);
+
+// Row mapping of users_all, shared by both user listings
+extern const row_field_t user_fields[];
+extern const int user_field_count;
+
+// Response bodies shared by the handlers and the startup warm-up
+bool render_post(const PGresult *result, json_t *out);
+bool render_profile(const PGresult *result, bool is_author, json_t *out);
+
+// Renders the responses listed by save_cache_snapshot() into the post
+// cache, at most max of them. Blocking, meant to run before listening.
+void warm_caches(const char *path, int max);
 
 void hello_world(Req *req, Res *res);
 void get_all_users(Req *req, Res *res);
+void get_stats(Req *req, Res *res);
 void get_all_users_async(Req *req, Res *res);
 void add_user(Req *req, Res *res);
 void login(Req *req, Res *res);
@@ -15,30 +15,38 @@ typedef struct
     char *author_id;
 } ctx_t;
 
-static void on_category_insert(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *category;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, category, BIND_STRING, true),
+};
+
+static void on_category_insert(db_query_t *pg, PGresult *result, void *data);
 
 void create_category(Req *req, Res *res)
 {
     auth_context_t *auth_ctx = (auth_context_t *)get_context(req, "auth_ctx");
 
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *jcategory = cJSON_GetObjectItem(json, "category");
-
-    if (!jcategory || !jcategory->valuestring)
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Category field is missing");
         return;
     }
 
     const char *author_id = auth_ctx->id;
-    const char *category = jcategory->valuestring;
+    const char *category = body.category;
 
     char *slug = slugify(category, NULL);
 
@@ -46,7 +54,6 @@ void create_category(Req *req, Res *res)
     if (!ctx)
     {
         free(slug);
-        cJSON_Delete(json);
         send_text(res, 500, "Context allocation failed");
         return;
     }
@@ -57,7 +64,6 @@ void create_category(Req *req, Res *res)
     ctx->author_id = arena_strdup(ctx->res->arena, author_id);
 
     free(slug);
-    cJSON_Delete(json);
 
     if (!ctx->category || !ctx->slug || !ctx->author_id)
     {
@@ -65,36 +71,31 @@ void create_category(Req *req, Res *res)
         return;
     }
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *conditional_insert_sql =
-        "INSERT INTO categories (category, slug, author_id) "
-        "SELECT $1, $2, $3 "
-        "WHERE NOT EXISTS ("
-        "    SELECT 1 FROM categories WHERE slug = $2"
-        ");";
+    db_query_writer(pg, auth_ctx->id);
 
     const char *params[] = {ctx->category, ctx->slug, ctx->author_id};
 
-    if (pg_query_queue(pg, conditional_insert_sql, 3, params, on_category_insert, ctx) != 0)
+    if (db_query_queue_prepared(pg, "category_insert", 3, params, on_category_insert, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void on_category_insert(PGquery *pg, PGresult *result, void *data)
+static void on_category_insert(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
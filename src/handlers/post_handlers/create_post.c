@@ -20,44 +20,54 @@ typedef struct
     bool is_hidden;
     int *category_ids;
     int category_count;
-    char *batch_sql;
+    char *username;
 } ctx_t;
 
-static void on_query_post(PGquery *pg, PGresult *result, void *data);
-static void on_post_created(PGquery *pg, PGresult *result, void *data);
-static void insert_post_result(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *header;
+    char *content;
+    bool is_hidden;
+    int_list_t categories;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, header, BIND_STRING, true),
+    BIND(body_t, content, BIND_STRING, true),
+    BIND(body_t, is_hidden, BIND_BOOL, false),
+    BIND(body_t, categories, BIND_INT_LIST, false),
+};
+
+static void on_post_created(db_query_t *pg, PGresult *result, void *data);
+static void on_post_rendered(db_query_t *pg, PGresult *result, void *data);
 
 void create_post(Req *req, Res *res)
 {
     auth_context_t *auth_ctx = (auth_context_t *)get_context(req, "auth_ctx");
 
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *jheader = cJSON_GetObjectItem(json, "header");
-    const cJSON *jcontent = cJSON_GetObjectItem(json, "content");
-    const cJSON *jis_hidden = cJSON_GetObjectItem(json, "is_hidden");
-
-    if (!jheader || !jcontent || !jheader->valuestring || !jcontent->valuestring)
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Header or content is missing");
         return;
     }
 
     const char *author_id = auth_ctx->id;
-    const char *header = jheader->valuestring;
-    const char *content = jcontent->valuestring;
-    bool is_hidden = jis_hidden ? jis_hidden->valueint : false;
+    const char *header = body.header;
+    const char *content = body.content;
+    bool is_hidden = body.is_hidden;
 
     char *slug = slugify(header, NULL);
     if (!slug)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation error in slugify");
         return;
     }
@@ -68,7 +78,6 @@ void create_post(Req *req, Res *res)
     if (!ctx)
     {
         free(slug);
-        cJSON_Delete(json);
         send_text(res, 500, "Context allocation failed");
         return;
     }
@@ -78,6 +87,7 @@ void create_post(Req *req, Res *res)
     ctx->content = arena_strdup(res->arena, content);
     ctx->slug = arena_strdup(res->arena, slug);
     ctx->author_id = arena_strdup(res->arena, author_id);
+    ctx->username = arena_strdup(res->arena, auth_ctx->username);
     ctx->reading_time = reading_time;
     ctx->created_at = (int)time(NULL);
     ctx->updated_at = ctx->created_at;
@@ -85,96 +95,40 @@ void create_post(Req *req, Res *res)
 
     free(slug);
 
-    if (!ctx->header || !ctx->content || !ctx->slug || !ctx->author_id)
+    if (!ctx->header || !ctx->content || !ctx->slug || !ctx->author_id || !ctx->username)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation failed");
         return;
     }
 
-    ctx->category_ids = NULL;
-    ctx->category_count = 0;
-
-    const cJSON *jcategories = cJSON_GetObjectItem(json, "categories");
-    if (jcategories && cJSON_IsArray(jcategories))
-    {
-        int n = cJSON_GetArraySize(jcategories);
-        if (n > 0)
-        {
-            ctx->category_ids = arena_alloc(res->arena, n * sizeof(int));
-            if (!ctx->category_ids)
-            {
-                cJSON_Delete(json);
-                send_text(res, 500, "Memory allocation failed for categories");
-                return;
-            }
-
-            ctx->category_count = 0;
-            for (int i = 0; i < n; i++)
-            {
-                const cJSON *item = cJSON_GetArrayItem(jcategories, i);
-                if (cJSON_IsNumber(item))
-                {
-                    ctx->category_ids[ctx->category_count] = item->valueint;
-                    ctx->category_count++;
-                }
-            }
-
-            if (ctx->category_count == 0)
-                ctx->category_ids = NULL;
-        }
-    }
-
-    cJSON_Delete(json);
-
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
-    if (!pg)
-    {
-        send_text(res, 500, "Database connection error");
-        return;
-    }
-
-    const char *select_sql = "SELECT 1 FROM posts WHERE slug = $1";
-    const char *params[] = {ctx->slug};
+    ctx->category_ids = body.categories.count ? body.categories.items : NULL;
+    ctx->category_count = body.categories.count;
 
-    if (pg_query_queue(pg, select_sql, 1, params, on_query_post, ctx) != 0)
-    {
-        send_text(res, 500, "Failed to queue query");
-        return;
-    }
+    char *category_ids = int_array_literal(res->arena, ctx->category_ids, ctx->category_count);
+    char *reading_time_str = arena_sprintf(res->arena, "%d", ctx->reading_time);
+    char *created_at_str = arena_sprintf(res->arena, "%d", ctx->created_at);
+    char *updated_at_str = arena_sprintf(res->arena, "%d", ctx->updated_at);
 
-    if (pg_query_exec(pg) != 0)
+    if (!category_ids || !reading_time_str || !created_at_str || !updated_at_str)
     {
-        send_text(res, 500, "Failed to execute query");
+        send_text(res, 500, "Memory allocation failed");
         return;
     }
-}
-
-static void on_query_post(PGquery *pg, PGresult *result, void *data)
-{
-    ctx_t *ctx = (ctx_t *)data;
 
-    ExecStatusType status = PQresultStatus(result);
-
-    if (status != PGRES_TUPLES_OK)
+    db_query_t *pg = db_query_create(db_get_pool());
+    if (!pg)
     {
-        printf("on_query_post: DB check failed: %s\n", PQresultErrorMessage(result));
-        send_text(ctx->res, 500, "Database check failed");
+        send_text(res, 500, "Database connection error");
         return;
     }
 
-    if (PQntuples(result) > 0)
-    {
-        send_text(ctx->res, 409, "This post already exists");
-        return;
-    }
+    db_query_writer(pg, auth_ctx->id);
 
-    char *reading_time_str = arena_sprintf(ctx->res->arena, "%d", ctx->reading_time);
-    char *created_at_str = arena_sprintf(ctx->res->arena, "%d", ctx->created_at);
-    char *updated_at_str = arena_sprintf(ctx->res->arena, "%d", ctx->updated_at);
-    char *is_hidden_str = arena_sprintf(ctx->res->arena, "%s", ctx->is_hidden ? "true" : "false");
+    // Slug check, insert, category links and the rendered JSON in a
+    // single round trip and transaction
+    db_query_pipeline(pg, true);
 
-    const char *insert_params[8] = {
+    const char *insert_params[9] = {
         ctx->header,
         ctx->slug,
         ctx->content,
@@ -182,80 +136,58 @@ static void on_query_post(PGquery *pg, PGresult *result, void *data)
         ctx->author_id,
         created_at_str,
         updated_at_str,
-        is_hidden_str};
-
-    const char *insert_sql =
-        "INSERT INTO posts "
-        "(header, slug, content, reading_time, author_id, created_at, updated_at, is_hidden) "
-        "VALUES ($1, $2, $3, $4, $5, to_timestamp($6), to_timestamp($7), $8) "
-        "RETURNING id;";
+        ctx->is_hidden ? "true" : "false",
+        category_ids};
 
-    if (pg_query_queue(pg, insert_sql, 8, insert_params, on_post_created, ctx) != 0)
-    {
-        send_text(ctx->res, 500, "Failed to queue insert query");
-        return;
-    }
-}
+    const char *render_params[] = {ctx->slug, ctx->author_id, updated_at_str};
 
-static void on_post_created(PGquery *pg, PGresult *result, void *data)
-{
-    ctx_t *ctx = (ctx_t *)data;
-
-    if (!result || PQresultStatus(result) != PGRES_TUPLES_OK)
+    if (db_query_queue_prepared(pg, "post_create", 9, insert_params, on_post_created, ctx) != 0 ||
+        db_query_queue_prepared(pg, "post_render", 3, render_params, on_post_rendered, ctx) != 0)
     {
-        send_text(ctx->res, 500, "DB insert failed");
+        send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    int post_id = atoi(PQgetvalue(result, 0, 0));
-
-    if (ctx->category_count == 0)
+    if (db_query_exec(pg) != 0)
     {
+        send_text(res, 500, "Failed to execute query");
         return;
     }
+}
 
-    size_t sql_len = 256 + (ctx->category_count * 32);
-    ctx->batch_sql = arena_alloc(ctx->res->arena, sql_len);
+static void on_post_created(db_query_t *pg, PGresult *result, void *data)
+{
+    ctx_t *ctx = (ctx_t *)data;
 
-    if (!ctx->batch_sql)
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
     {
-        send_text(ctx->res, 500, "Memory allocation failed");
+        printf("on_post_created: DB insert failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
+        send_text(ctx->res, 500, "DB insert failed");
         return;
     }
 
-    strcpy(ctx->batch_sql, "INSERT INTO post_categories (post_id, category_id) VALUES ");
-
-    for (int i = 0; i < ctx->category_count; i++)
+    // Nothing is returned when the slug was already taken
+    if (PQntuples(result) == 0)
     {
-        if (i > 0)
-        {
-            strcat(ctx->batch_sql, ", ");
-        }
-
-        char *temp_values = arena_sprintf(ctx->res->arena, "(%d, %d)", post_id, ctx->category_ids[i]);
-        strcat(ctx->batch_sql, temp_values);
-    }
-    strcat(ctx->batch_sql, " ON CONFLICT DO NOTHING;");
-
-    if (pg_query_queue(pg, ctx->batch_sql, 0, NULL, insert_post_result, ctx) != 0)
-    {
-        send_text(ctx->res, 500, "Failed to queue batch category insert");
+        db_query_cancel(pg);
+        send_text(ctx->res, 409, "This post already exists");
         return;
     }
 }
 
-static void insert_post_result(PGquery *pg, PGresult *result, void *data)
+static void on_post_rendered(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
-    ExecStatusType status = PQresultStatus(result);
-
-    if (status != PGRES_COMMAND_OK)
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
     {
-        printf("insert_post_result: Batch category insert failed: %s\n", PQresultErrorMessage(result));
-        send_text(ctx->res, 500, "Category insert failed");
+        printf("on_post_rendered: Render failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
+        send_text(ctx->res, 500, "DB insert failed");
         return;
     }
 
+    forget_missing_post(ctx->username, ctx->slug);
     send_text(ctx->res, 201, "Post created successfully");
 }
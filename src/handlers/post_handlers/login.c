@@ -13,7 +13,18 @@ typedef struct
     char *hashed_password;
 } ctx_t;
 
-static void on_user_found(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *username;
+    char *password;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, username, BIND_STRING, true),
+    BIND(body_t, password, BIND_STRING, true),
+};
+
+static void on_user_found(db_query_t *pg, PGresult *result, void *data);
 
 void login(Req *req, Res *res)
 {
@@ -25,19 +36,17 @@ void login(Req *req, Res *res)
         return;
     }
 
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *juser = cJSON_GetObjectItem(json, "username");
-    const cJSON *jpass = cJSON_GetObjectItem(json, "password");
-
-    if (!juser || !jpass || !juser->valuestring || !jpass->valuestring)
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Username or password is missing");
         return;
     }
@@ -45,40 +54,37 @@ void login(Req *req, Res *res)
     ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
     if (!ctx)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Context allocation failed");
         return;
     }
 
     ctx->res = res;
-    ctx->username = arena_strdup(res->arena, juser->valuestring);
-    ctx->password = arena_strdup(res->arena, jpass->valuestring);
-    cJSON_Delete(json);
+    ctx->username = arena_strdup(res->arena, body.username);
+    ctx->password = arena_strdup(res->arena, body.password);
 
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *select_sql = "SELECT id, name, password FROM users WHERE username = $1";
     const char *params[] = {ctx->username};
 
-    if (pg_query_queue(pg, select_sql, 1, params, on_user_found, ctx) != 0)
+    if (db_query_queue_prepared(pg, "user_login", 1, params, on_user_found, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void on_user_found(PGquery *pg, PGresult *result, void *data)
+static void on_user_found(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
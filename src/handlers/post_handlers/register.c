@@ -15,44 +15,52 @@ typedef struct
     char *hashpw;
 } ctx_t;
 
-static void check_user_exists(PGquery *pg, PGresult *result, void *data);
-static void add_user_result(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *name;
+    char *username;
+    char *password;
+    char *email;
+    char *about;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, name, BIND_STRING, true),
+    BIND(body_t, username, BIND_STRING, true),
+    BIND(body_t, password, BIND_STRING, true),
+    BIND(body_t, email, BIND_STRING, true),
+    BIND(body_t, about, BIND_STRING, false),
+};
+
+static void check_user_exists(db_query_t *pg, PGresult *result, void *data);
+static void add_user_result(db_query_t *pg, PGresult *result, void *data);
 
 void add_user(Req *req, Res *res)
 {
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    cJSON *j_name = cJSON_GetObjectItem(json, "name");
-    cJSON *j_username = cJSON_GetObjectItem(json, "username");
-    cJSON *j_password = cJSON_GetObjectItem(json, "password");
-    cJSON *j_email = cJSON_GetObjectItem(json, "email");
-    cJSON *j_about = cJSON_GetObjectItem(json, "about");
-
-    if (!cJSON_IsString(j_name) ||
-        !cJSON_IsString(j_username) ||
-        !cJSON_IsString(j_password) ||
-        !cJSON_IsString(j_email))
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Missing or invalid fields");
         return;
     }
 
-    const char *name = j_name->valuestring;
-    const char *username = j_username->valuestring;
-    const char *password = j_password->valuestring;
-    const char *email = j_email->valuestring;
-    const char *about = cJSON_IsString(j_about) ? j_about->valuestring : "";
+    const char *name = body.name;
+    const char *username = body.username;
+    const char *password = body.password;
+    const char *email = body.email;
+    const char *about = body.about ? body.about : "";
 
     ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
     if (!ctx)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Context allocation failed");
         return;
     }
@@ -66,7 +74,6 @@ void add_user(Req *req, Res *res)
 
     if (!ctx->name || !ctx->username || !ctx->password || !ctx->email || !ctx->about)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation failed");
         return;
     }
@@ -74,7 +81,6 @@ void add_user(Req *req, Res *res)
     ctx->hashpw = arena_alloc(res->arena, crypto_pwhash_STRBYTES);
     if (!ctx->hashpw)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation failed");
         return;
     }
@@ -85,41 +91,35 @@ void add_user(Req *req, Res *res)
             crypto_pwhash_OPSLIMIT_INTERACTIVE,
             crypto_pwhash_MEMLIMIT_INTERACTIVE) != 0)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Password hashing failed");
         return;
     }
 
-    cJSON_Delete(json);
-
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Failed to create async DB context");
         return;
     }
 
-    const char *check_sql =
-        "SELECT COUNT(*) FROM users WHERE username = $1 OR email = $2;";
-
     const char *check_params[2] = {
         ctx->username,
         ctx->email};
 
-    if (pg_query_queue(pg, check_sql, 2, check_params, check_user_exists, ctx) != 0)
+    if (db_query_queue_prepared(pg, "user_exists", 2, check_params, check_user_exists, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue database query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute database query");
         return;
     }
 }
 
-static void check_user_exists(PGquery *pg, PGresult *result, void *data)
+static void check_user_exists(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -141,11 +141,6 @@ static void check_user_exists(PGquery *pg, PGresult *result, void *data)
         return;
     }
 
-    const char *insert_sql =
-        "INSERT INTO users "
-        "(name, username, password, email, about) "
-        "VALUES ($1, $2, $3, $4, $5);";
-
     const char *insert_params[5] = {
         ctx->name,
         ctx->username,
@@ -153,14 +148,14 @@ static void check_user_exists(PGquery *pg, PGresult *result, void *data)
         ctx->email,
         ctx->about};
 
-    if (pg_query_queue(pg, insert_sql, 5, insert_params, add_user_result, ctx) != 0)
+    if (db_query_queue_prepared(pg, "user_insert", 5, insert_params, add_user_result, ctx) != 0)
     {
         send_text(ctx->res, 500, "Failed to queue insert query");
         return;
     }
 }
 
-static void add_user_result(PGquery *pg, PGresult *result, void *data)
+static void add_user_result(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -168,6 +163,10 @@ static void add_user_result(PGquery *pg, PGresult *result, void *data)
 
     if (status == PGRES_COMMAND_OK)
     {
+        forget_missing_user(ctx->username);
+
+        // A name freed by deleting its row by hand gets a new id
+        forget_user_id(ctx->username);
         send_text(ctx->res, 201, "User created!");
     }
     else
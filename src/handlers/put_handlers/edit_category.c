@@ -16,10 +16,19 @@ typedef struct
     char *author_id;
 } ctx_t;
 
-static void on_query_category(PGquery *pg, PGresult *result, void *data);
-static void on_check_new_slug(PGquery *pg, PGresult *result, void *data);
-static void update_category(PGquery *pg, ctx_t *ctx);
-static void on_category_updated(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *category;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, category, BIND_STRING, true),
+};
+
+static void on_query_category(db_query_t *pg, PGresult *result, void *data);
+static void on_check_new_slug(db_query_t *pg, PGresult *result, void *data);
+static void update_category(db_query_t *pg, ctx_t *ctx);
+static void on_category_updated(db_query_t *pg, PGresult *result, void *data);
 
 void edit_category(Req *req, Res *res)
 {
@@ -38,29 +47,27 @@ void edit_category(Req *req, Res *res)
         return;
     }
 
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *jcategory = cJSON_GetObjectItem(json, "category");
-
-    if (!jcategory || !jcategory->valuestring)
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Category field is missing");
         return;
     }
 
     const char *author_id = auth_ctx->id;
-    const char *category = jcategory->valuestring;
+    const char *category = body.category;
 
     char *new_slug = slugify(category, NULL);
     if (!new_slug)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation error in slugify");
         return;
     }
@@ -68,7 +75,6 @@ void edit_category(Req *req, Res *res)
     ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
     if (!ctx)
     {
-        cJSON_Delete(json);
         free(new_slug);
         send_text(res, 500, "Context allocation failed");
         return;
@@ -84,37 +90,35 @@ void edit_category(Req *req, Res *res)
 
     if (!ctx->category || !ctx->author_id)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation failed");
         return;
     }
 
-    cJSON_Delete(json);
-
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *select_sql = "SELECT id, author_id FROM categories WHERE slug = $1";
+    db_query_writer(pg, auth_ctx->id);
+
     const char *params[] = {ctx->original_slug};
 
-    if (pg_query_queue(pg, select_sql, 1, params, on_query_category, ctx) != 0)
+    if (db_query_queue_prepared(pg, "category_owner", 1, params, on_query_category, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void on_query_category(PGquery *pg, PGresult *result, void *data)
+static void on_query_category(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -135,10 +139,9 @@ static void on_query_category(PGquery *pg, PGresult *result, void *data)
 
     if (strcmp(ctx->original_slug, ctx->new_slug) != 0)
     {
-        const char *check_slug_sql = "SELECT 1 FROM categories WHERE slug = $1 AND slug != $2";
         const char *check_params[] = {ctx->new_slug, ctx->original_slug};
 
-        if (pg_query_queue(pg, check_slug_sql, 2, check_params, on_check_new_slug, ctx) != 0)
+        if (db_query_queue_prepared(pg, "category_slug_taken", 2, check_params, on_check_new_slug, ctx) != 0)
         {
             send_text(ctx->res, 500, "Failed to queue slug check query");
             return;
@@ -150,7 +153,7 @@ static void on_query_category(PGquery *pg, PGresult *result, void *data)
     }
 }
 
-static void on_check_new_slug(PGquery *pg, PGresult *result, void *data)
+static void on_check_new_slug(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -172,7 +175,7 @@ static void on_check_new_slug(PGquery *pg, PGresult *result, void *data)
     update_category(pg, ctx);
 }
 
-static void update_category(PGquery *pg, ctx_t *ctx)
+static void update_category(db_query_t *pg, ctx_t *ctx)
 {
     const char *update_params[3] = {
         ctx->category,
@@ -180,21 +183,14 @@ static void update_category(PGquery *pg, ctx_t *ctx)
         ctx->original_slug
     };
 
-    const char *update_sql =
-        "UPDATE categories SET "
-        "category = $1, "
-        "slug = $2 "
-        "WHERE slug = $3 "
-        "RETURNING id;";
-
-    if (pg_query_queue(pg, update_sql, 3, update_params, on_category_updated, ctx) != 0)
+    if (db_query_queue_prepared(pg, "category_update", 3, update_params, on_category_updated, ctx) != 0)
     {
         send_text(ctx->res, 500, "Failed to queue update query");
         return;
     }
 }
 
-static void on_category_updated(PGquery *pg, PGresult *result, void *data)
+static void on_category_updated(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -213,5 +209,11 @@ static void on_category_updated(PGquery *pg, PGresult *result, void *data)
         return;
     }
 
+    // Every author whose posts list the category, not only this one
+    for (int i = 0; i < PQntuples(result); i++)
+    {
+        if (!PQgetisnull(result, i, 1))
+            post_cache_invalidate_user(PQgetvalue(result, i, 1));
+    }
     send_text(ctx->res, 200, "Category updated successfully");
 }
@@ -20,21 +20,30 @@ typedef struct
     bool is_hidden;
     int *category_ids;
     int category_count;
-    char *batch_sql;
-    char **batch_params;
-    char *post_id;
+    char *category_ids_literal;
+    char *username;
 } ctx_t;
 
-static void on_query_post_exists(PGquery *pg, PGresult *result, void *data);
-static void on_check_new_slug(PGquery *pg, PGresult *result, void *data);
-static void update_post(PGquery *pg, ctx_t *ctx);
-static void on_post_updated(PGquery *pg, PGresult *result, void *data);
-static void clear_post_categories(PGquery *pg, ctx_t *ctx, const char *post_id);
-static void update_post_categories(PGquery *pg, ctx_t *ctx, const char *post_id);
-static void on_old_categories_deleted(PGquery *pg, PGresult *result, void *data);
-static void insert_new_categories(PGquery *pg, ctx_t *ctx);
-static void on_categories_cleared(PGquery *pg, PGresult *result, void *data);
-static void on_categories_inserted(PGquery *pg, PGresult *result, void *data);
+typedef struct
+{
+    char *header;
+    char *content;
+    bool is_hidden;
+    int_list_t categories;
+} body_t;
+
+static const bind_field_t body_fields[] = {
+    BIND(body_t, header, BIND_STRING, true),
+    BIND(body_t, content, BIND_STRING, true),
+    BIND(body_t, is_hidden, BIND_BOOL, false),
+    BIND(body_t, categories, BIND_INT_LIST, false),
+};
+
+static void on_query_post_exists(db_query_t *pg, PGresult *result, void *data);
+static void on_check_new_slug(db_query_t *pg, PGresult *result, void *data);
+static void update_post(db_query_t *pg, ctx_t *ctx);
+static void on_post_updated(db_query_t *pg, PGresult *result, void *data);
+static void on_post_rendered(db_query_t *pg, PGresult *result, void *data);
 
 void edit_post(Req *req, Res *res)
 {
@@ -53,32 +62,28 @@ void edit_post(Req *req, Res *res)
         return;
     }
 
-    cJSON *json = cJSON_Parse(req->body);
-    if (!json)
+    body_t body;
+    bind_status_t status = bind_body(req->arena, req->body, body_fields, BIND_COUNT(body_fields), &body);
+
+    if (status == BIND_INVALID)
     {
         send_text(res, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *jheader = cJSON_GetObjectItem(json, "header");
-    const cJSON *jcontent = cJSON_GetObjectItem(json, "content");
-    const cJSON *jis_hidden = cJSON_GetObjectItem(json, "is_hidden");
-
-    if (!jheader || !jcontent || !jheader->valuestring || !jcontent->valuestring)
+    if (status == BIND_MISSING)
     {
-        cJSON_Delete(json);
         send_text(res, 400, "Header or content is missing");
         return;
     }
 
-    const char *header = jheader->valuestring;
-    const char *content = jcontent->valuestring;
-    bool is_hidden = jis_hidden ? jis_hidden->valueint : false;
+    const char *header = body.header;
+    const char *content = body.content;
+    bool is_hidden = body.is_hidden;
 
     char *new_slug = slugify(header, NULL);
     if (!new_slug)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation error in slugify");
         return;
     }
@@ -88,7 +93,6 @@ void edit_post(Req *req, Res *res)
     ctx_t *ctx = arena_alloc(res->arena, sizeof(ctx_t));
     if (!ctx)
     {
-        cJSON_Delete(json);
         free(new_slug);
         send_text(res, 500, "Context allocation failed");
         return;
@@ -100,6 +104,7 @@ void edit_post(Req *req, Res *res)
     ctx->original_slug = arena_strdup(res->arena, slug);
     ctx->new_slug = arena_strdup(res->arena, new_slug);
     ctx->author_id = arena_strdup(res->arena, auth_ctx->id);
+    ctx->username = arena_strdup(res->arena, auth_ctx->username);
     ctx->reading_time = reading_time;
     ctx->updated_at = (int)time(NULL);
     ctx->is_hidden = is_hidden;
@@ -108,70 +113,60 @@ void edit_post(Req *req, Res *res)
 
     if (!ctx->header || !ctx->content || !ctx->original_slug || !ctx->new_slug || !ctx->author_id)
     {
-        cJSON_Delete(json);
         send_text(res, 500, "Memory allocation failed");
         return;
     }
 
-    ctx->category_ids = NULL;
-    ctx->category_count = 0;
+    ctx->category_ids = body.categories.count ? body.categories.items : NULL;
+    ctx->category_count = body.categories.count;
 
-    const cJSON *jcategories = cJSON_GetObjectItem(json, "categories");
-    if (jcategories && cJSON_IsArray(jcategories))
+    ctx->category_ids_literal = int_array_literal(res->arena, ctx->category_ids, ctx->category_count);
+    if (!ctx->category_ids_literal)
     {
-        int n = cJSON_GetArraySize(jcategories);
-        if (n > 0)
-        {
-            ctx->category_ids = arena_alloc(res->arena, n * sizeof(int));
-            if (!ctx->category_ids)
-            {
-                cJSON_Delete(json);
-                send_text(res, 500, "Memory allocation failed for categories");
-                return;
-            }
-
-            ctx->category_count = 0;
-            for (int i = 0; i < n; i++)
-            {
-                const cJSON *item = cJSON_GetArrayItem(jcategories, i);
-                if (cJSON_IsNumber(item))
-                {
-                    ctx->category_ids[ctx->category_count] = item->valueint;
-                    ctx->category_count++;
-                }
-            }
-
-            if (ctx->category_count == 0)
-                ctx->category_ids = NULL;
-        }
+        send_text(res, 500, "Memory allocation failed");
+        return;
     }
 
-    cJSON_Delete(json);
-
-    PGquery *pg = pg_query_create(db_get_pool(), res->arena);
+    db_query_t *pg = db_query_create(db_get_pool());
     if (!pg)
     {
         send_text(res, 500, "Database connection error");
         return;
     }
 
-    const char *select_sql = "SELECT id, author_id FROM posts WHERE slug = $1";
+    db_query_writer(pg, auth_ctx->id);
+
+    // Both checks only read, so they go out together. The write goes in
+    // a second batch once they passed: two round trips instead of five.
+    db_query_pipeline(pg, true);
+
     const char *params[] = {ctx->original_slug};
 
-    if (pg_query_queue(pg, select_sql, 1, params, on_query_post_exists, ctx) != 0)
+    if (db_query_queue_prepared(pg, "post_owner", 1, params, on_query_post_exists, ctx) != 0)
     {
         send_text(res, 500, "Failed to queue query");
         return;
     }
 
-    if (pg_query_exec(pg) != 0)
+    if (strcmp(ctx->original_slug, ctx->new_slug) != 0)
+    {
+        const char *check_params[] = {ctx->new_slug, ctx->original_slug};
+
+        if (db_query_queue_prepared(pg, "post_slug_taken", 2, check_params, on_check_new_slug, ctx) != 0)
+        {
+            send_text(res, 500, "Failed to queue slug check query");
+            return;
+        }
+    }
+
+    if (db_query_exec(pg) != 0)
     {
         send_text(res, 500, "Failed to execute query");
         return;
     }
 }
 
-static void on_query_post_exists(PGquery *pg, PGresult *result, void *data)
+static void on_query_post_exists(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -180,12 +175,14 @@ static void on_query_post_exists(PGquery *pg, PGresult *result, void *data)
     if (status != PGRES_TUPLES_OK)
     {
         printf("on_query_post_exists: DB check failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
         send_text(ctx->res, 500, "Database check failed");
         return;
     }
 
     if (PQntuples(result) == 0)
     {
+        db_query_cancel(pg);
         send_text(ctx->res, 404, "Post not found");
         return;
     }
@@ -193,28 +190,19 @@ static void on_query_post_exists(PGquery *pg, PGresult *result, void *data)
     const char *post_author_id = PQgetvalue(result, 0, 1);
     if (strcmp(post_author_id, ctx->author_id) != 0)
     {
+        db_query_cancel(pg);
         send_text(ctx->res, 403, "You can only edit your own posts");
         return;
     }
 
-    if (strcmp(ctx->original_slug, ctx->new_slug) != 0)
-    {
-        const char *check_slug_sql = "SELECT 1 FROM posts WHERE slug = $1 AND slug != $2";
-        const char *check_params[] = {ctx->new_slug, ctx->original_slug};
-
-        if (pg_query_queue(pg, check_slug_sql, 2, check_params, on_check_new_slug, ctx) != 0)
-        {
-            send_text(ctx->res, 500, "Failed to queue slug check query");
-            return;
-        }
-    }
-    else
+    // Otherwise the slug check result follows in the same batch
+    if (strcmp(ctx->original_slug, ctx->new_slug) == 0)
     {
         update_post(pg, ctx);
     }
 }
 
-static void on_check_new_slug(PGquery *pg, PGresult *result, void *data)
+static void on_check_new_slug(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -223,12 +211,14 @@ static void on_check_new_slug(PGquery *pg, PGresult *result, void *data)
     if (status != PGRES_TUPLES_OK)
     {
         printf("on_check_new_slug: DB check failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
         send_text(ctx->res, 500, "Database check failed");
         return;
     }
 
     if (PQntuples(result) > 0)
     {
+        db_query_cancel(pg);
         send_text(ctx->res, 409, "A post with this title already exists");
         return;
     }
@@ -236,7 +226,7 @@ static void on_check_new_slug(PGquery *pg, PGresult *result, void *data)
     update_post(pg, ctx);
 }
 
-static void update_post(PGquery *pg, ctx_t *ctx)
+static void update_post(db_query_t *pg, ctx_t *ctx)
 {
     char reading_time_str[32], updated_at_str[32];
     char is_hidden_str[8];
@@ -245,35 +235,37 @@ static void update_post(PGquery *pg, ctx_t *ctx)
     snprintf(updated_at_str, sizeof(updated_at_str), "%d", ctx->updated_at);
     snprintf(is_hidden_str, sizeof(is_hidden_str), "%s", ctx->is_hidden ? "true" : "false");
 
-    const char *update_params[7] = {
+    const char *update_params[9] = {
         ctx->header,
         ctx->new_slug,
         ctx->content,
         reading_time_str,
         updated_at_str,
         is_hidden_str,
-        ctx->original_slug
+        ctx->original_slug,
+        ctx->category_ids_literal,
+        ctx->author_id
     };
 
-    const char *update_sql =
-        "UPDATE posts SET "
-        "header = $1, "
-        "slug = $2, "
-        "content = $3, "
-        "reading_time = $4, "
-        "updated_at = to_timestamp($5), "
-        "is_hidden = $6 "
-        "WHERE slug = $7 "
-        "RETURNING id;";
-
-    if (pg_query_queue(pg, update_sql, 7, update_params, on_post_updated, ctx) != 0)
+    // The category links are written with the post, and the render only
+    // touches the row this update left, so nothing else is changed when
+    // the update found no post of this author
+    const char *render_params[3] = {
+        ctx->new_slug,
+        ctx->author_id,
+        updated_at_str
+    };
+
+    if (db_query_queue_prepared(pg, "post_update", 9, update_params, on_post_updated, ctx) != 0 ||
+        db_query_queue_prepared(pg, "post_render", 3, render_params, on_post_rendered, ctx) != 0)
     {
+        db_query_cancel(pg);
         send_text(ctx->res, 500, "Failed to queue update query");
         return;
     }
 }
 
-static void on_post_updated(PGquery *pg, PGresult *result, void *data)
+static void on_post_updated(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
@@ -282,155 +274,39 @@ static void on_post_updated(PGquery *pg, PGresult *result, void *data)
     if (status != PGRES_TUPLES_OK)
     {
         printf("on_post_updated: Update failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
         send_text(ctx->res, 500, "Post update failed");
         return;
     }
 
     if (PQntuples(result) == 0)
     {
+        db_query_cancel(pg);
         send_text(ctx->res, 404, "Post not found or not updated");
         return;
     }
-
-    const char *post_id = PQgetvalue(result, 0, 0);
-
-    if (ctx->category_ids && ctx->category_count > 0)
-    {
-        update_post_categories(pg, ctx, post_id);
-    }
-    else
-    {
-        clear_post_categories(pg, ctx, post_id);
-    }
 }
 
-static void clear_post_categories(PGquery *pg, ctx_t *ctx, const char *post_id)
-{
-    const char *delete_sql = "DELETE FROM post_categories WHERE post_id = $1";
-    const char *delete_params[] = {post_id};
-
-    if (pg_query_queue(pg, delete_sql, 1, delete_params, on_categories_cleared, ctx) != 0)
-    {
-        send_text(ctx->res, 500, "Failed to queue category deletion");
-        return;
-    }
-}
-
-static void update_post_categories(PGquery *pg, ctx_t *ctx, const char *post_id)
-{
-    const char *delete_sql = "DELETE FROM post_categories WHERE post_id = $1";
-    const char *delete_params[] = {post_id};
-
-    ctx->post_id = arena_strdup(ctx->res->arena, post_id);
-    if (!ctx->post_id)
-    {
-        send_text(ctx->res, 500, "Memory allocation failed");
-        return;
-    }
-
-    if (pg_query_queue(pg, delete_sql, 1, delete_params, on_old_categories_deleted, ctx) != 0)
-    {
-        send_text(ctx->res, 500, "Failed to queue category deletion");
-        return;
-    }
-}
-
-static void on_old_categories_deleted(PGquery *pg, PGresult *result, void *data)
+static void on_post_rendered(db_query_t *pg, PGresult *result, void *data)
 {
     ctx_t *ctx = (ctx_t *)data;
 
     ExecStatusType status = PQresultStatus(result);
     if (status != PGRES_COMMAND_OK)
     {
-        printf("on_old_categories_deleted: Delete failed: %s\n", PQresultErrorMessage(result));
-        send_text(ctx->res, 500, "Failed to delete old categories");
-        return;
-    }
-
-    insert_new_categories(pg, ctx);
-}
-
-static void insert_new_categories(PGquery *pg, ctx_t *ctx)
-{
-    if (!ctx->category_ids || ctx->category_count == 0)
-    {
-        send_text(ctx->res, 200, "Post updated successfully");
-        return;
-    }
-
-    size_t sql_size = 256 + (ctx->category_count * 32);
-    ctx->batch_sql = arena_alloc(ctx->res->arena, sql_size);
-    if (!ctx->batch_sql)
-    {
-        send_text(ctx->res, 500, "Memory allocation failed");
-        return;
-    }
-
-    strcpy(ctx->batch_sql, "INSERT INTO post_categories (post_id, category_id) VALUES ");
-
-    ctx->batch_params = arena_alloc(ctx->res->arena, ctx->category_count * 2 * sizeof(char *));
-    if (!ctx->batch_params)
-    {
-        send_text(ctx->res, 500, "Memory allocation failed");
-        return;
-    }
-
-    for (int i = 0; i < ctx->category_count; i++)
-    {
-        char *category_str = arena_sprintf(ctx->res->arena, "%d", ctx->category_ids[i]);
-        if (!category_str)
-        {
-            send_text(ctx->res, 500, "Memory allocation failed");
-            return;
-        }
-
-        ctx->batch_params[i * 2] = arena_strdup(ctx->res->arena, ctx->post_id);
-        ctx->batch_params[i * 2 + 1] = category_str;
-
-        if (!ctx->batch_params[i * 2] || !ctx->batch_params[i * 2 + 1])
-        {
-            send_text(ctx->res, 500, "Memory allocation failed");
-            return;
-        }
-
-        if (i > 0)
-            strcat(ctx->batch_sql, ", ");
-
-        char *value_part = arena_sprintf(ctx->res->arena, "($%d, $%d)", i * 2 + 1, i * 2 + 2);
-        if (!value_part)
-        {
-            send_text(ctx->res, 500, "Memory allocation failed");
-            return;
-        }
-        strcat(ctx->batch_sql, value_part);
-    }
-
-    if (pg_query_queue(pg, ctx->batch_sql, ctx->category_count * 2,
-                    (const char **)ctx->batch_params,
-                    on_categories_inserted, ctx) != 0)
-    {
-        send_text(ctx->res, 500, "Failed to queue category insert");
+        printf("on_post_rendered: Render failed: %s\n", PQresultErrorMessage(result));
+        db_query_cancel(pg);
+        send_text(ctx->res, 500, "Post update failed");
         return;
     }
-}
 
-static void on_categories_cleared(PGquery *pg, PGresult *result, void *data)
-{
-    ctx_t *ctx = (ctx_t *)data;
-    send_text(ctx->res, 200, "Post updated successfully");
-}
-
-static void on_categories_inserted(PGquery *pg, PGresult *result, void *data)
-{
-    ctx_t *ctx = (ctx_t *)data;
+    post_cache_invalidate(ctx->username, ctx->original_slug);
+    if (strcmp(ctx->original_slug, ctx->new_slug) != 0)
+        post_cache_invalidate(ctx->username, ctx->new_slug);
 
-    ExecStatusType status = PQresultStatus(result);
-    if (status != PGRES_COMMAND_OK)
-    {
-        printf("on_categories_inserted: Insert failed: %s\n", PQresultErrorMessage(result));
-        send_text(ctx->res, 500, "Failed to insert categories");
-        return;
-    }
+    // Un-hiding makes the public view exist, a rename the new slug
+    forget_missing_post(ctx->username, ctx->original_slug);
+    forget_missing_post(ctx->username, ctx->new_slug);
 
     send_text(ctx->res, 200, "Post updated successfully");
 }
@@ -8,60 +8,152 @@
 
 void hello_world(Req *req, Res *res)
 {
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "message", "Hello World!");
-    char *json_string = cJSON_PrintUnformatted(json);
-    send_json(res, 200, json_string);
-    cJSON_Delete(json);
-    free(json_string);
+    json_t json;
+    json_init(&json, req->arena);
+
+    json_object_begin(&json);
+    json_key(&json, "message");
+    json_string(&json, "Hello World!");
+    json_object_end(&json);
+
+    const char *body = json_text(&json);
+    if (!body)
+    {
+        send_text(res, 500, "Error while building the response");
+        return;
+    }
+
+    send_json(res, 200, body);
+}
+
+static void append_user(const PGresult *row, void *data)
+{
+    row_list_add((row_list_t *)data, row, 0);
 }
 
 void get_all_users(Req *req, Res *res)
 {
-    PGpool *pool = db_get_pool();
+    db_pool_t *pool = db_get_read_pool(NULL);
     if (!pool) {
         send_text(res, 500, "Database pool unavailable");
         return;
     }
     
-    PGconn *conn = pg_pool_borrow(pool);
+    PGconn *conn = db_pool_borrow(pool);
     if (!conn) {
         send_text(res, 500, "Failed to acquire database connection");
         return;
     }
     
-    const char *sql = "SELECT id, name, username FROM users;";
-    PGresult *result = PQexec(conn, sql);
+    // Each row is serialized as it arrives, the whole result is never held
+    row_list_t users;
+    row_list_init(&users, req->arena, accept_format(req), user_fields, user_field_count);
+
+    PGresult *result = db_stream_prepared(conn, "users_all", 0, NULL, append_user, &users);
     
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         fprintf(stderr, "DB select failed: %s", PQerrorMessage(conn));
         PQclear(result);
-        pg_pool_return(pool, conn);
+        db_pool_release(pool, conn);
         send_text(res, 500, "DB select failed");
         return;
     }
     
-    int rows = PQntuples(result);
-    cJSON *json_array = cJSON_CreateArray();
-    
-    for (int i = 0; i < rows; i++) {
-        int id = atoi(PQgetvalue(result, i, 0));
-        const char *name = PQgetvalue(result, i, 1);
-        const char *username = PQgetvalue(result, i, 2);
-        
-        cJSON *user_json = cJSON_CreateObject();
-        cJSON_AddNumberToObject(user_json, "id", id);
-        cJSON_AddStringToObject(user_json, "name", name);
-        cJSON_AddStringToObject(user_json, "username", username);
-        cJSON_AddItemToArray(json_array, user_json);
-    }
-    
     PQclear(result);
-    pg_pool_return(pool, conn);
+    db_pool_release(pool, conn);
     
-    char *json_string = cJSON_PrintUnformatted(json_array);
+    row_list_send(&users, res, accept_encoding(req));
+}
+
+void get_stats(Req *req, Res *res)
+{
+    db_pool_t *pool = db_get_pool();
+    if (!pool) {
+        send_text(res, 500, "Database pool unavailable");
+        return;
+    }
+
+    db_pool_stats_t stats;
+    db_pool_stats(pool, &stats);
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON *pool_json = cJSON_AddObjectToObject(json, "pool");
+
+    cJSON_AddNumberToObject(pool_json, "total", stats.total);
+    cJSON_AddNumberToObject(pool_json, "in_use", stats.in_use);
+    cJSON_AddNumberToObject(pool_json, "idle", stats.idle);
+    cJSON_AddNumberToObject(pool_json, "connecting", stats.connecting);
+    cJSON_AddNumberToObject(pool_json, "waiting", stats.waiting);
+    cJSON_AddNumberToObject(pool_json, "borrows", (double)stats.borrows);
+    cJSON_AddNumberToObject(pool_json, "waits", (double)stats.waits);
+    cJSON_AddNumberToObject(pool_json, "timeouts", (double)stats.timeouts);
+    cJSON_AddNumberToObject(pool_json, "rejected", (double)stats.rejected);
+    cJSON_AddNumberToObject(pool_json, "created", (double)stats.created);
+    cJSON_AddNumberToObject(pool_json, "closed", (double)stats.closed);
+    cJSON_AddNumberToObject(pool_json, "wait_ms_avg",
+                            stats.waits ? (double)stats.wait_ms_total / stats.waits : 0);
+    cJSON_AddNumberToObject(pool_json, "wait_ms_max", (double)stats.wait_ms_max);
+
+    db_replica_stats_t replica;
+    db_replica_stats(&replica);
+
+    cJSON *replica_json = cJSON_AddObjectToObject(json, "replica");
+
+    cJSON_AddBoolToObject(replica_json, "enabled", replica.enabled);
+    cJSON_AddBoolToObject(replica_json, "healthy", replica.healthy);
+    cJSON_AddNumberToObject(replica_json, "lag_ms", replica.lag_ms);
+    cJSON_AddNumberToObject(replica_json, "reads_primary", (double)replica.reads_primary);
+    cJSON_AddNumberToObject(replica_json, "reads_replica", (double)replica.reads_replica);
+    cJSON_AddNumberToObject(replica_json, "total", replica.pool.total);
+    cJSON_AddNumberToObject(replica_json, "in_use", replica.pool.in_use);
+    cJSON_AddNumberToObject(replica_json, "waiting", replica.pool.waiting);
+
+    cache_stats_t cache;
+    cache_stats(post_cache(), &cache);
+
+    cJSON *cache_json = cJSON_AddObjectToObject(json, "post_cache");
+
+    cJSON_AddNumberToObject(cache_json, "hits", (double)cache.hits);
+    cJSON_AddNumberToObject(cache_json, "misses", (double)cache.misses);
+    cJSON_AddNumberToObject(cache_json, "evictions", (double)cache.evictions);
+    cJSON_AddNumberToObject(cache_json, "invalidations", (double)cache.invalidations);
+    cJSON_AddNumberToObject(cache_json, "rejected", (double)cache.rejected);
+    cJSON_AddNumberToObject(cache_json, "entries", (double)cache.entries);
+    cJSON_AddNumberToObject(cache_json, "bytes", (double)cache.bytes);
+    cJSON_AddNumberToObject(cache_json, "max_bytes", (double)cache.max_bytes);
+
+    cache_stats(miss_cache(), &cache);
+
+    cJSON *miss_json = cJSON_AddObjectToObject(json, "miss_cache");
+
+    cJSON_AddNumberToObject(miss_json, "hits", (double)cache.hits);
+    cJSON_AddNumberToObject(miss_json, "misses", (double)cache.misses);
+    cJSON_AddNumberToObject(miss_json, "expired", (double)cache.expired);
+    cJSON_AddNumberToObject(miss_json, "invalidations", (double)cache.invalidations);
+    cJSON_AddNumberToObject(miss_json, "entries", (double)cache.entries);
+
+    cache_stats(user_id_cache(), &cache);
+
+    cJSON *user_id_json = cJSON_AddObjectToObject(json, "user_id_cache");
+
+    cJSON_AddNumberToObject(user_id_json, "hits", (double)cache.hits);
+    cJSON_AddNumberToObject(user_id_json, "misses", (double)cache.misses);
+    cJSON_AddNumberToObject(user_id_json, "evictions", (double)cache.evictions);
+    cJSON_AddNumberToObject(user_id_json, "entries", (double)cache.entries);
+
+    cache_stats(auth_cache(), &cache);
+
+    cJSON *auth_json = cJSON_AddObjectToObject(json, "auth_cache");
+
+    cJSON_AddNumberToObject(auth_json, "hits", (double)cache.hits);
+    cJSON_AddNumberToObject(auth_json, "misses", (double)cache.misses);
+    cJSON_AddNumberToObject(auth_json, "expired", (double)cache.expired);
+    cJSON_AddNumberToObject(auth_json, "invalidations", (double)cache.invalidations);
+    cJSON_AddNumberToObject(auth_json, "entries", (double)cache.entries);
+
+    char *json_string = cJSON_PrintUnformatted(json);
     send_json(res, 200, json_string);
-    cJSON_Delete(json_array);
+    cJSON_Delete(json);
     free(json_string);
 }
 
@@ -82,6 +174,7 @@ void logout(Req *req, Res *res)
             .secure = true,
         };
 
+        forget_auth(sess->id);
         session_destroy(res, sess, &cookie_options);
         send_text(res, 302, "Logged out");
     }
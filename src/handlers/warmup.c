@@ -0,0 +1,174 @@
+#include "handlers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same separator and profile marker as the keys built in caches.c
+#define KEY_SEP '\x1f'
+#define PROFILE_SLUG "@"
+
+// Longest snapshot line taken, longer ones are skipped
+#define LINE_MAX_LEN 1024
+
+static const char *author_id(PGconn *conn, const char *username, char *buf, size_t size)
+{
+    const char *cached = cache_get(user_id_cache(), username, NULL);
+    if (cached)
+    {
+        snprintf(buf, size, "%s", cached);
+        return buf;
+    }
+
+    const char *params[] = {username};
+    PGresult *result = db_exec_prepared(conn, "user_id", 1, params);
+
+    const char *id = NULL;
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1)
+    {
+        snprintf(buf, size, "%s", PQgetvalue(result, 0, 0));
+        remember_user_id(username, buf);
+        id = buf;
+    }
+
+    PQclear(result);
+    return id;
+}
+
+static bool warm_post(PGconn *conn, const char *key, const char *username,
+                      const char *slug, bool is_author)
+{
+    char id[24];
+    if (!author_id(conn, username, id, sizeof(id)))
+        return false;
+
+    const char *params[] = {id, slug};
+    PGresult *result = db_exec_prepared(conn, is_author ? "post_get" : "post_get_public",
+                                        2, params);
+
+    bool ok = false;
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1)
+    {
+        json_t body;
+        json_init(&body, NULL);
+        if (render_post(result, &body))
+        {
+            post_cache_put(key, body.data, body.len, NULL, ENCODING_IDENTITY, NULL);
+            ok = true;
+        }
+        json_free(&body);
+    }
+
+    PQclear(result);
+    return ok;
+}
+
+static bool warm_profile(PGconn *conn, const char *key, const char *username, bool is_author)
+{
+    const char *params[] = {username};
+    PGresult *result = db_exec_prepared(conn, "user_profile", 1, params);
+
+    bool ok = false;
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1)
+    {
+        json_t body;
+        json_init(&body, NULL);
+        if (render_profile(result, is_author, &body))
+        {
+            post_cache_put(key, body.data, body.len, NULL, ENCODING_IDENTITY, NULL);
+            ok = true;
+        }
+        json_free(&body);
+    }
+
+    PQclear(result);
+    return ok;
+}
+
+// Keys are "username\x1fslug\x1fview", split in place
+static bool warm_key(PGconn *conn, char *line)
+{
+    char *key = strdup(line);
+    if (!key)
+        return false;
+
+    char *username = line;
+    char *slug = strchr(username, KEY_SEP);
+    char *view = slug ? strchr(slug + 1, KEY_SEP) : NULL;
+
+    bool ok = false;
+    if (view && (view[1] == 'a' || view[1] == 'p') && view[2] == '\0')
+    {
+        *slug++ = '\0';
+        *view++ = '\0';
+        bool is_author = *view == 'a';
+
+        ok = strcmp(slug, PROFILE_SLUG) == 0
+                 ? warm_profile(conn, key, username, is_author)
+                 : warm_post(conn, key, username, slug, is_author);
+    }
+
+    free(key);
+    return ok;
+}
+
+// Whole lines only, the rest of an overlong one is dropped
+static char *read_line(FILE *file)
+{
+    char line[LINE_MAX_LEN];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        size_t len = strcspn(line, "\n");
+        if (line[len] == '\n' || feof(file))
+        {
+            line[len] = '\0';
+            return strdup(line);
+        }
+
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n')
+            ;
+    }
+
+    return NULL;
+}
+
+void warm_caches(const char *path, int max)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        printf("[Cache] No snapshot at %s, starting cold\n", path);
+        return;
+    }
+
+    char **keys = calloc(max, sizeof(char *));
+    int count = 0;
+
+    while (keys && count < max && (keys[count] = read_line(file)))
+        count++;
+
+    fclose(file);
+
+    db_pool_t *pool = db_get_read_pool(NULL);
+    PGconn *conn = db_pool_borrow(pool);
+    if (!conn)
+        fprintf(stderr, "[Cache] No connection for the warm-up\n");
+
+    // The snapshot lists the most recently used first. Putting it last
+    // leaves the LRU order as it was before the restart.
+    int warmed = 0;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (conn && warm_key(conn, keys[i]))
+            warmed++;
+        free(keys[i]);
+    }
+
+    free(keys);
+
+    if (conn)
+        db_pool_release(pool, conn);
+
+    printf("[Cache] Warmed %d of %d responses from %s\n", warmed, count, path);
+}
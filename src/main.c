@@ -4,8 +4,11 @@
 #include "sodium.h"
 #include "dotenv.h"
 #include "db.h"
+#include "caches.h"
 #include "routers.h"
 #include "middlewares.h"
+#include "handlers.h"
+#include "utils.h"
 #include <stdio.h>
 
 static const char *allowed_origins[] = {
@@ -24,9 +27,17 @@ static const Cors cors = {
     .max_age = 86400
 };
 
+// Optional, the hot cache keys are kept here between restarts
+static const char *cache_snapshot = NULL;
+static int cache_warm_count = 0;
+
 void destroy_app(void) {
+    if (cache_snapshot)
+        save_cache_snapshot(cache_snapshot, (size_t)cache_warm_count);
+
     cors_cleanup();
     session_cleanup();
+    caches_cleanup();
     db_cleanup();
 }
 
@@ -60,6 +71,18 @@ int main(void) {
         return 1;
     }
 
+    if (caches_init() != 0) {
+        fprintf(stderr, "Cache initialization failed.\n");
+        return 1;
+    }
+
+    const char *snapshot = getenv("CACHE_SNAPSHOT");
+    if (snapshot && *snapshot) {
+        cache_snapshot = snapshot;
+        cache_warm_count = env_int("CACHE_WARM_COUNT", 500);
+        warm_caches(cache_snapshot, cache_warm_count);
+    }
+
     use(is_auth);
     register_routers();
 
@@ -6,6 +6,7 @@
 #include "ecewo-session.h"
 #include "cJSON.h"
 #include "context.h"
+#include "caches.h"
 
 void body_checker(Req *req, Res *res, Next next)
 {
@@ -25,8 +26,91 @@ static bool string_to_bool(const char *str)
     return (strcmp(str, "true") == 0 || strcmp(str, "1") == 0);
 }
 
+// Cached contexts are packed as "id\0name\0username\0" plus one
+// admin flag byte, so a hit is a single copy into the request arena
+
+static bool unpack_auth(Arena *arena, auth_context_t *ctx, const char *packed, size_t len)
+{
+    if (len < 4 || packed[len - 1] > 1)
+        return false;
+
+    char *copy = arena_alloc(arena, len);
+    if (!copy)
+        return false;
+
+    memcpy(copy, packed, len);
+
+    ctx->id = copy;
+    ctx->name = ctx->id + strlen(ctx->id) + 1;
+    ctx->username = ctx->name + strlen(ctx->name) + 1;
+    ctx->is_admin = copy[len - 1] == 1;
+    return ctx->username + strlen(ctx->username) + 2 == copy + len;
+}
+
+static void pack_auth(const char *session_id, const auth_context_t *ctx)
+{
+    size_t id_len = strlen(ctx->id) + 1;
+    size_t name_len = strlen(ctx->name) + 1;
+    size_t username_len = strlen(ctx->username) + 1;
+    size_t len = id_len + name_len + username_len + 1;
+
+    char *packed = malloc(len);
+    if (!packed)
+        return;
+
+    memcpy(packed, ctx->id, id_len);
+    memcpy(packed + id_len, ctx->name, name_len);
+    memcpy(packed + id_len + name_len, ctx->username, username_len);
+    packed[len - 1] = ctx->is_admin ? 1 : 0;
+
+    cache_put(auth_cache(), session_id, packed, len);
+    free(packed);
+}
+
+static bool load_auth(Req *req, Res *res, Session *session, auth_context_t *ctx)
+{
+    char *id = session_value_get(session, "id", req->arena);
+    char *name = session_value_get(session, "name", req->arena);
+    char *username = session_value_get(session, "username", req->arena);
+    char *is_admin_str = session_value_get(session, "is_admin", req->arena);
+
+    if (!id || !name || !username)
+    {
+        free(id);
+        free(name);
+        free(username);
+        free(is_admin_str);
+
+        send_text(res, 500, "Error: Incomplete session data");
+        return false;
+    }
+
+    // Copy to arena BEFORE freeing
+    ctx->id = arena_strdup(req->arena, id);
+    ctx->name = arena_strdup(req->arena, name);
+    ctx->username = arena_strdup(req->arena, username);
+    ctx->is_admin = string_to_bool(is_admin_str);
+
+    // Free malloc'd strings
+    free(id);
+    free(name);
+    free(username);
+    free(is_admin_str);
+
+    if (!ctx->id || !ctx->name || !ctx->username)
+    {
+        send_text(res, 500, "Memory allocation failed");
+        return false;
+    }
+
+    pack_auth(session->id, ctx);
+    return true;
+}
+
 void is_auth(Req *req, Res *res, Next next)
 {
+    // Still the source of truth for whether the session exists and
+    // has not expired, the cache only saves parsing its values
     Session *session = session_get(req);
 
     auth_context_t *ctx = arena_alloc(req->arena, sizeof(auth_context_t));
@@ -36,44 +120,19 @@ void is_auth(Req *req, Res *res, Next next)
         return;
     }
 
+    // Initialize - will be set by is_authors_self
+    ctx->user_slug = NULL;
+    ctx->is_author = false;
+
     if (session)
     {
-        char *id = session_value_get(session, "id", req->arena);
-        char *name = session_value_get(session, "name", req->arena);
-        char *username = session_value_get(session, "username", req->arena);
-        char *is_admin_str = session_value_get(session, "is_admin", req->arena);
+        size_t len = 0;
+        const char *packed = cache_get(auth_cache(), session->id, &len);
 
-        if (!id || !name || !username)
+        if (!packed || !unpack_auth(req->arena, ctx, packed, len))
         {
-            free(id);
-            free(name);
-            free(username);
-            free(is_admin_str);
-
-            send_text(res, 500, "Error: Incomplete session data");
-            return;
-        }
-
-        // Copy to arena BEFORE freeing
-        ctx->id = arena_strdup(req->arena, id);
-        ctx->name = arena_strdup(req->arena, name);
-        ctx->username = arena_strdup(req->arena, username);
-        ctx->is_admin = string_to_bool(is_admin_str);
-
-        // Initialize - will be set by is_authors_self
-        ctx->user_slug = NULL;
-        ctx->is_author = false;
-
-        // Free malloc'd strings
-        free(id);
-        free(name);
-        free(username);
-        free(is_admin_str);
-
-        if (!ctx->id || !ctx->name || !ctx->username)
-        {
-            send_text(res, 500, "Memory allocation failed");
-            return;
+            if (!load_auth(req, res, session, ctx))
+                return;
         }
 
         printf("[is_auth] Session found - username: %s\n", ctx->username);
@@ -84,9 +143,7 @@ void is_auth(Req *req, Res *res, Next next)
         ctx->id = NULL;
         ctx->name = NULL;
         ctx->username = NULL;
-        ctx->user_slug = NULL;
         ctx->is_admin = false;
-        ctx->is_author = false;
     }
 
     set_context(req, "auth_ctx", ctx);
@@ -159,3 +216,17 @@ void auth_only(Req *req, Res *res, Next next)
 
     next(req, res);
 }
+
+// After auth_only, for operational routes like /stats
+void admin_only(Req *req, Res *res, Next next)
+{
+    auth_context_t *ctx = (auth_context_t *)get_context(req, "auth_ctx");
+
+    if (!ctx || !ctx->is_admin)
+    {
+        send_text(res, 403, "Forbidden");
+        return;
+    }
+
+    next(req, res);
+}
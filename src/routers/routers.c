@@ -23,5 +23,6 @@ void register_routers(void)
     get("/logout", logout);
     get("/users", get_all_users);
     get("/users-async", get_all_users_async);
+    get("/stats", auth_only, admin_only, get_stats);
     get("/", hello_world);
 }
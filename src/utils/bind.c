@@ -0,0 +1,495 @@
+#include "bind.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIND_MAX_DEPTH 64
+
+typedef struct
+{
+    Arena *arena;
+    char *p;
+} parser_t;
+
+static void skip_ws(parser_t *ps)
+{
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')
+        ps->p++;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool read_hex4(const char *s, uint32_t *out)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int d = hex_digit(s[i]);
+        if (d < 0)
+            return false;
+        value = (value << 4) | (uint32_t)d;
+    }
+
+    *out = value;
+    return true;
+}
+
+static char *put_utf8(char *w, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        *w++ = (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        *w++ = (char)(0xc0 | (cp >> 6));
+        *w++ = (char)(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        *w++ = (char)(0xe0 | (cp >> 12));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *w++ = (char)(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        *w++ = (char)(0xf0 | (cp >> 18));
+        *w++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *w++ = (char)(0x80 | (cp & 0x3f));
+    }
+
+    return w;
+}
+
+// Unescapes in place, the result is never longer than the escaped text.
+// The closing quote is overwritten with the terminator.
+static bool parse_string(parser_t *ps, char **out)
+{
+    if (*ps->p != '"')
+        return false;
+
+    char *start = ++ps->p;
+    char *w = start;
+
+    for (;;)
+    {
+        // Clean runs need no copy until the first escape
+        char *r = ps->p;
+        while (*r != '"' && *r != '\\' && (unsigned char)*r >= 0x20)
+            r++;
+
+        if (w != ps->p)
+            memmove(w, ps->p, (size_t)(r - ps->p));
+        w += r - ps->p;
+        ps->p = r;
+
+        if (*r == '"')
+            break;
+
+        if (*r != '\\')
+            return false; // control character or end of body
+
+        char esc = r[1];
+        ps->p = r + 2;
+
+        switch (esc)
+        {
+        case '"': *w++ = '"'; break;
+        case '\\': *w++ = '\\'; break;
+        case '/': *w++ = '/'; break;
+        case 'b': *w++ = '\b'; break;
+        case 'f': *w++ = '\f'; break;
+        case 'n': *w++ = '\n'; break;
+        case 'r': *w++ = '\r'; break;
+        case 't': *w++ = '\t'; break;
+        case 'u':
+        {
+            uint32_t cp;
+            if (!read_hex4(ps->p, &cp))
+                return false;
+            ps->p += 4;
+
+            if (cp >= 0xdc00 && cp <= 0xdfff)
+                return false;
+
+            if (cp >= 0xd800 && cp <= 0xdbff)
+            {
+                uint32_t low;
+                if (ps->p[0] != '\\' || ps->p[1] != 'u' ||
+                    !read_hex4(ps->p + 2, &low) || low < 0xdc00 || low > 0xdfff)
+                {
+                    return false;
+                }
+                ps->p += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            if (cp == 0)
+                return false; // would cut the string short
+
+            w = put_utf8(w, cp);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    *w = '\0';
+    ps->p++;
+    *out = start;
+    return true;
+}
+
+static bool parse_number(parser_t *ps, double *out)
+{
+    char *p = ps->p;
+
+    if (*p == '-')
+        p++;
+    if (*p < '0' || *p > '9')
+        return false;
+
+    char *end;
+    *out = strtod(ps->p, &end);
+    if (end == ps->p)
+        return false;
+
+    ps->p = end;
+    return true;
+}
+
+static bool parse_literal(parser_t *ps, const char *word)
+{
+    size_t len = strlen(word);
+    if (strncmp(ps->p, word, len) != 0)
+        return false;
+
+    ps->p += len;
+    return true;
+}
+
+static bool skip_value(parser_t *ps, int depth);
+
+static bool skip_container(parser_t *ps, int depth, char close, bool keyed)
+{
+    if (depth >= BIND_MAX_DEPTH)
+        return false;
+
+    ps->p++;
+    skip_ws(ps);
+
+    if (*ps->p == close)
+    {
+        ps->p++;
+        return true;
+    }
+
+    for (;;)
+    {
+        if (keyed)
+        {
+            char *key;
+            if (!parse_string(ps, &key))
+                return false;
+
+            skip_ws(ps);
+            if (*ps->p++ != ':')
+                return false;
+        }
+
+        if (!skip_value(ps, depth + 1))
+            return false;
+
+        skip_ws(ps);
+        if (*ps->p == ',')
+        {
+            ps->p++;
+            skip_ws(ps);
+            continue;
+        }
+
+        if (*ps->p != close)
+            return false;
+
+        ps->p++;
+        return true;
+    }
+}
+
+static bool skip_value(parser_t *ps, int depth)
+{
+    skip_ws(ps);
+
+    char *s;
+    double n;
+
+    switch (*ps->p)
+    {
+    case '"': return parse_string(ps, &s);
+    case '{': return skip_container(ps, depth, '}', true);
+    case '[': return skip_container(ps, depth, ']', false);
+    case 't': return parse_literal(ps, "true");
+    case 'f': return parse_literal(ps, "false");
+    case 'n': return parse_literal(ps, "null");
+    default: return parse_number(ps, &n);
+    }
+}
+
+static int to_int(double n)
+{
+    if (n >= INT32_MAX)
+        return INT32_MAX;
+    if (n <= INT32_MIN)
+        return INT32_MIN;
+    return (int)n;
+}
+
+// Numbers of an array, other elements are skipped
+static bool bind_int_list(parser_t *ps, int_list_t *list)
+{
+    // An upper bound on the elements, so the list is allocated once
+    size_t max = 1;
+    int nesting = 0;
+    bool in_string = false;
+    for (const char *c = ps->p + 1; *c; c++)
+    {
+        if (in_string)
+        {
+            if (*c == '\\' && c[1])
+                c++;
+            else if (*c == '"')
+                in_string = false;
+            continue;
+        }
+
+        if (*c == '"')
+            in_string = true;
+        else if (*c == '[' || *c == '{')
+            nesting++;
+        else if ((*c == ']' || *c == '}') && nesting-- == 0)
+            break;
+        else if (*c == ',' && nesting == 0)
+            max++;
+    }
+
+    list->items = arena_alloc(ps->arena, max * sizeof(int));
+    list->count = 0;
+    if (!list->items)
+        return false;
+
+    ps->p++;
+    skip_ws(ps);
+
+    if (*ps->p == ']')
+    {
+        ps->p++;
+        return true;
+    }
+
+    for (;;)
+    {
+        skip_ws(ps);
+
+        double n;
+        char c = *ps->p;
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            if (!parse_number(ps, &n) || (size_t)list->count == max)
+                return false;
+            list->items[list->count++] = to_int(n);
+        }
+        else if (!skip_value(ps, 1))
+        {
+            return false;
+        }
+
+        skip_ws(ps);
+        if (*ps->p == ',')
+        {
+            ps->p++;
+            continue;
+        }
+
+        if (*ps->p++ != ']')
+            return false;
+
+        return true;
+    }
+}
+
+// Stores the value if it has the field's type, skips it otherwise
+static bool bind_value(parser_t *ps, const bind_field_t *field, void *out, bool *bound)
+{
+    char *dst = (char *)out + field->offset;
+    char c = *ps->p;
+    double n;
+
+    *bound = false;
+
+    switch (field->type)
+    {
+    case BIND_STRING:
+        if (c != '"')
+            break;
+        if (!parse_string(ps, (char **)dst))
+            return false;
+        *bound = true;
+        return true;
+
+    case BIND_BOOL:
+        if (c == 't' || c == 'f')
+        {
+            *(bool *)dst = c == 't';
+            *bound = true;
+            return parse_literal(ps, c == 't' ? "true" : "false");
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            if (!parse_number(ps, &n))
+                return false;
+            *(bool *)dst = to_int(n) != 0;
+            *bound = true;
+            return true;
+        }
+        break;
+
+    case BIND_INT:
+        if (c != '-' && (c < '0' || c > '9'))
+            break;
+        if (!parse_number(ps, &n))
+            return false;
+        *(int *)dst = to_int(n);
+        *bound = true;
+        return true;
+
+    case BIND_INT_LIST:
+        if (c != '[')
+            break;
+        if (!bind_int_list(ps, (int_list_t *)dst))
+            return false;
+        *bound = true;
+        return true;
+    }
+
+    return skip_value(ps, 1);
+}
+
+static void clear_field(const bind_field_t *field, void *out)
+{
+    char *dst = (char *)out + field->offset;
+
+    switch (field->type)
+    {
+    case BIND_STRING: *(char **)dst = NULL; break;
+    case BIND_BOOL: *(bool *)dst = false; break;
+    case BIND_INT: *(int *)dst = 0; break;
+    case BIND_INT_LIST: *(int_list_t *)dst = (int_list_t){0}; break;
+    }
+}
+
+bind_status_t bind_body(Arena *arena, const char *body,
+                        const bind_field_t *fields, int count, void *out)
+{
+    if (count > BIND_MAX_FIELDS)
+        return BIND_INVALID;
+
+    for (int i = 0; i < count; i++)
+        clear_field(&fields[i], out);
+
+    if (!body)
+        return BIND_INVALID;
+
+    size_t len = strlen(body);
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy)
+        return BIND_INVALID;
+    memcpy(copy, body, len + 1);
+
+    parser_t ps = {arena, copy};
+    uint32_t bound = 0;
+
+    skip_ws(&ps);
+    if (*ps.p != '{')
+        return BIND_INVALID;
+
+    ps.p++;
+    skip_ws(&ps);
+
+    if (*ps.p == '}')
+    {
+        ps.p++;
+    }
+    else
+    {
+        for (;;)
+        {
+            char *key;
+            if (!parse_string(&ps, &key))
+                return BIND_INVALID;
+
+            skip_ws(&ps);
+            if (*ps.p++ != ':')
+                return BIND_INVALID;
+            skip_ws(&ps);
+
+            int field = -1;
+            for (int i = 0; i < count; i++)
+            {
+                if (strcmp(key, fields[i].name) == 0)
+                {
+                    field = i;
+                    break;
+                }
+            }
+
+            if (field < 0)
+            {
+                if (!skip_value(&ps, 1))
+                    return BIND_INVALID;
+            }
+            else
+            {
+                bool ok;
+                if (!bind_value(&ps, &fields[field], out, &ok))
+                    return BIND_INVALID;
+                if (ok)
+                    bound |= UINT32_C(1) << field;
+            }
+
+            skip_ws(&ps);
+            if (*ps.p == ',')
+            {
+                ps.p++;
+                skip_ws(&ps);
+                continue;
+            }
+
+            if (*ps.p++ != '}')
+                return BIND_INVALID;
+            break;
+        }
+    }
+
+    skip_ws(&ps);
+    if (*ps.p != '\0')
+        return BIND_INVALID;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (fields[i].required && !(bound & (UINT32_C(1) << i)))
+            return BIND_MISSING;
+    }
+
+    return BIND_OK;
+}
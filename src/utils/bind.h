@@ -0,0 +1,64 @@
+#ifndef BIND_H
+#define BIND_H
+
+#include "ecewo.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Single-pass binding of a JSON object body to a struct. Each route
+// declares the fields it reads; the body is copied to the arena once,
+// strings are unescaped in place and the struct gets pointers into
+// that copy. Keys the route did not declare are checked and skipped.
+//
+//     typedef struct { char *username; char *password; } body_t;
+//
+//     static const bind_field_t fields[] = {
+//         BIND(body_t, username, BIND_STRING, true),
+//         BIND(body_t, password, BIND_STRING, true),
+//     };
+//
+//     body_t body;
+//     bind_body(req->arena, req->body, fields, BIND_COUNT(fields), &body);
+
+typedef enum
+{
+    BIND_STRING,   // char *, NULL when absent or not a string
+    BIND_BOOL,     // bool, from true/false or a number
+    BIND_INT,      // int, from a number
+    BIND_INT_LIST, // int_list_t, the numbers of an array
+} bind_type_t;
+
+typedef struct
+{
+    int *items;
+    int count;
+} int_list_t;
+
+typedef struct
+{
+    const char *name;
+    bind_type_t type;
+    bool required;
+    size_t offset;
+} bind_field_t;
+
+// The JSON key is the member name
+#define BIND(type, member, kind, required) \
+    {#member, kind, required, offsetof(type, member)}
+
+#define BIND_COUNT(fields) ((int)(sizeof(fields) / sizeof((fields)[0])))
+
+// At most this many fields per route
+#define BIND_MAX_FIELDS 32
+
+typedef enum
+{
+    BIND_OK = 0,
+    BIND_INVALID, // not a JSON object, or out of memory
+    BIND_MISSING, // a required field is absent or of another type
+} bind_status_t;
+
+bind_status_t bind_body(Arena *arena, const char *body,
+                        const bind_field_t *fields, int count, void *out);
+
+#endif
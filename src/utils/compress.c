@@ -0,0 +1,238 @@
+#include "compress.h"
+#include "utils.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define COMPRESS_MIN_BYTES_DEFAULT 1024
+#define GZIP_LEVEL_DEFAULT 6
+#define ZSTD_LEVEL_DEFAULT 3
+
+// windowBits for a gzip wrapper instead of a zlib one
+#define GZIP_WINDOW_BITS (15 + 16)
+
+static int level_from_env(const char *name, int fallback, int max)
+{
+    int level = env_int(name, fallback);
+    if (level > max)
+    {
+        fprintf(stderr, "Ignoring invalid %s: %d\n", name, level);
+        return fallback;
+    }
+    return level;
+}
+
+static size_t min_bytes(void)
+{
+    static int value = -1;
+
+    if (value < 0)
+        value = env_int("COMPRESS_MIN_BYTES", COMPRESS_MIN_BYTES_DEFAULT);
+
+    return (size_t)value;
+}
+
+// q of a coding in an Accept-Encoding list, -1 when it is not named
+static double coding_q(const char *list, const char *coding)
+{
+    size_t len = strlen(coding);
+    const char *p = list;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+
+        const char *end = p;
+        while (*end && *end != ',' && *end != ';' && *end != ' ' && *end != '\t')
+            end++;
+
+        bool match = (size_t)(end - p) == len && strncasecmp(p, coding, len) == 0;
+
+        double q = 1.0;
+        const char *next = strchr(end, ',');
+        const char *param = strstr(end, "q=");
+        if (param && (!next || param < next))
+            q = strtod(param + 2, NULL);
+
+        if (match)
+            return q;
+
+        if (!next)
+            break;
+        p = next;
+    }
+
+    return -1.0;
+}
+
+encoding_t accept_encoding(Req *req)
+{
+    const char *list = get_header(req, "Accept-Encoding");
+    if (!list)
+        return ENCODING_IDENTITY;
+
+    double any = coding_q(list, "*");
+    encoding_t best = ENCODING_IDENTITY;
+    double best_q = 0.0;
+
+    // Ties go to the later, better compressing one
+    static const encoding_t order[] = {ENCODING_GZIP, ENCODING_ZSTD};
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+    {
+        if (!encoding_available(order[i]))
+            continue;
+
+        double q = coding_q(list, encoding_name(order[i]));
+        if (q < 0)
+            q = any;
+
+        if (q > 0 && q >= best_q)
+        {
+            best = order[i];
+            best_q = q;
+        }
+    }
+
+    return best;
+}
+
+const char *encoding_name(encoding_t encoding)
+{
+    switch (encoding)
+    {
+    case ENCODING_GZIP: return "gzip";
+    case ENCODING_ZSTD: return "zstd";
+    default: return NULL;
+    }
+}
+
+bool encoding_available(encoding_t encoding)
+{
+#ifdef HAVE_ZSTD
+    return encoding == ENCODING_GZIP || encoding == ENCODING_ZSTD;
+#else
+    return encoding == ENCODING_GZIP;
+#endif
+}
+
+bool worth_compressing(size_t len)
+{
+    return len >= min_bytes();
+}
+
+static char *alloc_out(Arena *arena, size_t size)
+{
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+// One stream, reset between bodies, saves deflate's allocations on
+// every response. Everything runs on the event loop thread.
+static z_stream *gzip_stream(void)
+{
+    static z_stream stream;
+    static int state = 0; // 1 ready, -1 failed to initialize
+
+    if (state == 0)
+    {
+        int level = level_from_env("GZIP_LEVEL", GZIP_LEVEL_DEFAULT, 9);
+        state = deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                             Z_DEFAULT_STRATEGY) == Z_OK
+                    ? 1
+                    : -1;
+    }
+
+    if (state < 0 || deflateReset(&stream) != Z_OK)
+        return NULL;
+
+    return &stream;
+}
+
+static char *gzip(Arena *arena, const void *body, size_t len, size_t *out_len)
+{
+    z_stream *stream = gzip_stream();
+    if (!stream || len > UINT_MAX)
+        return NULL;
+
+    size_t bound = deflateBound(stream, (uLong)len);
+    char *out = alloc_out(arena, bound);
+    if (!out)
+        return NULL;
+
+    stream->next_in = (Bytef *)body;
+    stream->avail_in = (uInt)len;
+    stream->next_out = (Bytef *)out;
+    stream->avail_out = (uInt)bound;
+
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+    {
+        if (!arena)
+            free(out);
+        return NULL;
+    }
+
+    *out_len = stream->total_out;
+    return out;
+}
+
+#ifdef HAVE_ZSTD
+static char *zstd(Arena *arena, const void *body, size_t len, size_t *out_len)
+{
+    static ZSTD_CCtx *cctx = NULL;
+    static int level = 0;
+
+    if (!cctx)
+    {
+        cctx = ZSTD_createCCtx();
+        level = level_from_env("ZSTD_LEVEL", ZSTD_LEVEL_DEFAULT, ZSTD_maxCLevel());
+        if (!cctx)
+            return NULL;
+    }
+
+    size_t bound = ZSTD_compressBound(len);
+    char *out = alloc_out(arena, bound);
+    if (!out)
+        return NULL;
+
+    size_t n = ZSTD_compressCCtx(cctx, out, bound, body, len, level);
+    if (ZSTD_isError(n))
+    {
+        if (!arena)
+            free(out);
+        return NULL;
+    }
+
+    *out_len = n;
+    return out;
+}
+#endif
+
+char *compress_body(Arena *arena, encoding_t encoding,
+                    const void *body, size_t len, size_t *out_len)
+{
+    char *out = NULL;
+
+    if (encoding == ENCODING_GZIP)
+        out = gzip(arena, body, len, out_len);
+#ifdef HAVE_ZSTD
+    else if (encoding == ENCODING_ZSTD)
+        out = zstd(arena, body, len, out_len);
+#endif
+
+    // Already compressed content, nothing gained
+    if (out && *out_len >= len)
+    {
+        if (!arena)
+            free(out);
+        return NULL;
+    }
+
+    return out;
+}
@@ -0,0 +1,48 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "ecewo.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Content-Encoding of responses. gzip comes from zlib; zstd is only
+// built in when libzstd was found (HAVE_ZSTD).
+//
+// Bodies under COMPRESS_MIN_BYTES go out as they are. GZIP_LEVEL and
+// ZSTD_LEVEL trade CPU for size.
+
+typedef enum
+{
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_ZSTD,
+    ENCODING_COUNT,
+} encoding_t;
+
+// The preferred encoding the request's Accept-Encoding allows
+encoding_t accept_encoding(Req *req);
+
+// Content-Encoding value, NULL for identity
+const char *encoding_name(encoding_t encoding);
+
+// Whether the encoding is built in
+bool encoding_available(encoding_t encoding);
+
+bool worth_compressing(size_t len);
+
+// Compressed copy of body in the arena, or the heap without one. NULL
+// on failure, or when it would not come out smaller.
+char *compress_body(Arena *arena, encoding_t encoding,
+                    const void *body, size_t len, size_t *out_len);
+
+// A body and, when there is one, its already compressed form
+typedef struct
+{
+    const char *data;
+    size_t len;
+    encoding_t encoding; // of encoded, ENCODING_IDENTITY if there is none
+    const char *encoded;
+    size_t encoded_len;
+} encoded_body_t;
+
+#endif
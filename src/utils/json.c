@@ -0,0 +1,368 @@
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+#define JSON_INITIAL_CAP 1024
+
+static bool reserve(json_t *json, size_t extra)
+{
+    if (json->failed)
+        return false;
+
+    if (json->len + extra + 1 <= json->cap)
+        return true;
+
+    size_t cap = json->cap ? json->cap : JSON_INITIAL_CAP;
+    while (json->len + extra + 1 > cap)
+        cap *= 2;
+
+    char *data;
+    if (json->arena)
+    {
+        // The arena cannot grow a block in place, the old one stays
+        // behind until the request ends. Doubling bounds that to the
+        // size of the final text.
+        data = arena_alloc(json->arena, cap);
+        if (data && json->len)
+            memcpy(data, json->data, json->len);
+    }
+    else
+    {
+        data = realloc(json->data, cap);
+    }
+
+    if (!data)
+    {
+        json->failed = true;
+        return false;
+    }
+
+    json->data = data;
+    json->cap = cap;
+    return true;
+}
+
+static void append(json_t *json, const char *s, size_t len)
+{
+    if (!reserve(json, len))
+        return;
+
+    memcpy(json->data + json->len, s, len);
+    json->len += len;
+    json->data[json->len] = '\0';
+}
+
+static void append_char(json_t *json, char c)
+{
+    if (!reserve(json, 1))
+        return;
+
+    json->data[json->len++] = c;
+    json->data[json->len] = '\0';
+}
+
+// Comma before every value but the first of its object or array
+static void separate(json_t *json)
+{
+    if (json->after_key)
+    {
+        json->after_key = false;
+        return;
+    }
+
+    if (json->depth == 0)
+        return;
+
+    uint64_t bit = UINT64_C(1) << (json->depth - 1);
+    if (json->has_items & bit)
+        append_char(json, ',');
+    json->has_items |= bit;
+}
+
+static void open_scope(json_t *json, char c)
+{
+    separate(json);
+
+    if (json->depth == JSON_MAX_DEPTH)
+    {
+        json->failed = true;
+        return;
+    }
+
+    append_char(json, c);
+    json->depth++;
+    json->has_items &= ~(UINT64_C(1) << (json->depth - 1));
+}
+
+static void close_scope(json_t *json, char c)
+{
+    if (json->depth == 0)
+    {
+        json->failed = true;
+        return;
+    }
+
+    json->depth--;
+    append_char(json, c);
+}
+
+void json_init(json_t *json, Arena *arena)
+{
+    memset(json, 0, sizeof(*json));
+    json->arena = arena;
+}
+
+void json_free(json_t *json)
+{
+    if (!json->arena)
+        free(json->data);
+
+    json->data = NULL;
+    json->len = json->cap = 0;
+}
+
+void json_object_begin(json_t *json)
+{
+    open_scope(json, '{');
+}
+
+void json_object_end(json_t *json)
+{
+    close_scope(json, '}');
+}
+
+void json_array_begin(json_t *json)
+{
+    open_scope(json, '[');
+}
+
+void json_array_end(json_t *json)
+{
+    close_scope(json, ']');
+}
+
+// Bytes that need an escape: quotes, backslashes and control characters
+static bool needs_escape(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+// Vector scans for the first byte that needs an escape, so the long
+// clean runs of post bodies are checked 16 or 32 bytes at a time. SSE2
+// is part of x86-64, AVX2 is used when the CPU has it.
+
+static size_t clean_prefix_sse2(const char *s, size_t len)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+        // v <= 0x1f unsigned exactly when min(v, 0x1f) == v
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+
+        int mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+
+    while (i < len && !needs_escape((unsigned char)s[i]))
+        i++;
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t clean_prefix_avx2(const char *s, size_t len)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+
+    return i + clean_prefix_sse2(s + i, len - i);
+}
+
+static size_t clean_prefix(const char *s, size_t len)
+{
+    static int has_avx2 = -1;
+
+    if (has_avx2 < 0)
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+
+    return has_avx2 ? clean_prefix_avx2(s, len) : clean_prefix_sse2(s, len);
+}
+
+#else
+
+static size_t clean_prefix(const char *s, size_t len)
+{
+    size_t i = 0;
+    while (i < len && !needs_escape((unsigned char)s[i]))
+        i++;
+
+    return i;
+}
+
+#endif
+
+static void put_escaped(json_t *json, const char *value, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // Room for the common case of nothing to escape
+    if (!reserve(json, len + 2))
+        return;
+
+    append_char(json, '"');
+
+    // Clean runs are copied in one go, only quotes, backslashes and
+    // control characters are written one at a time
+    size_t i = 0;
+    while (i < len)
+    {
+        size_t clean = clean_prefix(value + i, len - i);
+        append(json, value + i, clean);
+        i += clean;
+
+        if (i == len)
+            break;
+
+        unsigned char c = (unsigned char)value[i++];
+
+        char esc[6] = {'\\', 0};
+        size_t esc_len = 2;
+
+        switch (c)
+        {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            esc_len = 6;
+            break;
+        }
+
+        append(json, esc, esc_len);
+    }
+
+    append_char(json, '"');
+}
+
+void json_key(json_t *json, const char *key)
+{
+    separate(json);
+    put_escaped(json, key, strlen(key));
+    append_char(json, ':');
+    json->after_key = true;
+}
+
+void json_key_raw(json_t *json, const char *key, size_t len)
+{
+    separate(json);
+    append(json, key, len);
+    json->after_key = true;
+}
+
+void json_string(json_t *json, const char *value)
+{
+    if (!value)
+    {
+        json_null(json);
+        return;
+    }
+
+    json_string_len(json, value, strlen(value));
+}
+
+void json_string_len(json_t *json, const char *value, size_t len)
+{
+    separate(json);
+    put_escaped(json, value, len);
+}
+
+void json_int(json_t *json, int64_t value)
+{
+    char buf[24];
+    int n = snprintf(buf, sizeof(buf), "%lld", (long long)value);
+
+    separate(json);
+    append(json, buf, (size_t)n);
+}
+
+void json_bool(json_t *json, bool value)
+{
+    separate(json);
+    append(json, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_null(json_t *json)
+{
+    separate(json);
+    append(json, "null", 4);
+}
+
+void json_raw(json_t *json, const char *value, size_t len)
+{
+    separate(json);
+    append(json, value, len);
+}
+
+void json_post(json_t *json, const char *rendered, const char *categories)
+{
+    size_t len = strlen(rendered);
+    if (len < 2 || rendered[len - 1] != '}')
+    {
+        json->failed = true;
+        return;
+    }
+
+    separate(json);
+    append(json, rendered, len - 1);
+    append(json, ", \"categories\" : ", 17);
+    append(json, categories, strlen(categories));
+    append_char(json, '}');
+}
+
+const char *json_text(const json_t *json)
+{
+    if (json->failed || json->depth != 0 || !json->data)
+        return NULL;
+
+    return json->data;
+}
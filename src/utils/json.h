@@ -0,0 +1,60 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "ecewo.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only JSON writer for responses. With an arena the text lives
+// in it and is gone with the request, so a response costs no malloc
+// and nothing has to be freed. Without one (e.g. the startup warm-up)
+// it uses the heap and json_free() releases it.
+//
+// Commas are placed by the writer. After a failed append every call is
+// a no-op, so `failed` (or json_text() returning NULL) is checked once.
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct
+{
+    Arena *arena;
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+    bool after_key;
+    int depth;
+    uint64_t has_items; // one bit per open object or array
+} json_t;
+
+void json_init(json_t *json, Arena *arena);
+void json_free(json_t *json);
+
+void json_object_begin(json_t *json);
+void json_object_end(json_t *json);
+void json_array_begin(json_t *json);
+void json_array_end(json_t *json);
+
+void json_key(json_t *json, const char *key);
+
+// Key already written as JSON text with its colon, like "\"id\":"
+void json_key_raw(json_t *json, const char *key, size_t len);
+
+void json_string(json_t *json, const char *value);
+void json_string_len(json_t *json, const char *value, size_t len);
+void json_int(json_t *json, int64_t value);
+void json_bool(json_t *json, bool value);
+void json_null(json_t *json);
+
+// A value that is already JSON text, copied as it is
+void json_raw(json_t *json, const char *value, size_t len);
+
+// A post as the post_render statement stored it, with its categories
+// (a JSON array) spliced in before the closing brace
+void json_post(json_t *json, const char *rendered, const char *categories);
+
+// NUL-terminated text, NULL if anything failed or nothing was written
+const char *json_text(const json_t *json);
+
+#endif
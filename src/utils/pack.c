@@ -0,0 +1,634 @@
+#include "pack.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_INITIAL_CAP 1024
+#define PACK_MAX_DEPTH 64
+
+// Leading bytes of a container with a 32-bit count
+#define MSGPACK_ARRAY32 0xdd
+#define MSGPACK_MAP32 0xdf
+#define CBOR_ARRAY32 0x9a
+#define CBOR_MAP32 0xba
+
+// CBOR major types
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+static bool accepts(const char *accept, const char *type)
+{
+    size_t len = strlen(type);
+    const char *p = accept;
+
+    while ((p = strstr(p, type)))
+    {
+        // A whole media type, not a prefix of a longer one
+        char next = p[len];
+        if ((p == accept || p[-1] == ',' || p[-1] == ' ') &&
+            (next == '\0' || next == ',' || next == ';' || next == ' '))
+        {
+            return true;
+        }
+        p += len;
+    }
+
+    return false;
+}
+
+format_t accept_format(Req *req)
+{
+    const char *accept = get_header(req, "Accept");
+    if (!accept)
+        return FORMAT_JSON;
+
+    if (accepts(accept, "application/msgpack") || accepts(accept, "application/x-msgpack"))
+        return FORMAT_MSGPACK;
+
+    if (accepts(accept, "application/cbor"))
+        return FORMAT_CBOR;
+
+    return FORMAT_JSON;
+}
+
+const char *format_content_type(format_t format)
+{
+    switch (format)
+    {
+    case FORMAT_MSGPACK: return "application/msgpack";
+    case FORMAT_CBOR: return "application/cbor";
+    default: return "application/json";
+    }
+}
+
+static bool reserve(pack_t *pack, size_t extra)
+{
+    if (pack->failed)
+        return false;
+
+    if (pack->len + extra <= pack->cap)
+        return true;
+
+    size_t cap = pack->cap ? pack->cap : PACK_INITIAL_CAP;
+    while (pack->len + extra > cap)
+        cap *= 2;
+
+    char *data;
+    if (pack->arena)
+    {
+        data = arena_alloc(pack->arena, cap);
+        if (data && pack->len)
+            memcpy(data, pack->data, pack->len);
+    }
+    else
+    {
+        data = realloc(pack->data, cap);
+    }
+
+    if (!data)
+    {
+        pack->failed = true;
+        return false;
+    }
+
+    pack->data = data;
+    pack->cap = cap;
+    return true;
+}
+
+static void append(pack_t *pack, const void *bytes, size_t len)
+{
+    if (!reserve(pack, len))
+        return;
+
+    memcpy(pack->data + pack->len, bytes, len);
+    pack->len += len;
+}
+
+static void append_byte(pack_t *pack, uint8_t byte)
+{
+    append(pack, &byte, 1);
+}
+
+// Big-endian, as both formats store their integers
+static void append_be(pack_t *pack, uint8_t lead, uint64_t value, int bytes)
+{
+    uint8_t buf[9];
+    buf[0] = lead;
+    for (int i = 0; i < bytes; i++)
+        buf[1 + i] = (uint8_t)(value >> (8 * (bytes - 1 - i)));
+
+    append(pack, buf, (size_t)bytes + 1);
+}
+
+static void cbor_head(pack_t *pack, int major, uint64_t value)
+{
+    uint8_t type = (uint8_t)(major << 5);
+
+    if (value < 24)
+        append_byte(pack, type | (uint8_t)value);
+    else if (value <= UINT8_MAX)
+        append_be(pack, type | 24, value, 1);
+    else if (value <= UINT16_MAX)
+        append_be(pack, type | 25, value, 2);
+    else if (value <= UINT32_MAX)
+        append_be(pack, type | 26, value, 4);
+    else
+        append_be(pack, type | 27, value, 8);
+}
+
+void pack_init(pack_t *pack, Arena *arena, format_t format)
+{
+    memset(pack, 0, sizeof(*pack));
+    pack->arena = arena;
+    pack->format = format;
+}
+
+void pack_free(pack_t *pack)
+{
+    if (!pack->arena)
+        free(pack->data);
+
+    pack->data = NULL;
+    pack->len = pack->cap = 0;
+}
+
+void pack_map(pack_t *pack, uint32_t count)
+{
+    if (pack->format == FORMAT_CBOR)
+        cbor_head(pack, CBOR_MAP, count);
+    else if (count < 16)
+        append_byte(pack, 0x80 | (uint8_t)count);
+    else if (count <= UINT16_MAX)
+        append_be(pack, 0xde, count, 2);
+    else
+        append_be(pack, MSGPACK_MAP32, count, 4);
+}
+
+void pack_array(pack_t *pack, uint32_t count)
+{
+    if (pack->format == FORMAT_CBOR)
+        cbor_head(pack, CBOR_ARRAY, count);
+    else if (count < 16)
+        append_byte(pack, 0x90 | (uint8_t)count);
+    else if (count <= UINT16_MAX)
+        append_be(pack, 0xdc, count, 2);
+    else
+        append_be(pack, MSGPACK_ARRAY32, count, 4);
+}
+
+size_t pack_open_map(pack_t *pack)
+{
+    size_t at = pack->len;
+    append_be(pack, pack->format == FORMAT_CBOR ? CBOR_MAP32 : MSGPACK_MAP32, 0, 4);
+    return at;
+}
+
+size_t pack_open_array(pack_t *pack)
+{
+    size_t at = pack->len;
+    append_be(pack, pack->format == FORMAT_CBOR ? CBOR_ARRAY32 : MSGPACK_ARRAY32, 0, 4);
+    return at;
+}
+
+void pack_close(pack_t *pack, size_t at, uint32_t count)
+{
+    if (pack->failed || at + 5 > pack->len)
+        return;
+
+    unsigned char *p = (unsigned char *)pack->data + at + 1;
+    p[0] = (unsigned char)(count >> 24);
+    p[1] = (unsigned char)(count >> 16);
+    p[2] = (unsigned char)(count >> 8);
+    p[3] = (unsigned char)count;
+}
+
+static void string_head(pack_t *pack, size_t len)
+{
+    if (pack->format == FORMAT_CBOR)
+        cbor_head(pack, CBOR_TEXT, len);
+    else if (len < 32)
+        append_byte(pack, 0xa0 | (uint8_t)len);
+    else if (len <= UINT8_MAX)
+        append_be(pack, 0xd9, len, 1);
+    else if (len <= UINT16_MAX)
+        append_be(pack, 0xda, len, 2);
+    else
+        append_be(pack, 0xdb, len, 4);
+}
+
+void pack_string(pack_t *pack, const char *value)
+{
+    if (!value)
+    {
+        pack_null(pack);
+        return;
+    }
+
+    pack_string_len(pack, value, strlen(value));
+}
+
+void pack_string_len(pack_t *pack, const char *value, size_t len)
+{
+    string_head(pack, len);
+    append(pack, value, len);
+}
+
+void pack_int(pack_t *pack, int64_t value)
+{
+    if (pack->format == FORMAT_CBOR)
+    {
+        if (value >= 0)
+            cbor_head(pack, CBOR_UINT, (uint64_t)value);
+        else
+            cbor_head(pack, CBOR_NEGINT, (uint64_t)(-1 - value));
+        return;
+    }
+
+    if (value >= 0 && value < 128)
+        append_byte(pack, (uint8_t)value);
+    else if (value < 0 && value >= -32)
+        append_byte(pack, (uint8_t)(int8_t)value);
+    else if (value >= INT32_MIN && value <= INT32_MAX)
+        append_be(pack, 0xd2, (uint64_t)(uint32_t)(int32_t)value, 4);
+    else
+        append_be(pack, 0xd3, (uint64_t)value, 8);
+}
+
+void pack_double(pack_t *pack, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    append_be(pack, pack->format == FORMAT_CBOR ? 0xfb : 0xcb, bits, 8);
+}
+
+void pack_bool(pack_t *pack, bool value)
+{
+    if (pack->format == FORMAT_CBOR)
+        append_byte(pack, value ? 0xf5 : 0xf4);
+    else
+        append_byte(pack, value ? 0xc3 : 0xc2);
+}
+
+void pack_null(pack_t *pack)
+{
+    append_byte(pack, pack->format == FORMAT_CBOR ? 0xf6 : 0xc0);
+}
+
+// JSON to MessagePack/CBOR. The values come from our own rendering
+// (post_render, category lists), but are still checked as they go.
+
+typedef struct
+{
+    pack_t *pack;
+    const char *p;
+} reader_t;
+
+static void skip_ws(reader_t *r)
+{
+    while (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')
+        r->p++;
+}
+
+static int hex4(const char *s)
+{
+    int value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = s[i];
+        int d = c >= '0' && c <= '9'   ? c - '0'
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                       : -1;
+        if (d < 0)
+            return -1;
+        value = value << 4 | d;
+    }
+    return value;
+}
+
+static size_t utf8_len(uint32_t cp)
+{
+    return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+}
+
+static void put_utf8(pack_t *pack, uint32_t cp)
+{
+    uint8_t buf[4];
+    size_t n = utf8_len(cp);
+
+    if (n == 1)
+    {
+        buf[0] = (uint8_t)cp;
+    }
+    else
+    {
+        for (size_t i = n - 1; i > 0; i--)
+        {
+            buf[i] = (uint8_t)(0x80 | (cp & 0x3f));
+            cp >>= 6;
+        }
+        buf[0] = (uint8_t)((n == 2 ? 0xc0 : n == 3 ? 0xe0 : 0xf0) | cp);
+    }
+
+    append(pack, buf, n);
+}
+
+// One escape at s (after the backslash), its code point and length
+static bool read_escape(const char *s, uint32_t *cp, size_t *used)
+{
+    *used = 1;
+
+    switch (*s)
+    {
+    case '"': *cp = '"'; return true;
+    case '\\': *cp = '\\'; return true;
+    case '/': *cp = '/'; return true;
+    case 'b': *cp = '\b'; return true;
+    case 'f': *cp = '\f'; return true;
+    case 'n': *cp = '\n'; return true;
+    case 'r': *cp = '\r'; return true;
+    case 't': *cp = '\t'; return true;
+    case 'u':
+        break;
+    default:
+        return false;
+    }
+
+    int high = hex4(s + 1);
+    if (high < 0 || (high >= 0xdc00 && high <= 0xdfff))
+        return false;
+
+    *cp = (uint32_t)high;
+    *used = 5;
+
+    if (high >= 0xd800 && high <= 0xdbff)
+    {
+        int low = s[5] == '\\' && s[6] == 'u' ? hex4(s + 7) : -1;
+        if (low < 0xdc00 || low > 0xdfff)
+            return false;
+
+        *cp = 0x10000 + (((uint32_t)high - 0xd800) << 10) + ((uint32_t)low - 0xdc00);
+        *used = 11;
+    }
+
+    return true;
+}
+
+// Strings are measured first, both formats want the length up front
+static bool read_string(reader_t *r)
+{
+    const char *start = ++r->p;
+    size_t len = 0;
+    bool escaped = false;
+
+    const char *s = start;
+    for (; *s != '"'; s++)
+    {
+        if ((unsigned char)*s < 0x20)
+            return false;
+
+        if (*s == '\\')
+        {
+            uint32_t cp;
+            size_t used;
+            if (!read_escape(s + 1, &cp, &used))
+                return false;
+            len += utf8_len(cp);
+            s += used;
+            escaped = true;
+        }
+        else
+        {
+            len++;
+        }
+    }
+
+    string_head(r->pack, len);
+
+    if (!escaped)
+    {
+        append(r->pack, start, len);
+    }
+    else
+    {
+        for (const char *c = start; c < s; c++)
+        {
+            const char *run = c;
+            while (c < s && *c != '\\')
+                c++;
+            append(r->pack, run, (size_t)(c - run));
+
+            if (c == s)
+                break;
+
+            uint32_t cp;
+            size_t used;
+            read_escape(c + 1, &cp, &used);
+            put_utf8(r->pack, cp);
+            c += used;
+        }
+    }
+
+    r->p = s + 1;
+    return true;
+}
+
+static bool read_number(reader_t *r)
+{
+    const char *start = r->p;
+    bool integer = true;
+
+    if (*r->p == '-')
+        r->p++;
+    if (*r->p < '0' || *r->p > '9')
+        return false;
+
+    while ((*r->p >= '0' && *r->p <= '9') || *r->p == '.' || *r->p == 'e' ||
+           *r->p == 'E' || *r->p == '+' || *r->p == '-')
+    {
+        if (*r->p == '.' || *r->p == 'e' || *r->p == 'E')
+            integer = false;
+        r->p++;
+    }
+
+    char *end;
+    if (integer)
+    {
+        long long value = strtoll(start, &end, 10);
+        if (end == r->p)
+        {
+            pack_int(r->pack, value);
+            return true;
+        }
+    }
+
+    double value = strtod(start, &end);
+    if (end != r->p)
+        return false;
+
+    pack_double(r->pack, value);
+    return true;
+}
+
+static bool read_literal(reader_t *r, const char *word)
+{
+    size_t len = strlen(word);
+    if (strncmp(r->p, word, len) != 0)
+        return false;
+
+    r->p += len;
+    return true;
+}
+
+static bool read_value(reader_t *r, int depth);
+
+// Members of an object, up to and including its closing brace.
+// Returns their number, -1 if malformed.
+static int read_members(reader_t *r, int depth)
+{
+    int count = 0;
+
+    skip_ws(r);
+    if (*r->p == '}')
+    {
+        r->p++;
+        return 0;
+    }
+
+    for (;;)
+    {
+        skip_ws(r);
+        if (*r->p != '"' || !read_string(r))
+            return -1;
+
+        skip_ws(r);
+        if (*r->p++ != ':')
+            return -1;
+
+        if (!read_value(r, depth + 1))
+            return -1;
+        count++;
+
+        skip_ws(r);
+        if (*r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+
+        if (*r->p++ != '}')
+            return -1;
+
+        return count;
+    }
+}
+
+static bool read_array(reader_t *r, int depth)
+{
+    size_t at = pack_open_array(r->pack);
+    uint32_t count = 0;
+
+    r->p++;
+    skip_ws(r);
+
+    if (*r->p == ']')
+    {
+        r->p++;
+        pack_close(r->pack, at, 0);
+        return true;
+    }
+
+    for (;;)
+    {
+        if (!read_value(r, depth + 1))
+            return false;
+        count++;
+
+        skip_ws(r);
+        if (*r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+
+        if (*r->p++ != ']')
+            return false;
+
+        pack_close(r->pack, at, count);
+        return true;
+    }
+}
+
+static bool read_value(reader_t *r, int depth)
+{
+    if (depth >= PACK_MAX_DEPTH)
+        return false;
+
+    skip_ws(r);
+
+    switch (*r->p)
+    {
+    case '"':
+        return read_string(r);
+    case '{':
+    {
+        size_t at = pack_open_map(r->pack);
+        r->p++;
+        int count = read_members(r, depth);
+        if (count < 0)
+            return false;
+        pack_close(r->pack, at, (uint32_t)count);
+        return true;
+    }
+    case '[':
+        return read_array(r, depth);
+    case 't':
+        pack_bool(r->pack, true);
+        return read_literal(r, "true");
+    case 'f':
+        pack_bool(r->pack, false);
+        return read_literal(r, "false");
+    case 'n':
+        pack_null(r->pack);
+        return read_literal(r, "null");
+    default:
+        return read_number(r);
+    }
+}
+
+bool pack_json(pack_t *pack, const char *json)
+{
+    reader_t r = {pack, json};
+
+    if (!read_value(&r, 0))
+        return false;
+
+    skip_ws(&r);
+    return *r.p == '\0' && !pack->failed;
+}
+
+bool pack_post(pack_t *pack, const char *rendered, const char *categories)
+{
+    reader_t r = {pack, rendered};
+
+    skip_ws(&r);
+    if (*r.p != '{')
+        return false;
+
+    size_t at = pack_open_map(pack);
+    r.p++;
+
+    int count = read_members(&r, 0);
+    if (count < 0)
+        return false;
+
+    pack_string_len(pack, "categories", 10);
+    if (!pack_json(pack, categories))
+        return false;
+
+    pack_close(pack, at, (uint32_t)count + 1);
+    return !pack->failed;
+}
@@ -0,0 +1,61 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "ecewo.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary response formats for clients that ask for them in Accept.
+// pack_t writes MessagePack or CBOR the way json_t writes JSON: into
+// the request arena, or the heap without one, and `failed` sticks.
+//
+// Both formats put the element count before a map or array. When it
+// is not known up front, pack_open_*() leaves a 32-bit count that
+// pack_close() fills in once the elements are written.
+
+typedef enum
+{
+    FORMAT_JSON,
+    FORMAT_MSGPACK,
+    FORMAT_CBOR,
+} format_t;
+
+// The format named by the request's Accept header, JSON by default
+format_t accept_format(Req *req);
+const char *format_content_type(format_t format);
+
+typedef struct
+{
+    Arena *arena;
+    format_t format; // FORMAT_MSGPACK or FORMAT_CBOR
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} pack_t;
+
+void pack_init(pack_t *pack, Arena *arena, format_t format);
+void pack_free(pack_t *pack);
+
+void pack_map(pack_t *pack, uint32_t count);
+void pack_array(pack_t *pack, uint32_t count);
+
+size_t pack_open_map(pack_t *pack);
+size_t pack_open_array(pack_t *pack);
+void pack_close(pack_t *pack, size_t at, uint32_t count);
+
+void pack_string(pack_t *pack, const char *value);
+void pack_string_len(pack_t *pack, const char *value, size_t len);
+void pack_int(pack_t *pack, int64_t value);
+void pack_double(pack_t *pack, double value);
+void pack_bool(pack_t *pack, bool value);
+void pack_null(pack_t *pack);
+
+// JSON text re-encoded in the pack's format, false if it is malformed
+bool pack_json(pack_t *pack, const char *json);
+
+// Same as json_post(): the rendered post with its categories added
+bool pack_post(pack_t *pack, const char *rendered, const char *categories);
+
+#endif
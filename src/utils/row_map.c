@@ -0,0 +1,166 @@
+#include "row_map.h"
+#include "decode.h"
+#include "utils.h"
+#include <string.h>
+
+void row_map_init(row_map_t *map, const row_field_t *fields, int count)
+{
+    memset(map, 0, sizeof(*map));
+    map->fields = fields;
+    map->count = count < ROW_MAX_FIELDS ? count : ROW_MAX_FIELDS;
+}
+
+bool row_map_bind(row_map_t *map, const PGresult *result)
+{
+    if (map->bound)
+        return true;
+
+    for (int i = 0; i < map->count; i++)
+    {
+        map->cols[i] = PQfnumber(result, map->fields[i].column);
+        if (map->cols[i] < 0)
+            return false;
+    }
+
+    map->bound = true;
+    return true;
+}
+
+void row_map_fields(const row_map_t *map, const PGresult *result, int row, json_t *out)
+{
+    char buf[DB_TIMESTAMP_LEN];
+
+    for (int i = 0; i < map->count; i++)
+    {
+        const row_field_t *field = &map->fields[i];
+        int col = map->cols[i];
+
+        json_key_raw(out, field->key, field->key_len);
+
+        switch (field->type)
+        {
+        case ROW_TEXT:
+            json_string_len(out, PQgetvalue(result, row, col),
+                            (size_t)PQgetlength(result, row, col));
+            break;
+        case ROW_INT:
+            json_int(out, db_get_int(result, row, col));
+            break;
+        case ROW_BOOL:
+            json_bool(out, db_get_bool(result, row, col));
+            break;
+        case ROW_TIMESTAMP:
+            json_string(out, db_get_timestamp_text(result, row, col, buf, sizeof(buf)));
+            break;
+        case ROW_JSON:
+        {
+            const char *value = db_get_json(result, row, col);
+            json_raw(out, value, strlen(value));
+            break;
+        }
+        }
+    }
+}
+
+void row_map_object(const row_map_t *map, const PGresult *result, int row, json_t *out)
+{
+    json_object_begin(out);
+    row_map_fields(map, result, row, out);
+    json_object_end(out);
+}
+
+void row_map_pack(const row_map_t *map, const PGresult *result, int row, pack_t *out)
+{
+    char buf[DB_TIMESTAMP_LEN];
+
+    pack_map(out, (uint32_t)map->count);
+
+    for (int i = 0; i < map->count; i++)
+    {
+        const row_field_t *field = &map->fields[i];
+        int col = map->cols[i];
+
+        pack_string(out, field->name);
+
+        switch (field->type)
+        {
+        case ROW_TEXT:
+            pack_string_len(out, PQgetvalue(result, row, col),
+                            (size_t)PQgetlength(result, row, col));
+            break;
+        case ROW_INT:
+            pack_int(out, db_get_int(result, row, col));
+            break;
+        case ROW_BOOL:
+            pack_bool(out, db_get_bool(result, row, col));
+            break;
+        case ROW_TIMESTAMP:
+            pack_string(out, db_get_timestamp_text(result, row, col, buf, sizeof(buf)));
+            break;
+        case ROW_JSON:
+            if (!pack_json(out, db_get_json(result, row, col)))
+                out->failed = true;
+            break;
+        }
+    }
+}
+
+void row_list_init(row_list_t *list, Arena *arena, format_t format,
+                   const row_field_t *fields, int count)
+{
+    memset(list, 0, sizeof(*list));
+    list->format = format;
+    row_map_init(&list->map, fields, count);
+
+    if (format == FORMAT_JSON)
+    {
+        json_init(&list->json, arena);
+        json_array_begin(&list->json);
+    }
+    else
+    {
+        pack_init(&list->pack, arena, format);
+        list->at = pack_open_array(&list->pack);
+    }
+}
+
+void row_list_add(row_list_t *list, const PGresult *result, int row)
+{
+    if (!row_map_bind(&list->map, result))
+    {
+        list->json.failed = list->pack.failed = true;
+        return;
+    }
+
+    if (list->format == FORMAT_JSON)
+    {
+        row_map_object(&list->map, result, row, &list->json);
+        return;
+    }
+
+    row_map_pack(&list->map, result, row, &list->pack);
+    list->count++;
+}
+
+void row_list_send(row_list_t *list, Res *res, encoding_t encoding)
+{
+    if (list->format != FORMAT_JSON)
+    {
+        pack_close(&list->pack, list->at, list->count);
+
+        if (list->pack.failed)
+            send_text(res, 500, "Error while building the response");
+        else
+            send_compressed(res, encoding, format_content_type(list->format),
+                            list->pack.data, list->pack.len);
+        return;
+    }
+
+    json_array_end(&list->json);
+
+    const char *body = json_text(&list->json);
+    if (!body)
+        send_text(res, 500, "Out of memory");
+    else
+        send_compressed(res, encoding, "application/json", body, list->json.len);
+}
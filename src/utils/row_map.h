@@ -0,0 +1,82 @@
+#ifndef ROW_MAP_H
+#define ROW_MAP_H
+
+#include "json.h"
+#include "pack.h"
+#include "compress.h"
+#include <libpq-fe.h>
+
+// Declarative mapping of result columns to JSON object fields. A
+// handler lists the columns once in a static table; the column numbers
+// are looked up once per result shape and every row is then written
+// with pre-escaped keys and the typed getters of decode.h.
+
+typedef enum
+{
+    ROW_TEXT,      // string, "" for NULL as PQgetvalue() gives it
+    ROW_INT,       // int2/int4/int8 as a number
+    ROW_BOOL,      // boolean
+    ROW_TIMESTAMP, // string formatted like the server's text output
+    ROW_JSON,      // json/jsonb copied as it is
+} row_type_t;
+
+typedef struct
+{
+    const char *column;
+    const char *name;
+    const char *key; // "\"name\":", written without escaping
+    size_t key_len;
+    row_type_t type;
+} row_field_t;
+
+// Keys are string literals that need no escaping
+#define ROW_FIELD(column, key, type) \
+    {column, key, "\"" key "\":", sizeof("\"" key "\":") - 1, type}
+
+#define ROW_COUNT(fields) ((int)(sizeof(fields) / sizeof((fields)[0])))
+
+#define ROW_MAX_FIELDS 32
+
+typedef struct
+{
+    const row_field_t *fields;
+    int count;
+    int cols[ROW_MAX_FIELDS];
+    bool bound;
+} row_map_t;
+
+void row_map_init(row_map_t *map, const row_field_t *fields, int count);
+
+// Looks the columns up on the first result, single-row results of the
+// same statement reuse them. False if one of them is missing.
+bool row_map_bind(row_map_t *map, const PGresult *result);
+
+// The mapped fields of one row, into an object the caller has opened
+void row_map_fields(const row_map_t *map, const PGresult *result, int row, json_t *out);
+
+// The whole row as an object
+void row_map_object(const row_map_t *map, const PGresult *result, int row, json_t *out);
+
+// The same row as a MessagePack/CBOR map
+void row_map_pack(const row_map_t *map, const PGresult *result, int row, pack_t *out);
+
+// An array of mapped rows in the format the client asked for, written
+// as the rows arrive
+typedef struct
+{
+    format_t format;
+    row_map_t map;
+    json_t json;
+    pack_t pack;
+    size_t at; // count of the packed array, filled in at the end
+    uint32_t count;
+} row_list_t;
+
+void row_list_init(row_list_t *list, Arena *arena, format_t format,
+                   const row_field_t *fields, int count);
+void row_list_add(row_list_t *list, const PGresult *result, int row);
+
+// Closes the array and sends it with a 200, or a 500 if writing failed
+void row_list_send(row_list_t *list, Res *res, encoding_t encoding);
+
+#endif
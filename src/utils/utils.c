@@ -1,6 +1,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdio.h>
+#include "utils.h"
+#include "json.h"
+#include "sodium.h"
+
+#define CURSOR_BYTES 16
+#define CURSOR_VARIANT sodium_base64_VARIANT_URLSAFE_NO_PADDING
 
 int compute_reading_time(const char *content)
 {
@@ -17,3 +24,334 @@ int compute_reading_time(const char *content)
     }
     return (words + 199) / 200;
 }
+
+char *int_array_literal(Arena *arena, const int *values, int count)
+{
+    // Up to 11 chars per int plus a separator, and the braces
+    size_t size = (size_t)count * 12 + 3;
+    char *out = arena_alloc(arena, size);
+    if (!out)
+        return NULL;
+
+    size_t len = 0;
+    out[len++] = '{';
+
+    for (int i = 0; i < count; i++)
+    {
+        len += snprintf(out + len, size - len, i > 0 ? ",%d" : "%d", values[i]);
+    }
+
+    out[len++] = '}';
+    out[len] = '\0';
+    return out;
+}
+
+static void put_be64(unsigned char *p, int64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        p[i] = (unsigned char)(value & 0xff);
+        value = (int64_t)((uint64_t)value >> 8);
+    }
+}
+
+static int64_t get_be64(const unsigned char *p)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | p[i];
+    return (int64_t)value;
+}
+
+char *encode_cursor(Arena *arena, int64_t created_at, int64_t id)
+{
+    unsigned char raw[CURSOR_BYTES];
+    put_be64(raw, created_at);
+    put_be64(raw + 8, id);
+
+    size_t size = sodium_base64_ENCODED_LEN(CURSOR_BYTES, CURSOR_VARIANT);
+    char *out = arena_alloc(arena, size);
+    if (!out)
+        return NULL;
+
+    return sodium_bin2base64(out, size, raw, CURSOR_BYTES, CURSOR_VARIANT);
+}
+
+bool parse_page(Req *req, page_t *page)
+{
+    page->limit = PAGE_SIZE_DEFAULT;
+
+    const char *limit = get_query(req, "limit");
+    if (limit && *limit)
+    {
+        char *end = NULL;
+        long n = strtol(limit, &end, 10);
+        if (*end != '\0' || n <= 0)
+            return false;
+
+        page->limit = n > PAGE_SIZE_MAX ? PAGE_SIZE_MAX : (int)n;
+    }
+
+    snprintf(page->fetch, sizeof(page->fetch), "%d", page->limit + 1);
+
+    const char *cursor = get_query(req, "cursor");
+    if (!cursor || !*cursor)
+    {
+        // First page: everything sorts before this
+        snprintf(page->after_created_at, sizeof(page->after_created_at), "infinity");
+        snprintf(page->after_id, sizeof(page->after_id), "%d", INT32_MAX);
+        return true;
+    }
+
+    unsigned char raw[CURSOR_BYTES];
+    size_t raw_len = 0;
+
+    if (sodium_base642bin(raw, sizeof(raw), cursor, strlen(cursor), NULL,
+                          &raw_len, NULL, CURSOR_VARIANT) != 0 ||
+        raw_len != CURSOR_BYTES)
+    {
+        return false;
+    }
+
+    int64_t id = get_be64(raw + 8);
+    if (id <= 0 || id > INT32_MAX)
+        return false;
+
+    if (db_format_timestamp(get_be64(raw), page->after_created_at,
+                            sizeof(page->after_created_at)) == 0)
+    {
+        return false;
+    }
+
+    snprintf(page->after_id, sizeof(page->after_id), "%lld", (long long)id);
+    return true;
+}
+
+int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    if (!value || *value == '\0')
+        return fallback;
+
+    char *end = NULL;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || n <= 0 || n > 1000000)
+    {
+        fprintf(stderr, "Ignoring invalid %s: %s\n", name, value);
+        return fallback;
+    }
+
+    return (int)n;
+}
+
+bool env_list_has(const char *name, const char *item)
+{
+    const char *p = getenv(name);
+    size_t len = strlen(item);
+
+    while (p && *p)
+    {
+        while (*p == ' ' || *p == ',')
+            p++;
+
+        const char *end = p;
+        while (*end && *end != ',' && *end != ' ')
+            end++;
+
+        if ((size_t)(end - p) == len && memcmp(p, item, len) == 0)
+            return true;
+
+        p = end;
+    }
+
+    return false;
+}
+
+#define ETAG_HASH_BYTES 16
+
+char *if_none_match(Req *req)
+{
+    const char *value = get_header(req, "If-None-Match");
+    return value ? arena_strdup(req->arena, value) : NULL;
+}
+
+static bool etag_listed(const char *list, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+
+        if (*p == '*')
+            return true;
+
+        // If-None-Match uses the weak comparison, so W/ is ignored
+        if (strncmp(p, "W/", 2) == 0)
+            p += 2;
+
+        const char *end = p;
+        while (*end && *end != ',' && *end != ' ' && *end != '\t')
+            end++;
+
+        if ((size_t)(end - p) == etag_len && memcmp(p, etag, etag_len) == 0)
+            return true;
+
+        p = end;
+    }
+
+    return false;
+}
+
+// Quoted hex, as the header requires, plus the encoding: each one is
+// its own representation of the body
+#define ETAG_LEN (ETAG_HASH_BYTES * 2 + 8)
+
+static void make_etag(const unsigned char *hash, encoding_t encoding, char *etag)
+{
+    char hex[ETAG_HASH_BYTES * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), hash, ETAG_HASH_BYTES);
+
+    const char *name = encoding_name(encoding);
+    if (name)
+        snprintf(etag, ETAG_LEN, "\"%s-%s\"", hex, name);
+    else
+        snprintf(etag, ETAG_LEN, "\"%s\"", hex);
+}
+
+static void reply_encoded(Res *res, const char *content_type, encoding_t encoding,
+                          const void *body, size_t len)
+{
+    const char *name = encoding_name(encoding);
+    if (name)
+        set_header(res, "Content-Encoding", name);
+
+    set_header(res, "Content-Type", content_type);
+    reply(res, OK, body, len);
+}
+
+// The body, or its encoded form when there is one or it is worth
+// making. A 304 never gets as far as compressing.
+static void send_etag(Res *res, const char *if_none_match, const char *content_type,
+                      const encoded_body_t *body, encoding_t encoding)
+{
+    unsigned char hash[ETAG_HASH_BYTES];
+    crypto_generichash(hash, sizeof(hash), (const unsigned char *)body->data, body->len, NULL, 0);
+
+    const char *encoded = body->encoded;
+    size_t encoded_len = body->encoded_len;
+
+    if (!encoded && !worth_compressing(body->len))
+        encoding = ENCODING_IDENTITY;
+
+    // Authors see hidden posts, so the body depends on the session.
+    // Listings also come in the format and encoding the client accepts.
+    set_header(res, "Vary", "Cookie, Accept, Accept-Encoding");
+
+    char etag[ETAG_LEN];
+    make_etag(hash, encoding, etag);
+
+    if (if_none_match && etag_listed(if_none_match, etag))
+    {
+        set_header(res, "ETag", etag);
+        reply(res, NOT_MODIFIED, NULL, 0);
+        return;
+    }
+
+    if (encoding != ENCODING_IDENTITY && !encoded)
+    {
+        encoded = compress_body(res->arena, encoding, body->data, body->len, &encoded_len);
+        if (!encoded)
+        {
+            encoding = ENCODING_IDENTITY;
+            make_etag(hash, encoding, etag);
+        }
+    }
+
+    set_header(res, "ETag", etag);
+
+    if (encoding == ENCODING_IDENTITY)
+        reply_encoded(res, content_type, encoding, body->data, body->len);
+    else
+        reply_encoded(res, content_type, encoding, encoded, encoded_len);
+}
+
+void send_json_etag(Res *res, const char *if_none_match, encoding_t encoding, const char *body)
+{
+    encoded_body_t plain = {.data = body, .len = strlen(body)};
+    send_etag(res, if_none_match, "application/json", &plain, encoding);
+}
+
+void send_pack_etag(Res *res, const char *if_none_match, encoding_t encoding, const pack_t *pack)
+{
+    if (pack->failed)
+    {
+        send_text(res, 500, "Error while building the response");
+        return;
+    }
+
+    encoded_body_t plain = {.data = pack->data, .len = pack->len};
+    send_etag(res, if_none_match, format_content_type(pack->format), &plain, encoding);
+}
+
+void send_encoded_etag(Res *res, const char *if_none_match, const encoded_body_t *body)
+{
+    send_etag(res, if_none_match, "application/json", body, body->encoding);
+}
+
+void send_compressed(Res *res, encoding_t encoding, const char *content_type,
+                     const void *body, size_t len)
+{
+    set_header(res, "Vary", "Accept, Accept-Encoding");
+
+    size_t encoded_len = 0;
+    char *encoded = NULL;
+    if (encoding != ENCODING_IDENTITY && worth_compressing(len))
+        encoded = compress_body(res->arena, encoding, body, len, &encoded_len);
+
+    if (encoded)
+        reply_encoded(res, content_type, encoding, encoded, encoded_len);
+    else
+        reply_encoded(res, content_type, ENCODING_IDENTITY, body, len);
+}
+
+void send_json_page(Res *res, const char *if_none_match, encoding_t encoding,
+                    const PGresult *result)
+{
+    if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+    {
+        send_text(res, 500, "DB select failed");
+        return;
+    }
+
+    char *next_cursor = NULL;
+    if (db_get_bool(result, 0, PQfnumber(result, "has_more")))
+    {
+        next_cursor = encode_cursor(res->arena,
+                                    db_get_timestamp(result, 0, PQfnumber(result, "last_created_at")),
+                                    db_get_int(result, 0, PQfnumber(result, "last_id")));
+    }
+
+    int col_posts = PQfnumber(result, "posts");
+
+    json_t out;
+    json_init(&out, res->arena);
+
+    json_object_begin(&out);
+    json_key(&out, "posts");
+    json_raw(&out, PQgetvalue(result, 0, col_posts), (size_t)PQgetlength(result, 0, col_posts));
+    json_key(&out, "next_cursor");
+    json_string(&out, next_cursor);
+    json_object_end(&out);
+
+    const char *body = json_text(&out);
+    if (!body)
+    {
+        send_text(res, 500, "Out of memory");
+        return;
+    }
+
+    send_json_etag(res, if_none_match, encoding, body);
+}
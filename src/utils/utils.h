@@ -1,6 +1,65 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "ecewo.h"
+#include "decode.h"
+#include "pack.h"
+#include "compress.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PAGE_SIZE_DEFAULT 20
+#define PAGE_SIZE_MAX 100
+
+// Keyset page of a (created_at, id) DESC listing, as statement params
+typedef struct
+{
+    int limit;
+    char fetch[12]; // limit + 1, the extra row tells if a next page exists
+    char after_created_at[DB_TIMESTAMP_LEN];
+    char after_id[24];
+} page_t;
+
 int compute_reading_time(const char *content);
 
+// Positive integer from the environment, fallback if unset or invalid
+int env_int(const char *name, int fallback);
+
+// Whether the comma-separated list in the environment names item
+bool env_list_has(const char *name, const char *item);
+
+// Postgres array literal like {1,2,3} for passing ints as one parameter
+char *int_array_literal(Arena *arena, const int *values, int count);
+
+// If-None-Match of the request copied to its arena, NULL if absent
+char *if_none_match(Req *req);
+
+// Sends a 200 JSON body with a strong ETag hashed from its content,
+// or an empty 304 when the client's If-None-Match already names it.
+// Large bodies are compressed if the encoding (see accept_encoding)
+// is not identity.
+void send_json_etag(Res *res, const char *if_none_match, encoding_t encoding, const char *body);
+
+// The same for a MessagePack/CBOR body, 500 if writing it failed
+void send_pack_etag(Res *res, const char *if_none_match, encoding_t encoding, const pack_t *pack);
+
+// The same for a JSON body that may come compressed already, as the
+// post cache keeps them, so it is never compressed again
+void send_encoded_etag(Res *res, const char *if_none_match, const encoded_body_t *body);
+
+// A 200 body without ETag, compressed like the ones above
+void send_compressed(Res *res, encoding_t encoding, const char *content_type,
+                     const void *body, size_t len);
+
+// Reads ?limit= and ?cursor=, false if either is malformed
+bool parse_page(Req *req, page_t *page);
+
+// Opaque ?cursor= token for the last row of a page
+char *encode_cursor(Arena *arena, int64_t created_at, int64_t id);
+
+// Sends a page rendered by the server (JSON_PAGE in db.c): its posts
+// as they are, and the cursor of its last row if another page follows
+void send_json_page(Res *res, const char *if_none_match, encoding_t encoding,
+                    const PGresult *result);
+
 #endif
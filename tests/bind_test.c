@@ -0,0 +1,203 @@
+// bind_body edge cases, and strings written by json_t read back by it
+
+#include "support.h"
+#include "bind.h"
+#include "json.h"
+#include <string.h>
+
+typedef struct
+{
+    char *username;
+    char *password;
+    bool remember;
+    int age;
+    int_list_t ids;
+} body_t;
+
+static const bind_field_t fields[] = {
+    BIND(body_t, username, BIND_STRING, true),
+    BIND(body_t, password, BIND_STRING, false),
+    BIND(body_t, remember, BIND_BOOL, false),
+    BIND(body_t, age, BIND_INT, false),
+    BIND(body_t, ids, BIND_INT_LIST, false),
+};
+
+static Arena *arena;
+
+static bind_status_t bind(const char *json, body_t *body)
+{
+    arena_reset(arena);
+    return bind_body(arena, json, fields, BIND_COUNT(fields), body);
+}
+
+static void test_escapes(void)
+{
+    body_t b;
+
+    CHECK(bind("{\"username\":\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "a\"b\\c/d\b\f\n\r\t") == 0);
+
+    CHECK(bind("{\"username\":\"caf\\u00e9 \\u20AC\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "caf\xc3\xa9 \xe2\x82\xac") == 0);
+
+    // Raw UTF-8 passes through untouched
+    CHECK(bind("{\"username\":\"caf\xc3\xa9\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "caf\xc3\xa9") == 0);
+
+    CHECK(bind("{\"username\":\"\\x\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"\\u12\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"tab\there\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"unterminated}", &b) == BIND_INVALID);
+}
+
+static void test_surrogates(void)
+{
+    body_t b;
+
+    CHECK(bind("{\"username\":\"\\ud83d\\ude00!\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "\xf0\x9f\x98\x80!") == 0);
+
+    CHECK(bind("{\"username\":\"\\uDBFF\\uDFFF\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "\xf4\x8f\xbf\xbf") == 0);
+
+    // Halves on their own, or the wrong way round
+    CHECK(bind("{\"username\":\"\\ud83d\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"\\ud83dx\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"\\ude00\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"\\ud83d\\u0041\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"\\ude00\\ud83d\"}", &b) == BIND_INVALID);
+}
+
+static void test_nul(void)
+{
+    body_t b;
+
+    // Would end the C string early
+    CHECK(bind("{\"username\":\"ab\\u0000cd\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"other\":\"\\u0000\",\"username\":\"a\"}", &b) == BIND_INVALID);
+}
+
+static void test_unknown_keys(void)
+{
+    body_t b;
+
+    CHECK(bind("{\"x\":{\"a\":[1,{\"b\":\"\\\"}\"}],\"c\":null},\"username\":\"u\",\"y\":[[],{}],\"z\":-1.5e3}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "u") == 0);
+    CHECK(b.password == NULL);
+
+    // Still validated while skipped
+    CHECK(bind("{\"x\":[1,],\"username\":\"u\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"x\":tru,\"username\":\"u\"}", &b) == BIND_INVALID);
+}
+
+static void test_duplicate_keys(void)
+{
+    body_t b;
+
+    // The last value of the field's type wins
+    CHECK(bind("{\"username\":\"first\",\"username\":\"second\"}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "second") == 0);
+
+    CHECK(bind("{\"username\":\"first\",\"username\":5}", &b) == BIND_OK);
+    CHECK(strcmp(b.username, "first") == 0);
+
+    CHECK(bind("{\"username\":\"u\",\"age\":1,\"age\":2}", &b) == BIND_OK);
+    CHECK(b.age == 2);
+}
+
+static void test_wrong_types(void)
+{
+    body_t b;
+
+    // A required field of another type is missing
+    CHECK(bind("{\"username\":42}", &b) == BIND_MISSING);
+    CHECK(bind("{\"username\":null}", &b) == BIND_MISSING);
+    CHECK(bind("{\"username\":[\"a\"]}", &b) == BIND_MISSING);
+    CHECK(bind("{}", &b) == BIND_MISSING);
+
+    // Optional ones keep their zero value
+    CHECK(bind("{\"username\":\"u\",\"password\":1,\"remember\":\"yes\",\"age\":\"3\",\"ids\":{}}", &b) == BIND_OK);
+    CHECK(b.password == NULL);
+    CHECK(!b.remember);
+    CHECK(b.age == 0);
+    CHECK(b.ids.count == 0);
+
+    CHECK(bind("{\"username\":\"u\",\"remember\":true,\"age\":-7,\"ids\":[1,\"x\",2,[3],-4]}", &b) == BIND_OK);
+    CHECK(b.remember);
+    CHECK(b.age == -7);
+    CHECK(b.ids.count == 3 && b.ids.items[0] == 1 && b.ids.items[1] == 2 && b.ids.items[2] == -4);
+
+    CHECK(bind("{\"username\":\"u\",\"remember\":1}", &b) == BIND_OK);
+    CHECK(b.remember);
+
+    // Out of range numbers saturate
+    CHECK(bind("{\"username\":\"u\",\"age\":1e20}", &b) == BIND_OK);
+    CHECK(b.age == INT32_MAX);
+}
+
+static void test_not_an_object(void)
+{
+    body_t b;
+
+    CHECK(bind(NULL, &b) == BIND_INVALID);
+    CHECK(bind("", &b) == BIND_INVALID);
+    CHECK(bind("[]", &b) == BIND_INVALID);
+    CHECK(bind("\"username\"", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"u\"", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"u\"} x", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\" \"u\"}", &b) == BIND_INVALID);
+    CHECK(bind("{\"username\":\"u\",}", &b) == BIND_INVALID);
+    CHECK(bind("  {\"username\" : \"u\" }\n", &b) == BIND_OK);
+}
+
+// Every byte but NUL, written by json_t and read back by bind_body
+static void test_round_trip(void)
+{
+    uint32_t rng = 1;
+
+    for (int round = 0; round < 2000; round++)
+    {
+        char value[256];
+        size_t len = (size_t)(round % 255);
+        for (size_t i = 0; i < len; i++)
+        {
+            rng = rng * 1103515245 + 12345;
+            value[i] = (char)(1 + (rng >> 16) % 255);
+        }
+        value[len] = '\0';
+
+        json_t out;
+        json_init(&out, NULL);
+        json_object_begin(&out);
+        json_key(&out, "ignored\n");
+        json_string(&out, value);
+        json_key(&out, "username");
+        json_string(&out, value);
+        json_object_end(&out);
+
+        body_t b;
+        CHECK(bind(json_text(&out), &b) == BIND_OK);
+        CHECK(b.username && strcmp(b.username, value) == 0);
+
+        json_free(&out);
+    }
+}
+
+int main(void)
+{
+    arena = arena_new(1 << 16);
+    if (!arena)
+        return 1;
+
+    test_escapes();
+    test_surrogates();
+    test_nul();
+    test_unknown_keys();
+    test_duplicate_keys();
+    test_wrong_types();
+    test_not_an_object();
+    test_round_trip();
+
+    arena_delete(arena);
+    return check_failures != 0;
+}
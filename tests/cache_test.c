@@ -0,0 +1,291 @@
+// cache_t: LRU eviction, the byte limit, the settle window after an
+// invalidation, prefix tombstones and their overflow, and TTL expiry.
+// The loop clock is the stand-in's, moved by hand.
+
+#include "support.h"
+#include "cache.h"
+#include <string.h>
+
+#define SETTLE_MS 1000
+
+// The most tombstones cache.c keeps, CACHE_TOMBSTONES there
+#define TOMBSTONES 64
+
+static uint64_t clock_ms = 1000000;
+
+static void advance(uint64_t ms)
+{
+    clock_ms += ms;
+    set_now_ms(clock_ms);
+}
+
+static char value[100];
+
+static bool has(cache_t *cache, const char *key)
+{
+    return cache_get(cache, key, NULL) != NULL;
+}
+
+static cache_stats_t stats(cache_t *cache)
+{
+    cache_stats_t s;
+    cache_stats(cache, &s);
+    return s;
+}
+
+// False when the put was refused, an older entry then stays as it was
+static bool put(cache_t *cache, const char *key)
+{
+    uint64_t rejected = stats(cache).rejected;
+    cache_put(cache, key, value, sizeof(value));
+    return stats(cache).rejected == rejected && has(cache, key);
+}
+
+// Bytes taken by one entry with a two-letter key and `value`
+static size_t entry_bytes(void)
+{
+    cache_t *cache = cache_create(1 << 20, 0);
+    cache_put(cache, "k0", value, sizeof(value));
+    size_t bytes = stats(cache).bytes;
+    cache_destroy(cache);
+    return bytes;
+}
+
+static void append_key(const char *key, void *data)
+{
+    char *keys = data;
+    strcat(keys, key);
+    strcat(keys, " ");
+}
+
+static void test_eviction_order(void)
+{
+    // Room for exactly four entries
+    cache_t *cache = cache_create(4 * entry_bytes(), 0);
+
+    CHECK(put(cache, "k0"));
+    CHECK(put(cache, "k1"));
+    CHECK(put(cache, "k2"));
+    CHECK(put(cache, "k3"));
+    CHECK(stats(cache).evictions == 0);
+
+    // A read makes k0 the most recent, so k1 goes first
+    CHECK(has(cache, "k0"));
+    cache_put(cache, "k4", value, sizeof(value));
+
+    char keys[64] = "";
+    cache_each_key(cache, 10, append_key, keys);
+    CHECK(strcmp(keys, "k4 k0 k3 k2 ") == 0);
+
+    keys[0] = '\0';
+    cache_each_key(cache, 2, append_key, keys);
+    CHECK(strcmp(keys, "k4 k0 ") == 0);
+
+    CHECK(!has(cache, "k1"));
+    CHECK(stats(cache).evictions == 1);
+    CHECK(stats(cache).entries == 4);
+
+    // Replacing a key does not evict anything else
+    CHECK(put(cache, "k2"));
+    CHECK(stats(cache).evictions == 1);
+    CHECK(stats(cache).entries == 4);
+
+    cache_destroy(cache);
+}
+
+static void test_byte_limit(void)
+{
+    size_t bytes = entry_bytes();
+    cache_t *cache = cache_create(4 * bytes, 0);
+
+    // Never above max_bytes, however many puts
+    char key[8];
+    for (int i = 0; i < 100; i++)
+    {
+        snprintf(key, sizeof(key), "k%d", i % 10);
+        cache_put(cache, key, value, sizeof(value));
+        CHECK(stats(cache).bytes <= 4 * bytes);
+    }
+    CHECK(stats(cache).bytes == 4 * bytes);
+
+    // One byte over a quarter of the cache is refused, and evicts nothing
+    cache_stats_t before = stats(cache);
+    char big[sizeof(value) + 1] = {0};
+    cache_put(cache, "k0", big, sizeof(big));
+    CHECK(stats(cache).rejected == before.rejected + 1);
+    CHECK(stats(cache).entries == before.entries);
+    CHECK(!has(cache, "k0"));
+    CHECK(stats(cache).evictions == before.evictions);
+
+    // Exactly a quarter is not
+    CHECK(put(cache, "kx"));
+    CHECK(stats(cache).rejected == before.rejected + 1);
+
+    size_t len = 0;
+    const char *got = cache_get(cache, "kx", &len);
+    CHECK(got && len == sizeof(value) && got[len] == '\0');
+
+    cache_destroy(cache);
+}
+
+static void test_settle_window(void)
+{
+    cache_t *cache = cache_create(1 << 20, SETTLE_MS);
+
+    CHECK(put(cache, "alice\x1fpost"));
+    cache_remove(cache, "alice\x1fpost");
+    CHECK(!has(cache, "alice\x1fpost"));
+    CHECK(stats(cache).invalidations == 1);
+
+    // A read that began before the write may still try to fill it
+    advance(SETTLE_MS - 1);
+    CHECK(!put(cache, "alice\x1fpost"));
+    CHECK(stats(cache).rejected == 1);
+
+    // Other keys are not affected
+    CHECK(put(cache, "alice\x1fother"));
+
+    advance(1);
+    CHECK(put(cache, "alice\x1fpost"));
+
+    cache_destroy(cache);
+
+    // Without a window the key can be filled again at once
+    cache = cache_create(1 << 20, 0);
+    CHECK(put(cache, "k0"));
+    cache_remove(cache, "k0");
+    CHECK(put(cache, "k0"));
+    cache_destroy(cache);
+}
+
+static void test_prefix_tombstone(void)
+{
+    cache_t *cache = cache_create(1 << 20, SETTLE_MS);
+
+    CHECK(put(cache, "alice\x1fone"));
+    CHECK(put(cache, "alice\x1ftwo"));
+    CHECK(put(cache, "alicia\x1fone"));
+    CHECK(put(cache, "bob\x1fone"));
+
+    cache_remove_prefix(cache, "alice\x1f");
+    CHECK(!has(cache, "alice\x1fone"));
+    CHECK(!has(cache, "alice\x1ftwo"));
+    CHECK(has(cache, "alicia\x1fone"));
+    CHECK(has(cache, "bob\x1fone"));
+    CHECK(stats(cache).invalidations == 2);
+
+    // Every key under the prefix is refused, even one never cached
+    advance(SETTLE_MS / 2);
+    CHECK(!put(cache, "alice\x1fone"));
+    CHECK(!put(cache, "alice\x1fthree"));
+    CHECK(put(cache, "alicia\x1ftwo"));
+    CHECK(put(cache, "bob\x1ftwo"));
+
+    advance(SETTLE_MS / 2);
+    CHECK(put(cache, "alice\x1fone"));
+
+    // The empty prefix, as after missed notifications, covers everything
+    cache_remove_prefix(cache, "");
+    CHECK(stats(cache).entries == 0);
+    CHECK(!put(cache, "bob\x1fone"));
+
+    cache_destroy(cache);
+}
+
+static void test_tombstone_overflow(void)
+{
+    cache_t *cache = cache_create(1 << 20, SETTLE_MS);
+    char key[16];
+
+    for (int i = 0; i < TOMBSTONES; i++)
+    {
+        snprintf(key, sizeof(key), "gone%d", i);
+        cache_remove(cache, key);
+    }
+
+    // All of them still remembered
+    CHECK(put(cache, "other"));
+    CHECK(!put(cache, "gone0"));
+
+    // One more overwrites gone0 inside its window: which key it guarded
+    // is lost, so every put is refused until that window would have ended
+    advance(SETTLE_MS / 4);
+    cache_remove(cache, "gone64");
+    CHECK(!put(cache, "unrelated"));
+    CHECK(!put(cache, "other"));
+
+    advance(SETTLE_MS - SETTLE_MS / 4 - 1);
+    CHECK(!put(cache, "unrelated"));
+
+    advance(1);
+    CHECK(put(cache, "unrelated"));
+    CHECK(put(cache, "gone0"));
+    CHECK(!put(cache, "gone64"));
+
+    // Overwriting tombstones that already settled does not overflow
+    advance(SETTLE_MS);
+    for (int i = 0; i < TOMBSTONES; i++)
+    {
+        snprintf(key, sizeof(key), "old%d", i);
+        cache_remove(cache, key);
+    }
+    advance(SETTLE_MS);
+    for (int i = 0; i < TOMBSTONES; i++)
+    {
+        snprintf(key, sizeof(key), "new%d", i);
+        cache_remove(cache, key);
+    }
+    CHECK(put(cache, "unrelated"));
+    CHECK(put(cache, "old0"));
+    CHECK(!put(cache, "new0"));
+
+    cache_destroy(cache);
+}
+
+static void test_ttl(void)
+{
+    cache_t *cache = cache_create(1 << 20, 0);
+
+    // Set after a put, older entries keep living
+    CHECK(put(cache, "before"));
+    cache_set_ttl(cache, 500);
+    CHECK(put(cache, "after"));
+
+    advance(499);
+    CHECK(has(cache, "after"));
+    CHECK(stats(cache).expired == 0);
+
+    advance(1);
+    CHECK(!has(cache, "after"));
+    CHECK(has(cache, "before"));
+    CHECK(stats(cache).expired == 1);
+    CHECK(stats(cache).entries == 1);
+
+    // A put starts the clock again
+    CHECK(put(cache, "after"));
+    advance(499);
+    CHECK(put(cache, "after"));
+    advance(499);
+    CHECK(has(cache, "after"));
+
+    // Reads do not extend it
+    advance(1);
+    CHECK(!has(cache, "after"));
+
+    cache_destroy(cache);
+}
+
+int main(void)
+{
+    memset(value, 'v', sizeof(value));
+    set_now_ms(clock_ms);
+
+    test_eviction_order();
+    test_byte_limit();
+    test_settle_window();
+    test_prefix_tombstone();
+    test_tombstone_overflow();
+    test_ttl();
+
+    return check_failures != 0;
+}
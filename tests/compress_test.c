@@ -0,0 +1,246 @@
+// compress_body output decompressed again and compared to its input,
+// gzip always and zstd when built with HAVE_ZSTD, and the choice of
+// encoding from Accept-Encoding
+
+#include "support.h"
+#include "compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// utils.c needs the whole app, so its env_int is repeated here
+int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    if (!value || *value == '\0')
+        return fallback;
+
+    char *end = NULL;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || n <= 0 || n > 1000000)
+        return fallback;
+
+    return (int)n;
+}
+
+static Arena *arena;
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// JSON-ish text, compressible like a response
+static char *make_text(size_t len)
+{
+    static const char *words[] = {"{\"id\" : ", "\"header\" : ", "post", "1234", ", ",
+                                  "\"content\" : \"", "lorem", "ipsum", "\\n", "}"};
+    char *s = malloc(len + 1);
+
+    for (size_t n = 0; n < len;)
+    {
+        const char *word = words[next_random() % (sizeof(words) / sizeof(words[0]))];
+        for (; *word && n < len; word++)
+            s[n++] = *word;
+    }
+
+    s[len] = '\0';
+    return s;
+}
+
+static bool gunzip_equals(const char *data, size_t len, const char *expected, size_t expected_len)
+{
+    // Gzip wrapper, not zlib's
+    if (len < 2 || (unsigned char)data[0] != 0x1f || (unsigned char)data[1] != 0x8b)
+        return false;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return false;
+
+    char *out = malloc(expected_len + 1);
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)len;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = (uInt)expected_len + 1;
+
+    int status = inflate(&stream, Z_FINISH);
+    bool equal = status == Z_STREAM_END && stream.total_out == expected_len &&
+                 stream.avail_in == 0 && memcmp(out, expected, expected_len) == 0;
+
+    inflateEnd(&stream);
+    free(out);
+    return equal;
+}
+
+#ifdef HAVE_ZSTD
+static bool unzstd_equals(const char *data, size_t len, const char *expected, size_t expected_len)
+{
+    if (ZSTD_getFrameContentSize(data, len) != expected_len)
+        return false;
+
+    char *out = malloc(expected_len + 1);
+    size_t n = ZSTD_decompress(out, expected_len + 1, data, len);
+    bool equal = !ZSTD_isError(n) && n == expected_len && memcmp(out, expected, expected_len) == 0;
+
+    free(out);
+    return equal;
+}
+#endif
+
+static bool round_trip(Arena *in, encoding_t encoding, const char *body, size_t len)
+{
+    if (in)
+        arena_reset(in);
+
+    size_t out_len = 0;
+    char *out = compress_body(in, encoding, body, len, &out_len);
+    if (!out || out_len >= len)
+        return false;
+
+    bool equal = false;
+    if (encoding == ENCODING_GZIP)
+        equal = gunzip_equals(out, out_len, body, len);
+#ifdef HAVE_ZSTD
+    else if (encoding == ENCODING_ZSTD)
+        equal = unzstd_equals(out, out_len, body, len);
+#endif
+
+    if (!in)
+        free(out);
+    return equal;
+}
+
+static void test_round_trip(void)
+{
+    // From the default COMPRESS_MIN_BYTES up, smaller ones need not shrink
+    static const size_t sizes[] = {1024, 4096, 65536, 1 << 20};
+    static const encoding_t encodings[] = {
+        ENCODING_GZIP,
+#ifdef HAVE_ZSTD
+        ENCODING_ZSTD,
+#endif
+    };
+
+    for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++)
+    {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            char *body = make_text(sizes[s]);
+
+            // Into the arena and onto the heap, twice over, as the
+            // compressor state is reused between bodies
+            CHECK(round_trip(arena, encodings[e], body, sizes[s]));
+            CHECK(round_trip(NULL, encodings[e], body, sizes[s]));
+            CHECK(round_trip(arena, encodings[e], body, sizes[s]));
+
+            free(body);
+        }
+    }
+}
+
+static void test_not_smaller(void)
+{
+    char noise[4096];
+    for (size_t i = 0; i < sizeof(noise); i++)
+        noise[i] = (char)next_random();
+
+    size_t out_len;
+    arena_reset(arena);
+    CHECK(compress_body(arena, ENCODING_GZIP, noise, sizeof(noise), &out_len) == NULL);
+    CHECK(compress_body(NULL, ENCODING_GZIP, "", 0, &out_len) == NULL);
+    CHECK(compress_body(arena, ENCODING_IDENTITY, "aaaaaaaaaaaaaaaa", 16, &out_len) == NULL);
+#ifdef HAVE_ZSTD
+    CHECK(compress_body(arena, ENCODING_ZSTD, noise, sizeof(noise), &out_len) == NULL);
+#else
+    CHECK(compress_body(arena, ENCODING_ZSTD, "aaaaaaaaaaaaaaaa", 16, &out_len) == NULL);
+#endif
+}
+
+static void test_accept_encoding(void)
+{
+#ifdef HAVE_ZSTD
+    const encoding_t best = ENCODING_ZSTD;
+#else
+    const encoding_t best = ENCODING_GZIP;
+#endif
+
+    static const struct
+    {
+        const char *header;
+        encoding_t zstd; // the answer with zstd built in
+        encoding_t gzip; // and without
+    } cases[] = {
+        {"gzip", ENCODING_GZIP, ENCODING_GZIP},
+        {"GZip", ENCODING_GZIP, ENCODING_GZIP},
+        {"gzip, deflate, br, zstd", ENCODING_ZSTD, ENCODING_GZIP},
+        {"zstd", ENCODING_ZSTD, ENCODING_IDENTITY},
+        {"zstd;q=0.5, gzip", ENCODING_GZIP, ENCODING_GZIP},
+        {"gzip;q=0.5, zstd;q=0.8", ENCODING_ZSTD, ENCODING_GZIP},
+        {"gzip;q=0", ENCODING_IDENTITY, ENCODING_IDENTITY},
+        {"*", ENCODING_ZSTD, ENCODING_GZIP},
+        {"*;q=0, gzip", ENCODING_GZIP, ENCODING_GZIP},
+        {"zstd;q=0, *", ENCODING_GZIP, ENCODING_GZIP},
+        {"identity", ENCODING_IDENTITY, ENCODING_IDENTITY},
+        {"br, deflate", ENCODING_IDENTITY, ENCODING_IDENTITY},
+        {"xgzip, gzipx", ENCODING_IDENTITY, ENCODING_IDENTITY},
+        {"", ENCODING_IDENTITY, ENCODING_IDENTITY},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        Req *req = request_with("Accept-Encoding", cases[i].header);
+        encoding_t expected = best == ENCODING_ZSTD ? cases[i].zstd : cases[i].gzip;
+        encoding_t chosen = accept_encoding(req);
+        if (chosen != expected)
+            fprintf(stderr, "Accept-Encoding: %s\n", cases[i].header);
+        CHECK(chosen == expected);
+        request_delete(req);
+    }
+
+    CHECK(accept_encoding(NULL) == ENCODING_IDENTITY);
+    CHECK(encoding_available(ENCODING_GZIP));
+    CHECK(encoding_available(ENCODING_ZSTD) == (best == ENCODING_ZSTD));
+    CHECK(!encoding_available(ENCODING_IDENTITY));
+    CHECK(encoding_name(ENCODING_IDENTITY) == NULL);
+    CHECK(strcmp(encoding_name(ENCODING_ZSTD), "zstd") == 0);
+}
+
+static void test_threshold(void)
+{
+    // Read once, on first use
+    CHECK(!worth_compressing(99));
+    CHECK(worth_compressing(100));
+}
+
+int main(void)
+{
+    setenv("COMPRESS_MIN_BYTES", "100", 1);
+
+    arena = arena_new(4 << 20);
+    if (!arena)
+        return 1;
+
+#ifdef HAVE_ZSTD
+    printf("gzip and zstd\n");
+#else
+    printf("gzip only, built without HAVE_ZSTD\n");
+#endif
+
+    test_round_trip();
+    test_not_smaller();
+    test_accept_encoding();
+    test_threshold();
+
+    arena_delete(arena);
+    return check_failures != 0;
+}
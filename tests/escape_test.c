@@ -0,0 +1,162 @@
+// The scans put_escaped uses to find the next byte that needs an
+// escape: SSE2 and AVX2 against the scalar one, with hits placed on and
+// around each 16- and 32-byte boundary, then json_string_len against a
+// byte-by-byte reference. The scans are static, so json.c is compiled
+// in here, as in bench/escape_bench.c.
+
+#include "support.h"
+#include "../src/utils/json.c"
+
+typedef size_t (*scan_fn)(const char *s, size_t len);
+
+static size_t clean_prefix_scalar(const char *s, size_t len)
+{
+    size_t i = 0;
+    while (i < len && !needs_escape((unsigned char)s[i]))
+        i++;
+    return i;
+}
+
+typedef struct
+{
+    const char *name;
+    scan_fn scan;
+} path_t;
+
+static path_t paths[3];
+static int path_count = 0;
+
+static void find_paths(void)
+{
+    paths[path_count++] = (path_t){"scalar", clean_prefix_scalar};
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    paths[path_count++] = (path_t){"sse2", clean_prefix_sse2};
+
+    if (__builtin_cpu_supports("avx2"))
+        paths[path_count++] = (path_t){"avx2", clean_prefix_avx2};
+    else
+        printf("no AVX2 on this CPU, skipping it\n");
+#endif
+}
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Text that never needs an escape, including UTF-8 and DEL
+static void fill_clean(char *s, size_t len)
+{
+    static const char alphabet[] = "abcdefghij klmnopqrstuvwxyz.,;:!?'0123456789\x7f\xc3\xa9\xe2\x82\xac";
+    for (size_t i = 0; i < len; i++)
+        s[i] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+}
+
+static void check_paths(void)
+{
+    // Hits must be found. Misses (space, DEL, high bytes) must not be,
+    // the signed-compare mistake would take 0x80 and up for controls.
+    static const unsigned char hits[] = {'"', '\\', 0x00, 0x01, '\n', 0x1f};
+    static const unsigned char misses[] = {0x20, 0x7f, 0x80, 0xff};
+
+    char buf[200];
+
+    for (size_t len = 0; len <= 130; len++)
+    {
+        for (size_t at = 0; at < len; at++)
+        {
+            for (size_t h = 0; h < sizeof(hits); h++)
+            {
+                fill_clean(buf, len);
+                buf[at] = (char)hits[h];
+
+                for (int p = 1; p < path_count; p++)
+                    CHECK(paths[p].scan(buf, len) == at);
+            }
+
+            for (size_t m = 0; m < sizeof(misses); m++)
+            {
+                fill_clean(buf, len);
+                buf[at] = (char)misses[m];
+
+                for (int p = 1; p < path_count; p++)
+                    CHECK(paths[p].scan(buf, len) == len);
+            }
+        }
+    }
+
+    // Several hits and unaligned starts, against scalar
+    for (int round = 0; round < 20000; round++)
+    {
+        size_t len = next_random() % 190;
+        size_t start = next_random() % 8;
+        fill_clean(buf, sizeof(buf));
+
+        for (int n = next_random() % 4; n > 0 && len; n--)
+            buf[start + next_random() % len] = (char)hits[next_random() % sizeof(hits)];
+
+        size_t expected = clean_prefix_scalar(buf + start, len);
+        for (int p = 1; p < path_count; p++)
+            CHECK(paths[p].scan(buf + start, len) == expected);
+    }
+
+    // And the whole escape, against a byte-by-byte reference
+    for (int round = 0; round < 2000; round++)
+    {
+        size_t len = next_random() % 190;
+        fill_clean(buf, len);
+        for (int n = next_random() % 6; n > 0 && len; n--)
+            buf[next_random() % len] = (char)hits[next_random() % sizeof(hits)];
+
+        json_t out;
+        json_init(&out, NULL);
+        json_string_len(&out, buf, len);
+
+        char expected[200 * 6 + 3];
+        size_t e = 0;
+        expected[e++] = '"';
+        for (size_t i = 0; i < len; i++)
+        {
+            unsigned char c = (unsigned char)buf[i];
+            if (c == '"' || c == '\\')
+            {
+                expected[e++] = '\\';
+                expected[e++] = (char)c;
+            }
+            else if (c == '\n')
+            {
+                expected[e++] = '\\';
+                expected[e++] = 'n';
+            }
+            else if (c < 0x20)
+            {
+                e += (size_t)sprintf(expected + e, "\\u%04x", c);
+            }
+            else
+            {
+                expected[e++] = (char)c;
+            }
+        }
+        expected[e++] = '"';
+        expected[e] = '\0';
+
+        const char *text = json_text(&out);
+        CHECK(text && strcmp(text, expected) == 0);
+        json_free(&out);
+    }
+}
+
+int main(void)
+{
+    find_paths();
+    check_paths();
+
+    printf("%d vector scans checked against scalar\n", path_count - 1);
+    return check_failures != 0;
+}
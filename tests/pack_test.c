@@ -0,0 +1,308 @@
+// MessagePack and CBOR encodings at their size boundaries, byte for byte,
+// pack_close patching counts, and JSON re-encoded by pack_json/pack_post
+
+#include "support.h"
+#include "pack.h"
+#include <string.h>
+
+static Arena *arena;
+
+static void start(pack_t *pack, format_t format)
+{
+    arena_reset(arena);
+    pack_init(pack, arena, format);
+}
+
+// The pack holds exactly these bytes
+static bool bytes_are(const pack_t *pack, const char *expected, size_t len)
+{
+    return !pack->failed && pack->len == len && memcmp(pack->data, expected, len) == 0;
+}
+
+#define BYTES(pack, lit) bytes_are((pack), (lit), sizeof(lit) - 1)
+
+static bool int_is(format_t format, int64_t value, const char *expected, size_t len)
+{
+    pack_t p;
+    start(&p, format);
+    pack_int(&p, value);
+    return bytes_are(&p, expected, len);
+}
+
+#define MSGPACK_INT(value, lit) int_is(FORMAT_MSGPACK, (value), (lit), sizeof(lit) - 1)
+#define CBOR_INT(value, lit) int_is(FORMAT_CBOR, (value), (lit), sizeof(lit) - 1)
+
+static void test_msgpack_ints(void)
+{
+    // Positive fixint up to 127, then int32
+    CHECK(MSGPACK_INT(0, "\x00"));
+    CHECK(MSGPACK_INT(127, "\x7f"));
+    CHECK(MSGPACK_INT(128, "\xd2\x00\x00\x00\x80"));
+
+    // Negative fixint down to -32, then int32
+    CHECK(MSGPACK_INT(-1, "\xff"));
+    CHECK(MSGPACK_INT(-32, "\xe0"));
+    CHECK(MSGPACK_INT(-33, "\xd2\xff\xff\xff\xdf"));
+
+    // int32 to its limits, int64 past them
+    CHECK(MSGPACK_INT(INT32_MAX, "\xd2\x7f\xff\xff\xff"));
+    CHECK(MSGPACK_INT(INT32_MIN, "\xd2\x80\x00\x00\x00"));
+    CHECK(MSGPACK_INT((int64_t)INT32_MAX + 1, "\xd3\x00\x00\x00\x00\x80\x00\x00\x00"));
+    CHECK(MSGPACK_INT((int64_t)INT32_MIN - 1, "\xd3\xff\xff\xff\xff\x7f\xff\xff\xff"));
+    CHECK(MSGPACK_INT(INT64_MIN, "\xd3\x80\x00\x00\x00\x00\x00\x00\x00"));
+}
+
+static void test_cbor_ints(void)
+{
+    CHECK(CBOR_INT(0, "\x00"));
+    CHECK(CBOR_INT(23, "\x17"));
+    CHECK(CBOR_INT(24, "\x18\x18"));
+    CHECK(CBOR_INT(256, "\x19\x01\x00"));
+
+    // Major type 1 holds -1 - value
+    CHECK(CBOR_INT(-1, "\x20"));
+    CHECK(CBOR_INT(-24, "\x37"));
+    CHECK(CBOR_INT(-25, "\x38\x18"));
+    CHECK(CBOR_INT(-256, "\x38\xff"));
+    CHECK(CBOR_INT(-257, "\x39\x01\x00"));
+    CHECK(CBOR_INT(-65536, "\x39\xff\xff"));
+    CHECK(CBOR_INT(-65537, "\x3a\x00\x01\x00\x00"));
+    CHECK(CBOR_INT((int64_t)INT32_MIN, "\x3a\x7f\xff\xff\xff"));
+    CHECK(CBOR_INT(-4294967297, "\x3b\x00\x00\x00\x01\x00\x00\x00\x00"));
+    CHECK(CBOR_INT(INT64_MIN, "\x3b\x7f\xff\xff\xff\xff\xff\xff\xff"));
+}
+
+// A string of len 'x', and whether it starts with the given head
+static bool string_head_is(format_t format, size_t len, const char *head, size_t head_len)
+{
+    static char value[70000];
+    memset(value, 'x', len);
+
+    pack_t p;
+    start(&p, format);
+    pack_string_len(&p, value, len);
+
+    return !p.failed && p.len == head_len + len && memcmp(p.data, head, head_len) == 0 &&
+           memcmp(p.data + head_len, value, len) == 0;
+}
+
+#define MSGPACK_STR(len, lit) string_head_is(FORMAT_MSGPACK, (len), (lit), sizeof(lit) - 1)
+#define CBOR_STR(len, lit) string_head_is(FORMAT_CBOR, (len), (lit), sizeof(lit) - 1)
+
+static void test_strings(void)
+{
+    // fixstr up to 31, str8 to 255, str16 to 65535, then str32
+    CHECK(MSGPACK_STR(0, "\xa0"));
+    CHECK(MSGPACK_STR(31, "\xbf"));
+    CHECK(MSGPACK_STR(32, "\xd9\x20"));
+    CHECK(MSGPACK_STR(255, "\xd9\xff"));
+    CHECK(MSGPACK_STR(256, "\xda\x01\x00"));
+    CHECK(MSGPACK_STR(65535, "\xda\xff\xff"));
+    CHECK(MSGPACK_STR(65536, "\xdb\x00\x01\x00\x00"));
+
+    CHECK(CBOR_STR(0, "\x60"));
+    CHECK(CBOR_STR(23, "\x77"));
+    CHECK(CBOR_STR(24, "\x78\x18"));
+    CHECK(CBOR_STR(255, "\x78\xff"));
+    CHECK(CBOR_STR(256, "\x79\x01\x00"));
+    CHECK(CBOR_STR(65536, "\x7a\x00\x01\x00\x00"));
+
+    pack_t p;
+    start(&p, FORMAT_MSGPACK);
+    pack_string(&p, NULL);
+    CHECK(BYTES(&p, "\xc0"));
+}
+
+static void test_containers(void)
+{
+    pack_t p;
+
+    start(&p, FORMAT_MSGPACK);
+    pack_map(&p, 15);
+    pack_map(&p, 16);
+    pack_array(&p, 15);
+    pack_array(&p, 65535);
+    pack_array(&p, 65536);
+    CHECK(BYTES(&p, "\x8f\xde\x00\x10\x9f\xdc\xff\xff\xdd\x00\x01\x00\x00"));
+
+    start(&p, FORMAT_CBOR);
+    pack_map(&p, 23);
+    pack_map(&p, 24);
+    pack_array(&p, 0);
+    pack_array(&p, 256);
+    CHECK(BYTES(&p, "\xb7\xb8\x18\x80\x99\x01\x00"));
+
+    start(&p, FORMAT_MSGPACK);
+    pack_bool(&p, true);
+    pack_bool(&p, false);
+    pack_null(&p);
+    pack_double(&p, 1.5);
+    CHECK(BYTES(&p, "\xc3\xc2\xc0\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00"));
+
+    start(&p, FORMAT_CBOR);
+    pack_bool(&p, true);
+    pack_bool(&p, false);
+    pack_null(&p);
+    pack_double(&p, -2.0);
+    CHECK(BYTES(&p, "\xf5\xf4\xf6\xfb\xc0\x00\x00\x00\x00\x00\x00\x00"));
+}
+
+static void test_close(void)
+{
+    pack_t p;
+
+    // {"a": [1, 2], "b": {}}, every count patched in afterwards
+    start(&p, FORMAT_MSGPACK);
+    size_t map = pack_open_map(&p);
+    pack_string(&p, "a");
+    size_t list = pack_open_array(&p);
+    pack_int(&p, 1);
+    pack_int(&p, 2);
+    pack_close(&p, list, 2);
+    pack_string(&p, "b");
+    size_t inner = pack_open_map(&p);
+    pack_close(&p, inner, 0);
+    pack_close(&p, map, 2);
+    CHECK(BYTES(&p, "\xdf\x00\x00\x00\x02"
+                    "\xa1" "a" "\xdd\x00\x00\x00\x02\x01\x02"
+                    "\xa1" "b" "\xdf\x00\x00\x00\x00"));
+
+    start(&p, FORMAT_CBOR);
+    map = pack_open_map(&p);
+    pack_string(&p, "a");
+    list = pack_open_array(&p);
+    pack_int(&p, 1);
+    pack_int(&p, 2);
+    pack_close(&p, list, 2);
+    pack_string(&p, "b");
+    inner = pack_open_map(&p);
+    pack_close(&p, inner, 0);
+    pack_close(&p, map, 2);
+    CHECK(BYTES(&p, "\xba\x00\x00\x00\x02"
+                    "\x61" "a" "\x9a\x00\x00\x00\x02\x01\x02"
+                    "\x61" "b" "\xba\x00\x00\x00\x00"));
+
+    // Every byte of the count is written
+    for (int f = FORMAT_MSGPACK; f <= FORMAT_CBOR; f++)
+    {
+        start(&p, (format_t)f);
+        list = pack_open_array(&p);
+        for (uint32_t i = 0; i < 70000; i++)
+            pack_null(&p);
+        pack_close(&p, list, 0x01020304);
+
+        const unsigned char *d = (const unsigned char *)p.data;
+        CHECK(!p.failed && p.len == 5 + 70000);
+        CHECK(d[0] == (f == FORMAT_CBOR ? 0x9a : 0xdd));
+        CHECK(d[1] == 0x01 && d[2] == 0x02 && d[3] == 0x03 && d[4] == 0x04);
+    }
+
+    // Outside what was written, nothing is touched
+    start(&p, FORMAT_MSGPACK);
+    pack_int(&p, 1);
+    pack_close(&p, 0, 9);
+    pack_close(&p, 100, 9);
+    CHECK(BYTES(&p, "\x01"));
+}
+
+static void test_pack_json(void)
+{
+    pack_t p;
+
+    start(&p, FORMAT_MSGPACK);
+    CHECK(pack_json(&p, " {\"n\" : -33, \"s\" : \"\\u00e9\\ud83d\\ude00\\n\", \"l\" : [true, null, 0.5]} "));
+    CHECK(BYTES(&p, "\xdf\x00\x00\x00\x03"
+                    "\xa1" "n" "\xd2\xff\xff\xff\xdf"
+                    "\xa1" "s" "\xa7" "\xc3\xa9\xf0\x9f\x98\x80\n"
+                    "\xa1" "l" "\xdd\x00\x00\x00\x03\xc3\xc0\xcb\x3f\xe0\x00\x00\x00\x00\x00\x00"));
+
+    start(&p, FORMAT_CBOR);
+    CHECK(pack_json(&p, "[-25, \"\"]"));
+    CHECK(BYTES(&p, "\x9a\x00\x00\x00\x02\x38\x18\x60"));
+
+    static const char *malformed[] = {
+        "", "{", "[1,]", "{\"a\" 1}", "\"a", "\"\\x\"", "\"\\ud83d\"", "\"a\tb\"", "tru", "1 2", "-",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        start(&p, FORMAT_CBOR);
+        CHECK(!pack_json(&p, malformed[i]));
+    }
+
+    // Nesting stops at PACK_MAX_DEPTH
+    char deep[201];
+    memset(deep, '[', 100);
+    memset(deep + 100, ']', 100);
+    deep[200] = '\0';
+    start(&p, FORMAT_MSGPACK);
+    CHECK(!pack_json(&p, deep));
+}
+
+static void test_pack_post(void)
+{
+    pack_t p;
+
+    // As post_render and category_list store them
+    start(&p, FORMAT_MSGPACK);
+    CHECK(pack_post(&p, "{\"id\" : 7, \"is_hidden\" : false}", "[{\"id\": 1, \"slug\": \"c\"}]"));
+    CHECK(BYTES(&p, "\xdf\x00\x00\x00\x03"
+                    "\xa2" "id" "\x07"
+                    "\xa9" "is_hidden" "\xc2"
+                    "\xaa" "categories" "\xdd\x00\x00\x00\x01"
+                    "\xdf\x00\x00\x00\x02" "\xa2" "id" "\x01" "\xa4" "slug" "\xa1" "c"));
+
+    start(&p, FORMAT_CBOR);
+    CHECK(pack_post(&p, "{}", "[]"));
+    CHECK(BYTES(&p, "\xba\x00\x00\x00\x01" "\x6a" "categories" "\x9a\x00\x00\x00\x00"));
+
+    start(&p, FORMAT_CBOR);
+    CHECK(!pack_post(&p, "[]", "[]"));
+    start(&p, FORMAT_CBOR);
+    CHECK(!pack_post(&p, "{}", "[1,"));
+}
+
+static void test_accept_format(void)
+{
+    static const struct
+    {
+        const char *accept;
+        format_t format;
+    } cases[] = {
+        {"application/msgpack", FORMAT_MSGPACK},
+        {"application/x-msgpack", FORMAT_MSGPACK},
+        {"text/html, application/cbor;q=0.9", FORMAT_CBOR},
+        {"application/json,application/msgpack", FORMAT_MSGPACK},
+        {"application/msgpack-extra", FORMAT_JSON},
+        {"xapplication/cbor", FORMAT_JSON},
+        {"*/*", FORMAT_JSON},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        Req *req = request_with("Accept", cases[i].accept);
+        CHECK(accept_format(req) == cases[i].format);
+        request_delete(req);
+    }
+
+    CHECK(accept_format(NULL) == FORMAT_JSON);
+    CHECK(strcmp(format_content_type(FORMAT_CBOR), "application/cbor") == 0);
+}
+
+int main(void)
+{
+    arena = arena_new(1 << 20);
+    if (!arena)
+        return 1;
+
+    test_msgpack_ints();
+    test_cbor_ints();
+    test_strings();
+    test_containers();
+    test_close();
+    test_pack_json();
+    test_pack_post();
+    test_accept_format();
+
+    arena_delete(arena);
+    return check_failures != 0;
+}
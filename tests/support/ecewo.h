@@ -0,0 +1,19 @@
+#ifndef ECEWO_H
+#define ECEWO_H
+
+#include <stddef.h>
+
+// Stand-in for the few ecewo calls src/utils uses, so the tests and
+// benchmarks build and run without the framework, libuv or a server.
+// support.c implements them; support.h has the helpers to drive them.
+
+typedef struct Arena Arena;
+typedef struct Req Req;
+typedef struct Res Res;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *s);
+
+const char *get_header(Req *req, const char *name);
+
+#endif
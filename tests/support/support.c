@@ -0,0 +1,130 @@
+#include "support.h"
+#include "uv.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+struct Arena
+{
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct uv_loop_s
+{
+    uint64_t now;
+};
+
+static uv_loop_t loop;
+
+struct Req
+{
+    char *name;
+    char *value;
+};
+
+int check_failures = 0;
+
+Arena *arena_new(size_t size)
+{
+    Arena *arena = calloc(1, sizeof(Arena));
+    if (!arena)
+        return NULL;
+
+    arena->data = malloc(size);
+    if (!arena->data)
+    {
+        free(arena);
+        return NULL;
+    }
+
+    arena->cap = size;
+    return arena;
+}
+
+void arena_reset(Arena *arena)
+{
+    arena->len = 0;
+}
+
+void arena_delete(Arena *arena)
+{
+    if (!arena)
+        return;
+
+    free(arena->data);
+    free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    // Same alignment as malloc
+    size_t at = (arena->len + 15) & ~(size_t)15;
+    if (at + size > arena->cap)
+        return NULL;
+
+    arena->len = at + size;
+    return arena->data + at;
+}
+
+char *arena_strdup(Arena *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+Req *request_with(const char *name, const char *value)
+{
+    Req *req = calloc(1, sizeof(Req));
+    if (!req)
+        return NULL;
+
+    req->name = strdup(name);
+    req->value = strdup(value);
+    return req;
+}
+
+void request_delete(Req *req)
+{
+    if (!req)
+        return;
+
+    free(req->name);
+    free(req->value);
+    free(req);
+}
+
+const char *get_header(Req *req, const char *name)
+{
+    if (!req || strcasecmp(req->name, name) != 0)
+        return NULL;
+
+    return req->value;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uv_loop_t *uv_default_loop(void)
+{
+    return &loop;
+}
+
+uint64_t uv_now(const uv_loop_t *l)
+{
+    return l->now;
+}
+
+void set_now_ms(uint64_t ms)
+{
+    loop.now = ms;
+}
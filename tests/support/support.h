@@ -0,0 +1,41 @@
+#ifndef SUPPORT_H
+#define SUPPORT_H
+
+#include "ecewo.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Helpers shared by tests/ and bench/
+
+// Bump arena over one block, like a request's: allocations never call
+// malloc once it exists. arena_reset() reuses it for the next request.
+Arena *arena_new(size_t size);
+void arena_reset(Arena *arena);
+void arena_delete(Arena *arena);
+
+// A request carrying a single header, for accept_format and friends
+Req *request_with(const char *name, const char *value);
+void request_delete(Req *req);
+
+uint64_t now_ns(void);
+
+// What uv_now() returns from now on, for code that reads the loop clock
+void set_now_ms(uint64_t ms);
+
+// Number of failed CHECKs so far, main() returns it
+extern int check_failures;
+
+#define CHECK(cond)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (!(cond))                                                         \
+        {                                                                    \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            check_failures++;                                                \
+        }                                                                    \
+    } while (0)
+
+#endif
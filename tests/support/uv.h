@@ -0,0 +1,14 @@
+#ifndef UV_H
+#define UV_H
+
+#include <stdint.h>
+
+// Stand-in for the libuv clock src/cache reads. The loop's time only
+// moves when a test calls set_now_ms(), see support.h.
+
+typedef struct uv_loop_s uv_loop_t;
+
+uv_loop_t *uv_default_loop(void);
+uint64_t uv_now(const uv_loop_t *loop);
+
+#endif